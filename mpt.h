@@ -1,12 +1,16 @@
 #ifndef MPTEVENTS_MPT_H
 #define MPTEVENTS_MPT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef uint8_t u8;
+#ifndef _LINUX_TYPES_H
+// Already provided when the kernel uapi headers were included first
 typedef uint16_t __le16;
 typedef uint32_t __le32;
 typedef uint64_t __le64;
+#endif
 
 #define __user
 
@@ -18,14 +22,66 @@ typedef uint64_t __le64;
 #include "mpt3sas_ctl.h"
 
 #define MPT_EVENTS_LOG "/var/log/mptevents.log"
+#define MPT_STATE_DIR "/var/lib/mptevents"
+#define MPT_STATE_FILE MPT_STATE_DIR "/state"
 
 struct mpt_events {
 	struct mpt2_ioctl_header hdr;
 	struct MPT2_IOCTL_EVENTS event_data[MPT2SAS_CTL_EVENT_LOG_SIZE];
 };
 
-void dump_all_events(struct mpt_events *events, uint32_t *highest_context, int first_read);
+/* Per-IOC read position in the driver event ring */
+struct mpt_cursor {
+	uint32_t last_context; // Newest context already handed out
+	uint32_t last_event;   // Event code and data hash at last_context, to notice
+	uint32_t last_hash;    // the driver restarting its numbering
+	int primed;            // last_context is valid, otherwise everything is new
+	int skip_old;          // Don't hand out what is already there on the first read
+	uint64_t emitted;      // Events handed out so far
+	uint64_t lost;         // Events overwritten in the ring before we read them
+	uint64_t unchanged;    // Reads that had nothing new
+	uint64_t resets;       // Times the driver restarted its context numbering
+};
+
+// Event numbers the EVENTENABLE mask can express
+#define MPT_EVENT_TYPES (MPI2_EVENT_NOTIFY_EVENTMASK_WORDS * 32)
+
+/* The new events of one ring snapshot, in context order */
+struct mpt_window {
+	int count;
+	uint32_t lost;
+	int reset;                                // The driver restarted its numbering
+	int slot[MPT2SAS_CTL_EVENT_LOG_SIZE];     // Index into event_data
+	uint32_t gap[MPT2SAS_CTL_EVENT_LOG_SIZE]; // Events lost right before this one
+};
+
+uint32_t mpt_hash32(const void *buf, size_t len);
+void mpt_cursor_init(struct mpt_cursor *cursor);
+int mpt_cursor_window(struct mpt_cursor *cursor, const struct mpt_events *events,
+                      struct mpt_window *window);
+
+/* Cursors persisted across restarts, see mptstate.c */
+struct mpt_state_record;
+
+int mpt_state_open(const char *path);
+void mpt_state_close(void);
+struct mpt_state_record *mpt_state_get(int type, int ioc_id);
+int mpt_state_restore(const struct mpt_state_record *rec, struct mpt_cursor *cursor);
+void mpt_state_save(struct mpt_state_record *rec, const struct mpt_cursor *cursor);
+
+const char *mpt_event_name(unsigned event);
+int mpt_event_lookup(const char *name);
+
+void dump_event(struct MPT2_IOCTL_EVENTS *event, int ioc, uint64_t time_us);
+void dump_reset(int ioc, uint32_t context, uint64_t time_us);
+void dump_lost(int ioc, uint32_t count, uint32_t before_context, uint64_t time_us);
+void dump_repeated(int ioc, unsigned event, uint32_t first_context, uint32_t last_context,
+                   uint32_t count, uint32_t span_ms, uint64_t time_us);
+void dump_window(struct mpt_events *events, const struct mpt_window *window);
+int dump_all_events(struct mpt_events *events, struct mpt_cursor *cursor);
 
 extern void (*my_syslog)(int priority, const char *format, ...);
+// Logs a line that is already formatted, by default through my_syslog
+extern void (*my_syslog_line)(int priority, const char *line, size_t len);
 
 #endif
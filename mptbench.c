@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <syslog.h>
+
+#include "mpt.h"
+#include "mptdecode.h"
+#include "mptencode.h"
+
+/* Microbenchmarks of the payload encoders and the line formatting, run with
+ * "make bench"
+ */
+
+#define PAYLOAD 192
+#define PAYLOADS 1024
+#define ROUNDS 2000
+
+static uint8_t payloads[PAYLOADS][PAYLOAD];
+static char text[MPT_ENCODE_SIZE(PAYLOAD)];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The encoder the events were logged with before, for comparison */
+static inline char nibble_to_hex(char nibble)
+{
+	nibble &= 0xF;
+	if (nibble < 10)
+		return '0' + nibble;
+	else
+		return 'A' + nibble - 10;
+}
+
+static size_t old_buf2hex(const void *src, size_t len, char *hexbuf)
+{
+	const char *buf = src;
+	size_t i, j;
+
+	for (i = 0, j = 0; i < len; i++) {
+		hexbuf[j++] = nibble_to_hex(buf[i] >> 4);
+		hexbuf[j++] = nibble_to_hex(buf[i]);
+		hexbuf[j++] = ' ';
+	}
+	hexbuf[j] = 0;
+	return j;
+}
+
+/* Like the events we don't decode, a few leading bytes and zeros after */
+static void fill_payloads(int random_tail)
+{
+	int i, j;
+
+	for (i = 0; i < PAYLOADS; i++) {
+		for (j = 0; j < PAYLOAD; j++)
+			payloads[i][j] = (random_tail || j < 16) ? rand() : 0;
+	}
+}
+
+static void bench(const char *name, size_t (*encode)(const void *src, size_t len, char *dst))
+{
+	uint64_t start, ns;
+	size_t out = 0;
+	int r, i;
+
+	start = now_ns();
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < PAYLOADS; i++)
+			out += encode(payloads[i], PAYLOAD, text);
+	}
+	ns = now_ns() - start;
+
+	printf("  %-16s %8.1f ns/payload %8.1f MB/s in %8.1f MB/s out\n", name,
+	       (double)ns / (ROUNDS * PAYLOADS),
+	       (double)ROUNDS * PAYLOADS * PAYLOAD * 1000 / ns,
+	       (double)out * 1000 / ns);
+}
+
+static const char *const hex_impls[] = { "scalar", "ssse3", "avx2" };
+
+/* Every implementation has to match the old encoder, at any length */
+static int check(void)
+{
+	char expect[MPT_ENCODE_SIZE(PAYLOAD)];
+	unsigned i;
+	size_t len;
+
+	fill_payloads(1);
+	for (i = 0; i < sizeof(hex_impls) / sizeof(hex_impls[0]); i++) {
+		if (mpt_hex_select(hex_impls[i]) < 0)
+			continue;
+		for (len = 0; len <= PAYLOAD; len++) {
+			old_buf2hex(payloads[len], len, expect);
+			if (mpt_hex(payloads[len], len, text) != len * 3 || strcmp(text, expect) != 0) {
+				fprintf(stderr, "%s differs at length %zu\n", hex_impls[i], len);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Line formatting, the events go nowhere */
+
+#define LINE_EVENTS 64
+#define LINE_ROUNDS 20000
+
+static struct MPT2_IOCTL_EVENTS line_events[LINE_EVENTS];
+static uint64_t lines, line_bytes;
+
+static void count_line(int priority, const char *line, size_t len)
+{
+	lines++;
+	line_bytes += len;
+}
+
+// Where the original parser logs, it formats the line as vsyslog() does
+static void format_syslog(int priority, const char *format, ...)
+{
+	char buf[1024];
+	va_list ap;
+	int len;
+
+	va_start(ap, format);
+	len = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(buf))
+		len = sizeof(buf) - 1;
+	count_line(priority, buf, len);
+}
+
+/* The events were formatted with a printf each before the line builder. The
+ * Makefile takes that parser out of the first commit, and the names it
+ * shares with this tree are renamed here.
+ */
+#define my_syslog baseline_syslog
+#define dump_event baseline_dump_event
+#define dump_all_events baseline_dump_all_events
+#define nibble_to_hex baseline_nibble_to_hex
+#include "mptbench_baseline.c"
+#undef nibble_to_hex
+#undef dump_all_events
+#undef dump_event
+#undef my_syslog
+
+static void baseline_event(struct MPT2_IOCTL_EVENTS *event)
+{
+	baseline_dump_event(event, 1);
+}
+
+static void count_syslog(int priority, const char *format, ...)
+{
+	va_list ap;
+	const char *line;
+
+	// The lines are always passed as "%s"
+	va_start(ap, format);
+	line = va_arg(ap, const char *);
+	va_end(ap);
+	count_line(priority, line, strlen(line));
+}
+
+/* A mix like a flapping link logs: device status changes, topology changes
+ * with a few phys, phy counters and the odd event that isn't decoded.
+ */
+static void fill_line_events(void)
+{
+	static const uint32_t types[] = {
+		MPI2_EVENT_SAS_DEVICE_STATUS_CHANGE, MPI2_EVENT_SAS_DEVICE_STATUS_CHANGE,
+		MPI2_EVENT_SAS_TOPOLOGY_CHANGE_LIST, MPI2_EVENT_SAS_PHY_COUNTER,
+		MPI2_EVENT_SAS_DISCOVERY, MPI2_EVENT_STATE_CHANGE,
+	};
+	int i, j;
+
+	for (i = 0; i < LINE_EVENTS; i++) {
+		struct MPT2_IOCTL_EVENTS *event = &line_events[i];
+
+		memset(event, 0, sizeof(*event));
+		event->event = types[i % (sizeof(types) / sizeof(types[0]))];
+		event->context = 1000 + i;
+		for (j = 0; j < 32; j++)
+			event->data[j] = rand();
+		if (event->event == MPI2_EVENT_SAS_TOPOLOGY_CHANGE_LIST) {
+			MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST *topo = (void *)event->data;
+
+			topo->NumEntries = 4;
+		}
+	}
+}
+
+static void text_event(struct MPT2_IOCTL_EVENTS *event)
+{
+	struct mpt_record rec;
+
+	mpt_decode(event, 1, &rec);
+	mpt_record_text(&rec);
+}
+
+static void json_event(struct MPT2_IOCTL_EVENTS *event)
+{
+	struct mpt_record rec;
+
+	mpt_decode(event, 1, &rec);
+	mpt_record_json(&rec, LOG_INFO);
+}
+
+static void bench_lines(const char *name, void (*render)(struct MPT2_IOCTL_EVENTS *event))
+{
+	uint64_t start, ns;
+	int r, i;
+
+	lines = line_bytes = 0;
+	start = now_ns();
+	for (r = 0; r < LINE_ROUNDS; r++) {
+		for (i = 0; i < LINE_EVENTS; i++)
+			render(&line_events[i]);
+	}
+	ns = now_ns() - start;
+
+	printf("  %-16s %8.1f ns/line %10.0f lines/s %8.1f MB/s\n", name,
+	       (double)ns / lines, (double)lines * 1000000000 / ns, (double)line_bytes * 1000 / ns);
+}
+
+int main(void)
+{
+	int random_tail;
+	unsigned i;
+
+	if (check() < 0)
+		return 1;
+
+	for (random_tail = 0; random_tail <= 1; random_tail++) {
+		fill_payloads(random_tail);
+		printf("%d byte payloads, %s:\n", PAYLOAD, random_tail ? "random" : "16 bytes then zeros");
+
+		bench("buf2hex (old)", old_buf2hex);
+		for (i = 0; i < sizeof(hex_impls) / sizeof(hex_impls[0]); i++) {
+			char name[32];
+
+			if (mpt_hex_select(hex_impls[i]) < 0)
+				continue;
+			snprintf(name, sizeof(name), "hex %s", hex_impls[i]);
+			bench(name, mpt_hex);
+		}
+		// zrun spells out the bytes with the widest hex encoder again
+		for (i = sizeof(hex_impls) / sizeof(hex_impls[0]); i-- > 0;) {
+			if (mpt_hex_select(hex_impls[i]) == 0)
+				break;
+		}
+		bench("base64", mpt_base64);
+		bench("zrun", mpt_zrun);
+	}
+
+	fill_line_events();
+	my_syslog = count_syslog;
+	baseline_syslog = format_syslog;
+	my_syslog_line = count_line;
+	printf("Decoding and formatting lines:\n");
+	bench_lines("baseline printf", baseline_event);
+	bench_lines("line builder", text_event);
+	bench_lines("json", json_event);
+
+	return 0;
+}
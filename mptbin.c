@@ -0,0 +1,293 @@
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "mpt.h"
+#include "mptdecode.h"
+#include "mptbin.h"
+
+/* Writes the decoded records in the format of mptbin.h to a file, or to a
+ * collector listening on a unix socket. A collector that goes away or stops
+ * reading is dropped and reconnected later, the records in between are lost
+ * and counted.
+ */
+
+#define RECONNECT_MS 1000
+#define SEND_TIMEOUT_MS 200
+
+_Static_assert((int)MPT_RECORD_EVENT == MPT_BIN_EVENT && (int)MPT_RECORD_LOST == MPT_BIN_LOST &&
+               (int)MPT_RECORD_RESET == MPT_BIN_RESET && (int)MPT_RECORD_REPEATED == MPT_BIN_REPEATED,
+               "record kinds are written as they are");
+
+struct mpt_bin_stats mpt_bin_stats;
+
+static int bin_fd = -1;
+static const char *bin_path;
+static int bin_socket;       // bin_path is a unix socket rather than a file
+static int bin_failing;      // The last write failed, don't log every one
+static uint64_t reconnect_ms;
+
+static uint64_t bin_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int write_all(const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t ret;
+
+		if (bin_socket)
+			ret = send(bin_fd, p, len, MSG_NOSIGNAL);
+		else
+			ret = write(bin_fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int write_stream_hdr(void)
+{
+	struct mpt_bin_stream_hdr hdr;
+
+	memcpy(hdr.magic, MPT_BIN_MAGIC, sizeof(hdr.magic));
+	hdr.major = MPT_BIN_VERSION_MAJOR;
+	hdr.minor = MPT_BIN_VERSION_MINOR;
+	hdr.hdr_size = htole16(sizeof(hdr));
+
+	return write_all(&hdr, sizeof(hdr));
+}
+
+static int connect_collector(void)
+{
+	struct sockaddr_un addr;
+	struct timeval tv = { 0, SEND_TIMEOUT_MS * 1000 };
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		my_syslog(LOG_ERR, "Error creating binary records socket: %d (%m)", errno);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, bin_path, sizeof(addr.sun_path) - 1);
+
+	// A collector that stops reading is dropped rather than stall the output
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		if (!bin_failing)
+			my_syslog(LOG_WARNING, "Binary records collector %s is not there: %d (%m)", bin_path, errno);
+		bin_failing = 1;
+		close(fd);
+		return -1;
+	}
+
+	bin_fd = fd;
+	if (write_stream_hdr() < 0) {
+		close(bin_fd);
+		bin_fd = -1;
+		return -1;
+	}
+
+	if (bin_failing)
+		my_syslog(LOG_INFO, "Binary records collector %s is back", bin_path);
+	bin_failing = 0;
+	mpt_bin_stats.connects++;
+	return 0;
+}
+
+/* A file target is written as is, "unix:PATH" connects to a collector */
+int mpt_bin_open(const char *target)
+{
+	struct stat st;
+
+	if (strncmp(target, "unix:", 5) == 0) {
+		bin_socket = 1;
+		bin_path = target + 5;
+		if (strlen(bin_path) >= sizeof(((struct sockaddr_un *)0)->sun_path)) {
+			my_syslog(LOG_ERR, "Binary records socket path %s is too long", bin_path);
+			return -1;
+		}
+		// Not being able to connect yet is fine, it is retried as records come
+		connect_collector();
+		return 0;
+	}
+
+	bin_socket = 0;
+	bin_path = target;
+	bin_fd = open(bin_path, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0644);
+	if (bin_fd < 0) {
+		my_syslog(LOG_ERR, "Error opening binary records file %s: %d (%m)", bin_path, errno);
+		return -1;
+	}
+
+	// Appending to the records of an earlier run, the header is already there
+	if (fstat(bin_fd, &st) == 0 && st.st_size > 0)
+		return 0;
+
+	if (write_stream_hdr() < 0) {
+		my_syslog(LOG_ERR, "Error writing binary records file %s: %d (%m)", bin_path, errno);
+		close(bin_fd);
+		bin_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+void mpt_bin_close(void)
+{
+	if (bin_fd >= 0)
+		close(bin_fd);
+	bin_fd = -1;
+}
+
+struct bin_buf {
+	size_t len;
+	uint8_t data[MPT_BIN_MAX_RECORD];
+};
+
+static int put_field(struct bin_buf *buf, uint8_t type, const char *name, const void *value, size_t size)
+{
+	struct mpt_bin_field_hdr hdr;
+	size_t name_len = strlen(name);
+
+	if (buf->len + sizeof(hdr) + name_len + size > sizeof(buf->data))
+		return -1;
+
+	hdr.type = type;
+	hdr.name_len = name_len;
+	hdr.size = htole16(size);
+	memcpy(buf->data + buf->len, &hdr, sizeof(hdr));
+	memcpy(buf->data + buf->len + sizeof(hdr), name, name_len);
+	memcpy(buf->data + buf->len + sizeof(hdr) + name_len, value, size);
+	buf->len += sizeof(hdr) + name_len + size;
+
+	return 0;
+}
+
+static const uint8_t bin_types[] = {
+	[MPT_FIELD_UINT] = MPT_BIN_UINT,
+	[MPT_FIELD_INT] = MPT_BIN_INT,
+	[MPT_FIELD_HEX] = MPT_BIN_HEX,
+	[MPT_FIELD_HEXUP] = MPT_BIN_HEX,
+	[MPT_FIELD_SAS] = MPT_BIN_SAS,
+	[MPT_FIELD_BYTES] = MPT_BIN_BYTES,
+};
+
+static int put_fields(struct bin_buf *buf, const struct mpt_field *fields, int fields_nr,
+                      const uint8_t *data, const uint64_t *values)
+{
+	int i;
+
+	for (i = 0; i < fields_nr; i++) {
+		const struct mpt_field *field = &fields[i];
+		uint64_t le = htole64(values[i]);
+		const void *value = &le; // The low bytes
+
+		if (field->format == MPT_FIELD_BYTES)
+			value = data + field->offset;
+		if (put_field(buf, bin_types[field->format], field->name, value, field->size) < 0)
+			return -1;
+	}
+
+	return fields_nr;
+}
+
+static size_t encode_record(const struct mpt_record *rec, struct bin_buf *buf)
+{
+	const struct mpt_event_desc *desc = rec->desc;
+	const struct mpt_list_desc *list = desc->list;
+	struct mpt_bin_record_hdr hdr;
+	size_t name_len = strlen(desc->name);
+	int fields;
+	unsigned i;
+
+	buf->len = sizeof(hdr);
+	memcpy(buf->data + buf->len, desc->name, name_len);
+	buf->len += name_len;
+
+	fields = put_fields(buf, desc->fields, desc->fields_nr, rec->data, rec->value);
+	for (i = 0; list && fields >= 0 && i < rec->entries_nr; i++) {
+		const uint8_t *entry = rec->data + list->offset + i * list->entry_size;
+		int entry_fields;
+
+		if (put_field(buf, MPT_BIN_ENTRY, list->name, NULL, 0) < 0)
+			break;
+		entry_fields = put_fields(buf, list->fields, list->fields_nr, entry, rec->entry[i]);
+		if (entry_fields < 0)
+			break;
+		fields += 1 + entry_fields;
+	}
+
+	hdr.length = htole32(buf->len);
+	hdr.kind = rec->kind;
+	hdr.name_len = name_len;
+	hdr.event = htole16(rec->event);
+	hdr.ioc = htole32(rec->ioc);
+	hdr.context = htole32(rec->context);
+	hdr.time_us = htole64(rec->time_us);
+	hdr.fields = htole16(fields);
+	memcpy(buf->data, &hdr, sizeof(hdr));
+
+	return buf->len;
+}
+
+void mpt_bin_record(const struct mpt_record *rec)
+{
+	static struct bin_buf buf; // Only ever written from the one output thread
+	size_t len;
+
+	if (bin_fd < 0) {
+		uint64_t now = bin_now_ms();
+
+		if (!bin_socket || now < reconnect_ms || connect_collector() < 0) {
+			if (bin_socket && now >= reconnect_ms)
+				reconnect_ms = now + RECONNECT_MS;
+			mpt_bin_stats.dropped++;
+			return;
+		}
+	}
+
+	len = encode_record(rec, &buf);
+	if (write_all(buf.data, len) < 0) {
+		mpt_bin_stats.dropped++;
+		if (!bin_failing)
+			my_syslog(LOG_ERR, "Error writing binary records to %s: %d (%m)", bin_path, errno);
+		bin_failing = 1;
+
+		// What the collector got is cut in the middle of a record, start over
+		if (bin_socket) {
+			close(bin_fd);
+			bin_fd = -1;
+			reconnect_ms = bin_now_ms() + RECONNECT_MS;
+		}
+		return;
+	}
+
+	bin_failing = 0;
+	mpt_bin_stats.records++;
+	mpt_bin_stats.bytes += len;
+}
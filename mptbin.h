@@ -0,0 +1,116 @@
+#ifndef MPTEVENTS_MPTBIN_H
+#define MPTEVENTS_MPTBIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Binary event records, for collectors that would rather not parse the text.
+ *
+ * A stream (a file, or each connection to a unix socket) starts with a
+ * struct mpt_bin_stream_hdr and continues with records. Each record is a
+ * struct mpt_bin_record_hdr, the name of the event and then the fields. A
+ * field is a struct mpt_bin_field_hdr, its name and its value. Everything is
+ * little endian and nothing is padded.
+ *
+ * Readers skip what they don't know: the record length covers the whole
+ * record and a newer minor version only ever adds field types and kinds.
+ * The reader below does that for you.
+ */
+
+#define MPT_BIN_MAGIC "MPTB"
+#define MPT_BIN_VERSION_MAJOR 1
+#define MPT_BIN_VERSION_MINOR 0
+
+#define MPT_BIN_MAX_RECORD 16384
+
+struct mpt_bin_stream_hdr {
+	char magic[4];
+	uint8_t major;
+	uint8_t minor;
+	uint16_t hdr_size; // Of this header, later versions may add to it
+} __attribute__((packed));
+
+enum mpt_bin_kind {
+	MPT_BIN_EVENT,    // An event from the driver
+	MPT_BIN_LOST,     // Events before the context were overwritten before they were read
+	MPT_BIN_RESET,    // The driver restarted its numbering at the context
+	MPT_BIN_REPEATED, // Repeats of the event at the context, when coalescing
+};
+
+struct mpt_bin_record_hdr {
+	uint32_t length;   // Of the whole record, this header included
+	uint8_t kind;
+	uint8_t name_len;  // The event name follows the header
+	uint16_t event;    // MPI2_EVENT_*
+	int32_t ioc;
+	uint32_t context;
+	uint64_t time_us;  // When it was read from the driver, 0 if unknown
+	uint16_t fields;   // Including the list entry markers
+} __attribute__((packed));
+
+enum mpt_bin_type {
+	MPT_BIN_UINT,  // 1, 2, 4 or 8 bytes
+	MPT_BIN_INT,   // 1, 2, 4 or 8 bytes, signed
+	MPT_BIN_HEX,   // Unsigned, shown in hex
+	MPT_BIN_SAS,   // 8 byte SAS address
+	MPT_BIN_BYTES, // Raw payload bytes
+	MPT_BIN_ENTRY, // No value, the fields that follow belong to a list entry of that name
+};
+
+struct mpt_bin_field_hdr {
+	uint8_t type;
+	uint8_t name_len;
+	uint16_t size; // Of the value, which follows the name
+} __attribute__((packed));
+
+/* Reader */
+
+struct mpt_bin_reader {
+	int fd;
+	int started;   // The stream header was read
+	uint8_t minor;
+	size_t start;  // Of the unread data in buf
+	size_t end;
+	uint8_t buf[2 * MPT_BIN_MAX_RECORD];
+};
+
+struct mpt_bin_record {
+	uint8_t kind;
+	uint16_t event;
+	int32_t ioc;
+	uint32_t context;
+	uint64_t time_us;
+	const char *name; // Not NUL terminated
+	uint8_t name_len;
+	uint16_t fields;
+	const uint8_t *data; // The fields, valid until the next read
+	size_t data_len;
+};
+
+struct mpt_bin_field {
+	uint8_t type;
+	const char *name; // Not NUL terminated
+	uint8_t name_len;
+	uint16_t size;
+	const uint8_t *value;
+	int entry; // Index of the list entry the field is in, -1 for the event itself
+};
+
+struct mpt_bin_field_iter {
+	const struct mpt_bin_record *rec;
+	size_t pos;
+	int entry;
+};
+
+void mpt_bin_reader_init(struct mpt_bin_reader *reader, int fd);
+// Returns 1 with a record, 0 at the end of the stream and -1 on a read or format error
+int mpt_bin_read(struct mpt_bin_reader *reader, struct mpt_bin_record *rec);
+
+void mpt_bin_fields(const struct mpt_bin_record *rec, struct mpt_bin_field_iter *iter);
+// Returns 1 with a field, 0 after the last one and -1 if the record is corrupt
+int mpt_bin_next_field(struct mpt_bin_field_iter *iter, struct mpt_bin_field *field);
+
+uint64_t mpt_bin_uint(const struct mpt_bin_field *field);
+int64_t mpt_bin_int(const struct mpt_bin_field *field);
+
+#endif
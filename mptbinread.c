@@ -0,0 +1,199 @@
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mptbin.h"
+
+/* Reader for the binary records, it only depends on mptbin.h so collectors
+ * can build it on its own.
+ */
+
+void mpt_bin_reader_init(struct mpt_bin_reader *reader, int fd)
+{
+	reader->fd = fd;
+	reader->started = 0;
+	reader->minor = 0;
+	reader->start = 0;
+	reader->end = 0;
+}
+
+/* Have at least need bytes buffered. Returns 0 if the stream ended cleanly
+ * before any of them, -1 if it ended in the middle.
+ */
+static int fill(struct mpt_bin_reader *reader, size_t need)
+{
+	while (reader->end - reader->start < need) {
+		ssize_t ret;
+
+		if (reader->start + need > sizeof(reader->buf)) {
+			memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+			reader->end -= reader->start;
+			reader->start = 0;
+		}
+
+		ret = read(reader->fd, reader->buf + reader->end, sizeof(reader->buf) - reader->end);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0)
+			return reader->end == reader->start ? 0 : -1;
+		reader->end += ret;
+	}
+
+	return 1;
+}
+
+static int read_stream_hdr(struct mpt_bin_reader *reader)
+{
+	struct mpt_bin_stream_hdr hdr;
+	int ret;
+
+	ret = fill(reader, sizeof(hdr));
+	if (ret <= 0)
+		return ret;
+
+	memcpy(&hdr, reader->buf + reader->start, sizeof(hdr));
+	hdr.hdr_size = le16toh(hdr.hdr_size);
+	if (memcmp(hdr.magic, MPT_BIN_MAGIC, sizeof(hdr.magic)) != 0 || hdr.major != MPT_BIN_VERSION_MAJOR ||
+	    hdr.hdr_size < sizeof(hdr) || hdr.hdr_size > MPT_BIN_MAX_RECORD) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	if (fill(reader, hdr.hdr_size) <= 0)
+		return -1;
+	reader->start += hdr.hdr_size;
+	reader->minor = hdr.minor;
+	reader->started = 1;
+
+	return 1;
+}
+
+int mpt_bin_read(struct mpt_bin_reader *reader, struct mpt_bin_record *rec)
+{
+	struct mpt_bin_record_hdr hdr;
+	const uint8_t *p;
+	uint32_t length;
+	int ret;
+
+	if (!reader->started) {
+		ret = read_stream_hdr(reader);
+		if (ret <= 0)
+			return ret;
+	}
+
+	ret = fill(reader, sizeof(length));
+	if (ret <= 0)
+		return ret;
+
+	memcpy(&length, reader->buf + reader->start, sizeof(length));
+	length = le32toh(length);
+	if (length < sizeof(hdr) || length > MPT_BIN_MAX_RECORD) {
+		errno = EPROTO;
+		return -1;
+	}
+	if (fill(reader, length) <= 0)
+		return -1;
+
+	p = reader->buf + reader->start;
+	memcpy(&hdr, p, sizeof(hdr));
+	if (hdr.name_len > length - sizeof(hdr)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	rec->kind = hdr.kind;
+	rec->event = le16toh(hdr.event);
+	rec->ioc = (int32_t)le32toh(hdr.ioc);
+	rec->context = le32toh(hdr.context);
+	rec->time_us = le64toh(hdr.time_us);
+	rec->name = (const char *)p + sizeof(hdr);
+	rec->name_len = hdr.name_len;
+	rec->fields = le16toh(hdr.fields);
+	rec->data = p + sizeof(hdr) + hdr.name_len;
+	rec->data_len = length - sizeof(hdr) - hdr.name_len;
+
+	reader->start += length;
+	return 1;
+}
+
+void mpt_bin_fields(const struct mpt_bin_record *rec, struct mpt_bin_field_iter *iter)
+{
+	iter->rec = rec;
+	iter->pos = 0;
+	iter->entry = -1;
+}
+
+int mpt_bin_next_field(struct mpt_bin_field_iter *iter, struct mpt_bin_field *field)
+{
+	const struct mpt_bin_record *rec = iter->rec;
+	struct mpt_bin_field_hdr hdr;
+	size_t left = rec->data_len - iter->pos;
+
+	if (left == 0)
+		return 0;
+	if (left < sizeof(hdr))
+		return -1;
+
+	memcpy(&hdr, rec->data + iter->pos, sizeof(hdr));
+	hdr.size = le16toh(hdr.size);
+	if (left - sizeof(hdr) < (size_t)hdr.name_len + hdr.size)
+		return -1;
+
+	if (hdr.type == MPT_BIN_ENTRY)
+		iter->entry++;
+
+	field->type = hdr.type;
+	field->name = (const char *)rec->data + iter->pos + sizeof(hdr);
+	field->name_len = hdr.name_len;
+	field->size = hdr.size;
+	field->value = rec->data + iter->pos + sizeof(hdr) + hdr.name_len;
+	field->entry = iter->entry;
+
+	iter->pos += sizeof(hdr) + hdr.name_len + hdr.size;
+	return 1;
+}
+
+uint64_t mpt_bin_uint(const struct mpt_bin_field *field)
+{
+	uint8_t v8;
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (field->size) {
+		case 1:
+			memcpy(&v8, field->value, sizeof(v8));
+			return v8;
+		case 2:
+			memcpy(&v16, field->value, sizeof(v16));
+			return le16toh(v16);
+		case 4:
+			memcpy(&v32, field->value, sizeof(v32));
+			return le32toh(v32);
+		case 8:
+			memcpy(&v64, field->value, sizeof(v64));
+			return le64toh(v64);
+	}
+
+	return 0;
+}
+
+int64_t mpt_bin_int(const struct mpt_bin_field *field)
+{
+	uint64_t v = mpt_bin_uint(field);
+
+	switch (field->size) {
+		case 1:
+			return (int8_t)v;
+		case 2:
+			return (int16_t)v;
+		case 4:
+			return (int32_t)v;
+	}
+
+	return v;
+}
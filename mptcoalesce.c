@@ -0,0 +1,197 @@
+#include <memory.h>
+#include <syslog.h>
+
+#include "mpt.h"
+#include "mptring.h"
+#include "mptcoalesce.h"
+
+/* A flapping link produces the same few events over and over. The first one
+ * of a kind goes out as usual, the repeats that follow within the window are
+ * only counted and summarised in a single line when the window is over.
+ *
+ * The events are kept in a small open addressing table, when it fills up the
+ * oldest entry is summarised early to make room.
+ */
+
+#define COALESCE_SLOTS 256 // Power of two
+#define COALESCE_MAX 192   // Keep the probe sequences short
+
+#define KEY_SIZE sizeof(((struct MPT2_IOCTL_EVENTS *)0)->data)
+
+struct coalesce_entry {
+	int used;
+	uint32_t hash;
+	int ioc;
+	uint32_t event;
+	uint8_t key[KEY_SIZE];
+	uint32_t first_context; // The one that was reported
+	uint32_t last_context;
+	uint32_t count;         // Repeats held back
+	uint64_t first_us;
+	uint64_t last_us;
+	uint64_t deadline_ms;
+};
+
+static struct coalesce_entry table[COALESCE_SLOTS];
+static unsigned entries_nr;
+static unsigned window_ms;
+
+void mpt_coalesce_init(unsigned ms)
+{
+	memset(table, 0, sizeof(table));
+	entries_nr = 0;
+	window_ms = ms;
+}
+
+/* Only the fields that tell what happened to which device make the key, a
+ * device status change differs in its task tag and sense data between
+ * otherwise identical resets. Anything else has to match in full.
+ */
+static void event_key(const struct MPT2_IOCTL_EVENTS *event, uint8_t *key)
+{
+	if (event->event == MPI2_EVENT_SAS_DEVICE_STATUS_CHANGE) {
+		const MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE *evt = (const void *)event->data;
+		MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE *k = (void *)key;
+
+		memset(key, 0, KEY_SIZE);
+		k->ReasonCode = evt->ReasonCode;
+		k->DevHandle = evt->DevHandle;
+		k->SASAddress = evt->SASAddress;
+		return;
+	}
+
+	memcpy(key, event->data, KEY_SIZE);
+}
+
+static void summarise(struct coalesce_entry *entry)
+{
+	if (entry->count)
+		dump_repeated(entry->ioc, entry->event, entry->first_context, entry->last_context,
+				entry->count, (entry->last_us - entry->first_us) / 1000, entry->last_us);
+}
+
+/* Backward shift deletion, keeps every probe sequence without holes */
+static void remove_entry(unsigned i)
+{
+	unsigned j = i;
+
+	table[i].used = 0;
+	entries_nr--;
+
+	for (;;) {
+		unsigned home;
+
+		j = (j + 1) & (COALESCE_SLOTS - 1);
+		if (!table[j].used)
+			break;
+
+		// Move the entry back unless its home slot is between the hole and itself
+		home = table[j].hash & (COALESCE_SLOTS - 1);
+		if (i <= j ? (home > i && home <= j) : (home > i || home <= j))
+			continue;
+
+		table[i] = table[j];
+		table[j].used = 0;
+		i = j;
+	}
+}
+
+static void evict_oldest(void)
+{
+	unsigned oldest = 0;
+	unsigned i;
+
+	for (i = 1; i < COALESCE_SLOTS; i++) {
+		if (table[i].used && (!table[oldest].used || table[i].deadline_ms < table[oldest].deadline_ms))
+			oldest = i;
+	}
+
+	summarise(&table[oldest]);
+	remove_entry(oldest);
+}
+
+int mpt_coalesce_event(const struct mpt_raw_event *raw, uint64_t now_ms)
+{
+	uint8_t key[KEY_SIZE];
+	struct coalesce_entry *entry;
+	uint32_t hash;
+	unsigned i;
+
+	if (!window_ms)
+		return 0;
+
+	event_key(&raw->event, key);
+	hash = mpt_hash32(key, sizeof(key)) ^ (raw->event.event * 16777619u) ^ raw->ioc;
+
+	for (i = hash & (COALESCE_SLOTS - 1); table[i].used; i = (i + 1) & (COALESCE_SLOTS - 1)) {
+		entry = &table[i];
+
+		if (entry->hash != hash || entry->ioc != raw->ioc || entry->event != raw->event.event ||
+		    memcmp(entry->key, key, sizeof(key)) != 0)
+			continue;
+
+		if (now_ms >= entry->deadline_ms) {
+			// Its window is over, report this one and start a new window
+			summarise(entry);
+			remove_entry(i);
+			break;
+		}
+
+		entry->count++;
+		entry->last_context = raw->event.context;
+		entry->last_us = raw->time_us;
+		return 1;
+	}
+
+	if (entries_nr == COALESCE_MAX)
+		evict_oldest();
+
+	for (i = hash & (COALESCE_SLOTS - 1); table[i].used; i = (i + 1) & (COALESCE_SLOTS - 1))
+		;
+
+	entry = &table[i];
+	entry->used = 1;
+	entry->hash = hash;
+	entry->ioc = raw->ioc;
+	entry->event = raw->event.event;
+	memcpy(entry->key, key, sizeof(key));
+	entry->first_context = entry->last_context = raw->event.context;
+	entry->count = 0;
+	entry->first_us = entry->last_us = raw->time_us;
+	entry->deadline_ms = now_ms + window_ms;
+	entries_nr++;
+
+	return 0;
+}
+
+/* Summarise the entries whose window is over, with ioc >= 0 also all of the
+ * entries of that IOC and with ioc == MPT_COALESCE_ALL everything.
+ * Returns the earliest deadline left or 0 if the table is empty.
+ */
+uint64_t mpt_coalesce_expire(uint64_t now_ms, int ioc)
+{
+	uint64_t next = 0;
+	unsigned i = 0;
+
+	while (i < COALESCE_SLOTS) {
+		struct coalesce_entry *entry = &table[i];
+
+		if (!entry->used) {
+			i++;
+			continue;
+		}
+
+		if (now_ms >= entry->deadline_ms || ioc == MPT_COALESCE_ALL || entry->ioc == ioc) {
+			summarise(entry);
+			// Another entry may shift into this slot, look at it again
+			remove_entry(i);
+			continue;
+		}
+
+		if (!next || entry->deadline_ms < next)
+			next = entry->deadline_ms;
+		i++;
+	}
+
+	return next;
+}
@@ -0,0 +1,13 @@
+#ifndef MPTEVENTS_MPTCOALESCE_H
+#define MPTEVENTS_MPTCOALESCE_H
+
+#include "mptring.h"
+
+#define MPT_COALESCE_NONE -1 // Only what expired
+#define MPT_COALESCE_ALL -2
+
+void mpt_coalesce_init(unsigned window_ms);
+int mpt_coalesce_event(const struct mpt_raw_event *raw, uint64_t now_ms);
+uint64_t mpt_coalesce_expire(uint64_t now_ms, int ioc);
+
+#endif
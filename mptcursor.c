@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "mpt.h"
+
+/* The driver keeps the last MPT2SAS_CTL_EVENT_LOG_SIZE events in a ring and
+ * stamps each one with a running context number. We always get a copy of the
+ * whole ring, so the cursor has to work out which part of it we did not see
+ * yet and whether the ring wrapped past events we never got to read.
+ */
+
+void mpt_cursor_init(struct mpt_cursor *cursor)
+{
+	memset(cursor, 0, sizeof(*cursor));
+}
+
+uint32_t mpt_hash32(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint32_t hash = 2166136261u;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Context numbers wrap, compare them as a signed distance */
+static inline int context_after(uint32_t a, uint32_t b)
+{
+	return (int32_t)(a - b) > 0;
+}
+
+int mpt_cursor_window(struct mpt_cursor *cursor, const struct mpt_events *events,
+                      struct mpt_window *window)
+{
+	const struct MPT2_IOCTL_EVENTS *slots = events->event_data;
+	int newest = -1;
+	int anchor = -1;
+	int i, n;
+	uint32_t expected;
+
+	window->count = 0;
+	window->lost = 0;
+	window->reset = 0;
+
+	for (i = 0; i < MPT2SAS_CTL_EVENT_LOG_SIZE; i++) {
+		if (!slots[i].event)
+			continue;
+		if (newest < 0 || context_after(slots[i].context, slots[newest].context))
+			newest = i;
+		if (slots[i].context == cursor->last_context)
+			anchor = i;
+	}
+
+	if (newest < 0) {
+		cursor->skip_old = 0;
+		return 0;
+	}
+
+	if (!cursor->primed && cursor->skip_old) {
+		// Start from the current position without handing out the backlog
+		cursor->skip_old = 0;
+		goto Advance;
+	}
+
+	/* The last event we handed out is still in the ring, if it is not the
+	 * same event any more the driver restarted its numbering under us.
+	 */
+	if (cursor->primed && anchor >= 0 &&
+	    (slots[anchor].event != cursor->last_event ||
+	     mpt_hash32(slots[anchor].data, sizeof(slots[anchor].data)) != cursor->last_hash)) {
+		cursor->resets++;
+		cursor->primed = 0;
+		window->reset = 1;
+	}
+
+	if (cursor->primed) {
+		if (slots[newest].context == cursor->last_context) {
+			// Nothing new since the last read, no need to look further
+			cursor->unchanged++;
+			return 0;
+		}
+
+		if (!context_after(slots[newest].context, cursor->last_context)) {
+			// The driver restarted its numbering (IOC reset or driver reload)
+			cursor->resets++;
+			cursor->primed = 0;
+			window->reset = 1;
+		}
+	}
+
+	/* The driver fills the ring in context order, so starting right after
+	 * the newest slot gives us the oldest one. Collect everything we did not
+	 * see yet and keep it sorted in case the ring is not perfectly ordered.
+	 */
+	for (i = 1; i <= MPT2SAS_CTL_EVENT_LOG_SIZE; i++) {
+		int slot = (newest + i) % MPT2SAS_CTL_EVENT_LOG_SIZE;
+		uint32_t context = slots[slot].context;
+
+		if (!slots[slot].event)
+			continue;
+		if (cursor->primed && !context_after(context, cursor->last_context))
+			continue;
+
+		for (n = window->count; n > 0 && context_after(slots[window->slot[n-1]].context, context); n--)
+			window->slot[n] = window->slot[n-1];
+		window->slot[n] = slot;
+		window->count++;
+	}
+
+	/* Any hole in the context numbering is an event the driver overwrote
+	 * before we got to it. Before the first read we can't know what we
+	 * missed so only holes inside the window count.
+	 */
+	expected = cursor->primed ? cursor->last_context + 1 : slots[window->slot[0]].context;
+	for (i = 0; i < window->count; i++) {
+		uint32_t context = slots[window->slot[i]].context;
+
+		window->gap[i] = context_after(context, expected) ? context - expected : 0;
+		window->lost += window->gap[i];
+		expected = context + 1;
+	}
+
+	cursor->emitted += window->count;
+	cursor->lost += window->lost;
+
+Advance:
+	cursor->last_context = slots[newest].context;
+	cursor->last_event = slots[newest].event;
+	cursor->last_hash = mpt_hash32(slots[newest].data, sizeof(slots[newest].data));
+	cursor->primed = 1;
+
+	return window->count;
+}
@@ -0,0 +1,137 @@
+#ifndef MPTEVENTS_MPTDECODE_H
+#define MPTEVENTS_MPTDECODE_H
+
+#include <stddef.h>
+
+#include "mpt.h"
+
+/* Each event type is described by a table of its fields, a single engine
+ * decodes any event into a struct mpt_record from that and the output
+ * formats only ever look at the record.
+ */
+
+enum mpt_field_format {
+	MPT_FIELD_UINT,  // Decimal
+	MPT_FIELD_INT,   // Signed decimal
+	MPT_FIELD_HEX,   // Lower case hex, zero padded to digits
+	MPT_FIELD_HEXUP, // Upper case hex, zero padded to digits
+	MPT_FIELD_SAS,   // SAS address
+	MPT_FIELD_BYTES, // Raw bytes in the payload encoding, size is the byte count
+};
+
+#define MPT_FIELD_QUOTE  0x01 // Text output puts the value in single quotes
+#define MPT_FIELD_HANDLE 0x02 // A device handle, the journal indexes it as DEV_HANDLE
+#define MPT_FIELD_REASON 0x04 // Why the event happened, the journal indexes it as REASON
+
+#define MPT_TEXT_SIZE 512 // Enough for any meaning, all of the discovery status flags take 376
+
+/* Returns the meaning of the value, either a constant string or the text
+ * built in buf.
+ */
+typedef const char *(*mpt_text_fn)(uint32_t value, char *buf, size_t size);
+
+struct mpt_field {
+	const char *name;
+	uint8_t offset;
+	uint8_t size;    // 1, 2, 4 or 8 bytes, little endian
+	uint8_t format;
+	uint8_t digits;
+	uint8_t flags;
+	mpt_text_fn text; // The meaning of the value, if it has one
+};
+
+/* Events that carry a variable number of entries after their fixed part */
+struct mpt_list_desc {
+	const char *name;
+	uint8_t count_offset; // Of the one byte entry count
+	uint8_t offset;       // Of the first entry
+	uint8_t entry_size;
+	const struct mpt_field *fields;
+	uint8_t fields_nr;
+	const char *json_name; // Of the array of entries in JSON output
+};
+
+#define MPT_HDR_IOC   0x01 // Text output starts with ioc=
+#define MPT_HDR_EVENT 0x02 // Text output starts with event= before the context
+
+struct mpt_event_desc {
+	const char *name;
+	uint8_t header;
+	const struct mpt_field *fields;
+	uint8_t fields_nr;
+	const struct mpt_list_desc *list;
+};
+
+#define MPT_MAX_FIELDS 16
+#define MPT_MAX_ENTRIES 45 // SAS topology phy entries that fit in the payload
+#define MPT_MAX_ENTRY_FIELDS 8
+
+enum mpt_record_kind {
+	MPT_RECORD_EVENT,
+	MPT_RECORD_LOST,     // Events before the context were overwritten before they were read
+	MPT_RECORD_RESET,    // The driver restarted its numbering at the context
+	MPT_RECORD_REPEATED, // Repeats of the event at the context, see mptcoalesce.c
+};
+
+struct mpt_record {
+	uint8_t kind;
+	const struct mpt_event_desc *desc;
+	int ioc;
+	uint32_t event;
+	uint32_t context;
+	uint64_t time_us;     // When it was read from the driver, 0 if unknown
+	const uint8_t *data;  // The raw payload, bytes fields point into it
+	uint64_t value[MPT_MAX_FIELDS];
+	unsigned entries_total; // As the event claims
+	unsigned entries_nr;    // As many of them as fit in the payload
+	uint64_t entry[MPT_MAX_ENTRIES][MPT_MAX_ENTRY_FIELDS];
+};
+
+void mpt_decode(const struct MPT2_IOCTL_EVENTS *event, int ioc, struct mpt_record *rec);
+void mpt_record_text(const struct mpt_record *rec);
+
+// The entries of a list go on the line of the event rather than a line each
+extern int mpt_one_line_lists;
+
+struct mpt_line;
+// The whole record as one line of text, the entries of a list as [N/TOTAL: fields]
+void mpt_record_line(const struct mpt_record *rec, struct mpt_line *line);
+
+/* Logs the records instead of the text lines, when set. Returns nonzero if
+ * the text lines are wanted as well.
+ */
+extern int (*mpt_record_log)(const struct mpt_record *rec, int priority);
+
+/* JSON Lines, see mptjson.c */
+enum mpt_format {
+	MPT_FORMAT_TEXT,
+	MPT_FORMAT_JSON,
+};
+
+int mpt_format_lookup(const char *name);
+void mpt_record_json_line(const struct mpt_record *rec, struct mpt_line *line);
+int mpt_record_json(const struct mpt_record *rec, int priority);
+
+// The names of the values that are counted, see mptmetrics.c
+const char *mpt_reason_code_name(uint32_t rc);
+const char *mpt_discovery_status_name(unsigned bit);
+const char *mpt_topo_phy_rc_name(uint32_t rc);
+
+// Every record also goes here, when set
+extern void (*mpt_record_hook)(const struct mpt_record *rec);
+
+/* Binary records, see mptbin.c and mptbin.h for the format */
+struct mpt_bin_stats {
+	uint64_t records;
+	uint64_t bytes;
+	uint64_t dropped;
+	uint64_t connects;
+};
+
+extern struct mpt_bin_stats mpt_bin_stats;
+
+int mpt_bin_open(const char *target);
+void mpt_bin_record(const struct mpt_record *rec);
+void mpt_bin_close(void);
+
+#endif
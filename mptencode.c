@@ -0,0 +1,339 @@
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+
+#include "mptencode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+enum mpt_encoding mpt_payload_encoding = MPT_ENCODE_HEX;
+
+static const char *const encoding_names[] = {
+	[MPT_ENCODE_HEX] = "hex",
+	[MPT_ENCODE_BASE64] = "base64",
+	[MPT_ENCODE_ZRUN] = "zrun",
+};
+
+int mpt_encoding_lookup(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(encoding_names) / sizeof(encoding_names[0]); i++) {
+		if (strcasecmp(name, encoding_names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static const char hex_digits[16] = "0123456789ABCDEF";
+
+static size_t hex_scalar(const uint8_t *src, size_t len, char *dst)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		*dst++ = hex_digits[src[i] >> 4];
+		*dst++ = hex_digits[src[i] & 0xF];
+		*dst++ = ' ';
+	}
+	*dst = 0;
+
+	return len * 3;
+}
+
+#ifdef HAVE_X86_SIMD
+/* Every 16 input bytes become 48 output bytes. The high and low nibbles are
+ * turned into digits with a table shuffle, then shuffled again into every
+ * third byte and the spaces are or'ed in between. Index 0x80 zeroes the byte.
+ */
+static const uint8_t hex_hi_shuffle[48] __attribute__((aligned(16))) = {
+	0, 0x80, 0x80, 1, 0x80, 0x80, 2, 0x80, 0x80, 3, 0x80, 0x80, 4, 0x80, 0x80, 5,
+	0x80, 0x80, 6, 0x80, 0x80, 7, 0x80, 0x80, 8, 0x80, 0x80, 9, 0x80, 0x80, 10, 0x80,
+	0x80, 11, 0x80, 0x80, 12, 0x80, 0x80, 13, 0x80, 0x80, 14, 0x80, 0x80, 15, 0x80, 0x80,
+};
+
+static const uint8_t hex_lo_shuffle[48] __attribute__((aligned(16))) = {
+	0x80, 0, 0x80, 0x80, 1, 0x80, 0x80, 2, 0x80, 0x80, 3, 0x80, 0x80, 4, 0x80, 0x80,
+	5, 0x80, 0x80, 6, 0x80, 0x80, 7, 0x80, 0x80, 8, 0x80, 0x80, 9, 0x80, 0x80, 10,
+	0x80, 0x80, 11, 0x80, 0x80, 12, 0x80, 0x80, 13, 0x80, 0x80, 14, 0x80, 0x80, 15, 0x80,
+};
+
+static const uint8_t hex_spaces[48] __attribute__((aligned(16))) = {
+	0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0,
+	0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0,
+	' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ',
+};
+
+#define LOAD128(p) _mm_load_si128((const __m128i *)(p))
+
+// pshufb is SSSE3, plain SSE2 has no byte shuffle and uses the scalar loop
+__attribute__((target("ssse3"), always_inline))
+static inline void hex_block16(const uint8_t *src, char *dst)
+{
+	const __m128i digits = _mm_loadu_si128((const __m128i *)hex_digits);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i in = _mm_loadu_si128((const __m128i *)src);
+	__m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+	__m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, nibble));
+	int k;
+
+	for (k = 0; k < 3; k++) {
+		__m128i out = _mm_or_si128(_mm_shuffle_epi8(hi, LOAD128(hex_hi_shuffle + 16 * k)),
+		                           _mm_shuffle_epi8(lo, LOAD128(hex_lo_shuffle + 16 * k)));
+		out = _mm_or_si128(out, LOAD128(hex_spaces + 16 * k));
+		_mm_storeu_si128((__m128i *)(dst + 16 * k), out);
+	}
+}
+
+__attribute__((target("ssse3")))
+static size_t hex_ssse3(const uint8_t *src, size_t len, char *dst)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+		hex_block16(src + i, dst + 3 * i);
+
+	return 3 * i + hex_scalar(src + i, len - i, dst + 3 * i);
+}
+
+/* The shuffles stay within a 128 bit lane. Output lanes 0-5 draw on the input
+ * lanes 0,0 | 0,0 | 0,1 | 1,1 in that order and take the 16 byte shuffle
+ * patterns 0,1 | 2,0 | 1,2 so the input is duplicated into place first.
+ */
+#define LOAD256(lo, hi) _mm256_set_m128i(LOAD128(hi), LOAD128(lo))
+
+__attribute__((target("avx2")))
+static size_t hex_avx2(const uint8_t *src, size_t len, char *dst)
+{
+	const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hex_digits));
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const __m256i hi_shuffle[3] = {
+		LOAD256(hex_hi_shuffle, hex_hi_shuffle + 16),
+		LOAD256(hex_hi_shuffle + 32, hex_hi_shuffle),
+		LOAD256(hex_hi_shuffle + 16, hex_hi_shuffle + 32),
+	};
+	const __m256i lo_shuffle[3] = {
+		LOAD256(hex_lo_shuffle, hex_lo_shuffle + 16),
+		LOAD256(hex_lo_shuffle + 32, hex_lo_shuffle),
+		LOAD256(hex_lo_shuffle + 16, hex_lo_shuffle + 32),
+	};
+	const __m256i spaces[3] = {
+		LOAD256(hex_spaces, hex_spaces + 16),
+		LOAD256(hex_spaces + 32, hex_spaces),
+		LOAD256(hex_spaces + 16, hex_spaces + 32),
+	};
+	size_t i;
+	int k;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+		__m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(in, nibble));
+		__m256i hi_src[3] = {
+			_mm256_permute2x128_si256(hi, hi, 0x00),
+			hi,
+			_mm256_permute2x128_si256(hi, hi, 0x11),
+		};
+		__m256i lo_src[3] = {
+			_mm256_permute2x128_si256(lo, lo, 0x00),
+			lo,
+			_mm256_permute2x128_si256(lo, lo, 0x11),
+		};
+
+		for (k = 0; k < 3; k++) {
+			__m256i out = _mm256_or_si256(_mm256_shuffle_epi8(hi_src[k], hi_shuffle[k]),
+			                              _mm256_shuffle_epi8(lo_src[k], lo_shuffle[k]));
+			out = _mm256_or_si256(out, spaces[k]);
+			_mm256_storeu_si256((__m256i *)(dst + 3 * i + 32 * k), out);
+		}
+	}
+
+	// Inlined here rather than calling hex_ssse3(), mixing the legacy SSE
+	// encoding with AVX costs more than the whole payload
+	for (; i + 16 <= len; i += 16)
+		hex_block16(src + i, dst + 3 * i);
+
+	return 3 * i + hex_scalar(src + i, len - i, dst + 3 * i);
+}
+
+static int have_ssse3(void)
+{
+	return __builtin_cpu_supports("ssse3");
+}
+
+static int have_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static const struct hex_impl {
+	const char *name;
+	int (*supported)(void);
+	size_t (*encode)(const uint8_t *src, size_t len, char *dst);
+} hex_impls[] = {
+#ifdef HAVE_X86_SIMD
+	{ "avx2", have_avx2, hex_avx2 },
+	{ "ssse3", have_ssse3, hex_ssse3 },
+#endif
+	{ "scalar", NULL, hex_scalar },
+};
+
+#define HEX_IMPLS (sizeof(hex_impls) / sizeof(hex_impls[0]))
+
+static const struct hex_impl *hex_selected;
+static pthread_once_t hex_once = PTHREAD_ONCE_INIT;
+
+static void hex_select_best(void)
+{
+	unsigned i;
+
+	for (i = 0; i < HEX_IMPLS; i++) {
+		if (!hex_impls[i].supported || hex_impls[i].supported()) {
+			hex_selected = &hex_impls[i];
+			return;
+		}
+	}
+}
+
+int mpt_hex_select(const char *impl)
+{
+	unsigned i;
+
+	pthread_once(&hex_once, hex_select_best);
+
+	for (i = 0; i < HEX_IMPLS; i++) {
+		if (strcmp(impl, hex_impls[i].name) != 0)
+			continue;
+		if (hex_impls[i].supported && !hex_impls[i].supported())
+			return -1;
+		hex_selected = &hex_impls[i];
+		return 0;
+	}
+
+	return -1;
+}
+
+const char *mpt_hex_impl(void)
+{
+	pthread_once(&hex_once, hex_select_best);
+	return hex_selected->name;
+}
+
+size_t mpt_hex(const void *src, size_t len, char *dst)
+{
+	pthread_once(&hex_once, hex_select_best);
+	return hex_selected->encode(src, len, dst);
+}
+
+static const char base64_digits[64] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t mpt_base64(const void *src, size_t len, char *dst)
+{
+	const uint8_t *in = src;
+	char *out = dst;
+	uint32_t v;
+
+	for (; len >= 3; len -= 3, in += 3) {
+		v = in[0] << 16 | in[1] << 8 | in[2];
+		*out++ = base64_digits[v >> 18];
+		*out++ = base64_digits[(v >> 12) & 0x3F];
+		*out++ = base64_digits[(v >> 6) & 0x3F];
+		*out++ = base64_digits[v & 0x3F];
+	}
+
+	if (len) {
+		v = in[0] << 16 | (len > 1 ? in[1] << 8 : 0);
+		*out++ = base64_digits[v >> 18];
+		*out++ = base64_digits[(v >> 12) & 0x3F];
+		*out++ = len > 1 ? base64_digits[(v >> 6) & 0x3F] : '=';
+		*out++ = '=';
+	}
+	*out = 0;
+
+	return out - dst;
+}
+
+#define ZRUN_MIN 4 // Shorter runs take less space spelled out
+
+size_t mpt_zrun(const void *src, size_t len, char *dst)
+{
+	const uint8_t *in = src;
+	char *out = dst;
+	size_t i = 0;
+
+	while (i < len) {
+		size_t start = i;
+		size_t run = 0;
+
+		// Spell out everything up to the next long enough run of zeros
+		for (; i < len; i++) {
+			if (in[i]) {
+				run = 0;
+				continue;
+			}
+			if (++run == ZRUN_MIN) {
+				i++;
+				break;
+			}
+		}
+		if (run < ZRUN_MIN) {
+			out += mpt_hex(in + start, i - start, out);
+			break;
+		}
+
+		out += mpt_hex(in + start, i - start - run, out);
+		// Most of the payload is usually zeros, skip them a word at a time
+		while (i + 8 <= len) {
+			uint64_t word;
+
+			memcpy(&word, in + i, sizeof(word));
+			if (word)
+				break;
+			run += 8;
+			i += 8;
+		}
+		while (i < len && !in[i]) {
+			run++;
+			i++;
+		}
+
+		{
+			char digits[20];
+			int n = 0;
+
+			*out++ = '0';
+			*out++ = '0';
+			*out++ = '*';
+			do {
+				digits[n++] = '0' + run % 10;
+				run /= 10;
+			} while (run);
+			while (n)
+				*out++ = digits[--n];
+			*out++ = ' ';
+		}
+	}
+	*out = 0;
+
+	return out - dst;
+}
+
+size_t mpt_encode(enum mpt_encoding encoding, const void *src, size_t len, char *dst)
+{
+	switch (encoding) {
+		case MPT_ENCODE_BASE64:
+			return mpt_base64(src, len, dst);
+		case MPT_ENCODE_ZRUN:
+			return mpt_zrun(src, len, dst);
+		case MPT_ENCODE_HEX:
+			break;
+	}
+
+	return mpt_hex(src, len, dst);
+}
@@ -0,0 +1,35 @@
+#ifndef MPTEVENTS_MPTENCODE_H
+#define MPTEVENTS_MPTENCODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Text encodings of raw payload bytes */
+
+enum mpt_encoding {
+	MPT_ENCODE_HEX,    // "XX " per byte, as the events were always logged
+	MPT_ENCODE_BASE64,
+	MPT_ENCODE_ZRUN,   // Hex with runs of zero bytes as "00*N "
+};
+
+// Big enough for len bytes in any of the encodings, with the NUL
+#define MPT_ENCODE_SIZE(len) ((len) * 3 + 1)
+
+// How the payload of undecoded events is logged
+extern enum mpt_encoding mpt_payload_encoding;
+
+int mpt_encoding_lookup(const char *name);
+
+/* All of them NUL terminate dst and return the length of the text */
+size_t mpt_encode(enum mpt_encoding encoding, const void *src, size_t len, char *dst);
+size_t mpt_hex(const void *src, size_t len, char *dst);
+size_t mpt_base64(const void *src, size_t len, char *dst);
+size_t mpt_zrun(const void *src, size_t len, char *dst);
+
+/* The hex encoder picks the widest instruction set the CPU has on first use,
+ * the benchmark forces each in turn.
+ */
+int mpt_hex_select(const char *impl);
+const char *mpt_hex_impl(void);
+
+#endif
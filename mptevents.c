@@ -6,15 +6,38 @@
 #include <memory.h>
 #include <sys/ioctl.h>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <signal.h>
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdarg.h>
 #include <time.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include "mpt.h"
+#include "mptloop.h"
+#include "mptring.h"
+#include "mptcoalesce.h"
+#include "mptencode.h"
+#include "mptdecode.h"
+#include "mptsyslog.h"
+#include "mptstdout.h"
+#include "mptjournal.h"
+#include "mptsink.h"
+#include "mptsub.h"
+#include "mptmetrics.h"
+#include "mptstatsd.h"
 
 #define DEV_DIR "/dev"
 #define MPT2_DIR "/dev/mpt2ctl"
@@ -24,163 +47,337 @@
 #define MPT2SAS_MINOR_NUM 221
 #define MPT3SAS_MINOR_NUM 222
 
+#define MAX_DEVS 8
+#define BACKOFF_MIN_MS 20
+#define BACKOFF_MAX_MS 2560
+#define RETRY_MIN_MS 100
+#define RETRY_MAX_MS 30000
+#define MAX_MASK_RULES 16
+#define MAX_FILE_SINKS 4
+#define STORM_HOLD_MS 60000
+#define RING_SIZE 4096
+
 typedef enum mpt_type {
     MPT2SAS,
     MPT3SAS
 }mpt_type_e;
 
+struct mpt_dev;
+
 typedef struct mpt_ioc {
     int ioc_id;
-    uint32_t ioc_last_context;
+    struct mpt_cursor ioc_cursor;
     mpt_type_e ioc_type;
     int ioc_enabled;
+    struct mpt_dev *ioc_dev;
+    unsigned ioc_score;      // Recent event activity, busier IOCs are read first
+    uint64_t ioc_reads;
+    uint64_t ioc_useless_reads;
+    struct mpt_poll ioc_timer; // Wakes us up to retry a busy controller
+    unsigned ioc_backoff_ms;   // Non-zero while parked on the timer
+    struct mpt_ioc *ioc_next;
+    struct mpt_state_record *ioc_state; // Where the cursor is persisted, if anywhere
+    uint32_t ioc_events[MPI2_EVENT_NOTIFY_EVENTMASK_WORDS];      // Configured event mask
+    uint32_t ioc_storm_masked[MPI2_EVENT_NOTIFY_EVENTMASK_WORDS]; // Taken out of it for now
+    uint16_t ioc_storm_count[MPT_EVENT_TYPES]; // Events of each type in the current second
+    uint64_t ioc_storm_start;
+    unsigned ioc_storms;
+    struct mpt_poll ioc_storm_timer; // Gives back the masked events when the storm is over
+    uint32_t ioc_dropped;      // Events that found the output ring full, not reported yet
 }mpt_ioc_t;
 
+/* One control node, each one serves the IOCs of its own driver generation */
+typedef struct mpt_dev {
+	char path[256];
+	mpt_type_e type;
+	struct mpt_poll poll;
+	mpt_ioc_t *iocs; // IOCs come and go with hotplug, keep them individually allocated
+	int iocs_nr;
+	struct mpt_poll retry_timer; // Reopen fallback when inotify doesn't tell us
+	unsigned retry_ms;
+	int retries;                 // Failed open attempts in a row
+	int gave_up;
+}mpt_dev_t;
+
+/* An --events list, ioc_id is -1 when it applies to all IOCs */
+struct mask_rule {
+	int ioc_id;
+	const char *list;
+};
+
+/* How well the read scheduler avoids reading idle IOCs */
+struct read_stats {
+	uint64_t wakeups;
+	uint64_t ioctls;
+	uint64_t useless_reads;
+	uint64_t skipped_reads;
+	uint64_t busy_reads;
+};
+
+static mpt_dev_t devs[MAX_DEVS];
+static int devs_nr;
+static struct mpt_loop loop;
+static struct mpt_poll signal_poll = { .fd = -1 };
+static struct mpt_poll uevent_poll = { .fd = -1 };
+static struct mpt_poll devdir_poll = { .fd = -1 };
+static int rescan_pending;
+static mpt_ioc_t **sched;
+static int sched_nr;
+static struct read_stats read_stats;
+
+/* The reader above only fetches the events and queues them raw, decoding and
+ * writing them out happens on the output thread so a slow syslog never keeps
+ * us from draining the driver.
+ */
+static struct mpt_ring ring;
+static struct mpt_loop out_loop = { .epoll_fd = -1 };
+static struct mpt_poll ring_poll = { .fd = -1 };
+static struct mpt_poll coalesce_timer = { .fd = -1 };
+static struct mpt_poll flush_timer = { .fd = -1 };
+static pthread_t out_thread;
+static int out_started;
+static int out_stopping;
+static int out_stop_seen; // Drain the ring, then stop
+static int out_log_stats; // Set by the reader, the sinks are the output thread's to look at
+static struct mpt_state_record *out_save_state; // Where out_save_cursor goes, NULL if nowhere
+static struct mpt_cursor out_save_cursor;
+
 static int opt_debug;
 static int opt_stdout;
 static int opt_skip_old;
-
-static void syslog_none(int priority, const char *format, ...)
+static int opt_retries = 10; // -1 to retry forever
+static const char *opt_state_file = MPT_STATE_FILE;
+static struct mask_rule mask_rules[MAX_MASK_RULES];
+static int mask_rules_nr;
+static unsigned opt_storm_rate; // 0 to never mask events on a storm
+static unsigned opt_coalesce_ms; // 0 to report every repeat
+static const char *opt_storm_types = "SAS_PHY_COUNTER,LOG_ENTRY_ADDED";
+static const char *opt_binary; // NULL to not write binary records
+static int opt_syslog_format = -1; // -1 for syslog(3)
+static int opt_format = MPT_FORMAT_TEXT;
+static const char *opt_journal; // NULL to not log to the journal
+static struct mpt_sink log_sink;    // Syslog, stdout or the journal
+static struct mpt_sink file_sinks[MAX_FILE_SINKS];
+static int file_sinks_nr;
+static const char *opt_listen; // NULL to not take subscribers
+static const char *opt_metrics; // NULL to not serve the counters
+static const char *opt_statsd;  // NULL to not push them
+static unsigned opt_statsd_interval_ms = MPT_STATSD_INTERVAL_MS;
+static struct mpt_sink metrics_sink = { .name = "metrics", .record = mpt_metrics_record };
+static uint32_t storm_types[MPI2_EVENT_NOTIFY_EVENTMASK_WORDS];
+
+static int log_stderr; // JSON events have stdout to themselves
+
+// Like the ones mptstdout.c puts on the lines
+static void stdout_timestamp(FILE *out)
 {
+        struct timespec ts;
+        struct tm tm;
+        char timestr[32];
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        localtime_r(&ts.tv_sec, &tm);
+        strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &tm);
+        fprintf(out, "%s.%06ld ", timestr, ts.tv_nsec / 1000);
 }
 
 static void syslog_stdout(int priority, const char *format, ...)
 {
-        time_t now;
-        struct tm *tm;
-        char timestr[32];
+        char msg[4096];
         va_list ap;
-
-        now = time(NULL);
-        tm = localtime(&now);
-        strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", tm);
-        printf("%s ", timestr);
+        int len;
 
         va_start(ap, format);
-        vprintf(format, ap);
+        len = vsnprintf(msg, sizeof(msg), format, ap);
         va_end(ap);
+        if (len < 0)
+                return;
+        if ((size_t)len >= sizeof(msg))
+                len = sizeof(msg) - 1;
+
+        if (!log_stderr) {
+                // Behind the event lines already batched
+                mpt_stdout_message(msg, len);
+                return;
+        }
 
-        putchar('\n');
-        fflush(stdout);
+        // Both the reader and the output thread log, keep the lines whole
+        flockfile(stderr);
+        stdout_timestamp(stderr);
+        fwrite(msg, 1, len, stderr);
+        putc('\n', stderr);
+        funlockfile(stderr);
 }
 
 static int usage(const char *name)
 {
 	fprintf(stderr, "\nmptevents [options] %s\n", VERSION);
-	fprintf(stderr, "Usage:\n\t%s <dev>\n\tFor example %s /dev/mpt3ctl\n\n", name, name);
+	fprintf(stderr, "Usage:\n\t%s [<dev>...]\n\tFor example %s /dev/mpt2ctl /dev/mpt3ctl\n\n", name, name);
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "  -h  --help          Display this usage information.\n"
 	                "  -d  --debug         Save raw data to a debug file for later re-parsing with mptevents_offline.\n"
 	                "  -o  --stdout        Output the logs to stdout with a timestamp (else, output to syslog without timestamps).\n"
-	                "  -k  --skip-old      Skip the old events in case of a restart.\n"
+	                "  -k  --skip-old      Skip the old events of IOCs that have no saved state.\n"
+	                "  -s  --state-file=F  Where to keep the event position across restarts, or 'none' (default " MPT_STATE_FILE ").\n"
+	                "  -r  --retries=N     Give up on a device after N failed attempts to open it, or 'forever' (default 10).\n"
+	                "  -e  --events=[IOC:]LIST\n"
+	                "                      Events to enable, on all IOCs or only on IOC. LIST is a comma separated list of\n"
+	                "                      event names or numbers, 'all' or 'none'. A list starting with a plain name enables\n"
+	                "                      only the listed events, '-NAME' and '+NAME' remove and add to the current set.\n"
+	                "                      Can be given more than once, later lists apply on top of earlier ones.\n"
+	                "  -S  --storm=RATE    Mask a storm type on an IOC for a minute once it logs more than RATE events per\n"
+	                "                      second (default 0, never).\n"
+	                "  -T  --storm-types=LIST\n"
+	                "                      Event types that may be masked on a storm (default SAS_PHY_COUNTER,LOG_ENTRY_ADDED).\n"
+	                "  -c  --coalesce=MS   Report repeats of an event within MS milliseconds as a single line (default 0, never).\n"
+	                "  -p  --payload=ENC   Encoding of the raw payload of events that aren't decoded: hex, base64 or zrun,\n"
+	                "                      hex with runs of zero bytes as 00*N (default hex).\n"
+	                "  -f  --format=FMT    Log the events as text or as json, one object per line (default text). With\n"
+	                "                      --stdout and json the events are the only thing on stdout, the rest goes to stderr.\n"
+	                "  -l  --one-line      Log a topology or IR config change list with all of its entries on one line,\n"
+	                "                      rather than a line for the event and one per entry.\n"
+	                "  -y  --syslog=FMT    Write the events to " MPT_SYSLOG_PATH " directly rather than through syslog(3), batched\n"
+	                "                      and in the rfc3164 or rfc5424 format. Lines are held back while the syslog daemon\n"
+	                "                      is away.\n"
+	                "  -j  --journal[=SOCKET]\n"
+	                "                      Log the events to the systemd journal with their fields as journal fields,\n"
+	                "                      SOCKET is for testing (default " MPT_JOURNAL_SOCKET ").\n"
+	                "  -b  --binary=TARGET Also write the events as binary records, see mptbin.h, to the file TARGET or to\n"
+	                "                      the collector listening on unix:PATH.\n"
+	                "  -F  --file=[OPTS:]PATH\n"
+	                "                      Also append the events to PATH, a file or a fifo. OPTS is a comma separated list\n"
+	                "                      of text or json (default text), drop or grow to let the queue grow up to 16\n"
+	                "                      times its size when it is full rather than drop (default drop), queue=KB\n"
+	                "                      (default 1024) and flush=MS to write the lines at most MS milliseconds late\n"
+	                "                      rather than at the end of each wakeup. A file rotates to PATH.1 with size=MB\n"
+	                "                      and age=S, keep=N segments are kept (default 4). Up to 4 of them.\n"
+	                "  -L  --listen=PATH   Stream the events to the tools that connect to the unix socket PATH, each\n"
+	                "                      sends a line to filter them, see mptsub.h.\n"
+	                "  -M  --metrics=ADDR  Serve counters of the events to Prometheus on the unix socket unix:PATH or\n"
+	                "                      on [HOST:]PORT (default host 127.0.0.1), see mptmetrics.h.\n"
+	                "  -D  --statsd=ADDR   Push the same counters to the StatsD daemon at [HOST:]PORT (default host\n"
+	                "                      127.0.0.1), see mptstatsd.h.\n"
+	                "  -I  --statsd-interval=MS\n"
+	                "                      How often to push them (default 10000).\n"
+	                "\n"
+	                "Send SIGUSR1 to log the read scheduler statistics and SIGHUP to rescan for IOCs.\n"
 	                "\n"
 	       );
 	return 1;
 }
 
-static int find_mpt_host(mpt_ioc_t **ioc_ids, int *ioc_ids_nr)
+static int find_mpt_host(mpt_type_e type, int **ioc_ids, int *ioc_ids_nr)
 {
-    DIR *dir;
+	DIR *dir;
 	struct dirent *dirent;
-    int fd = -1;
-    ssize_t ret = -1;
-    mpt_ioc_t *ids = NULL;
-    int ids_idx = 0;
-    int ids_sz = 10;
-
-    ids = malloc(sizeof(*ids) * ids_sz);
-    if (!ids)
-        return -1;
-
-    memset(ids, 0x0, sizeof(*ids) * ids_sz);
+	int fd = -1;
+	ssize_t ret = -1;
+	int *ids = NULL;
+	int ids_idx = 0;
+	int ids_sz = 10;
+
+	ids = calloc(ids_sz, sizeof(*ids));
+	if (!ids)
+		return -1;
 
 	dir = opendir(SCSIHOST_DIR);
 	if (!dir) {
-        free(ids);
+		free(ids);
 		return -1;
 	}
 
-    while ( (dirent = readdir(dir)) != NULL ) {
+	while ( (dirent = readdir(dir)) != NULL ) {
 		char filename[512];
 		char procname[8];
+		char unique_id[16];
+		mpt_type_e ioc_type;
 
 		snprintf(filename, sizeof(filename), "%s/%s/proc_name", SCSIHOST_DIR, dirent->d_name);
 
-        fd = open(filename, O_RDONLY);
+		fd = open(filename, O_RDONLY);
 		if (fd < 0)
 			continue;
 
 		ret = read(fd, procname, 8);
+		close(fd);
 		if (ret < 0)
 			continue;
 
-        close(fd);
+		procname[7] = '\0';
+
+		if (strncmp("mpt3sas", procname, 7) == 0) {
+			ioc_type = MPT3SAS;
+		} else if (strncmp("mpt2sas", procname, 7) == 0) {
+			ioc_type = MPT2SAS;
+		} else {
+			continue;
+		}
 
-        procname[7] = '\0';
+		// Each control node only serves the IOCs of its own generation
+		if (ioc_type != type)
+			continue;
 
-        if (strncmp("mpt3sas", procname, 7) == 0) {
-            ids[ids_idx].ioc_type = MPT3SAS;
-        } else if (strncmp("mpt2sas", procname, 7) == 0) {
-            ids[ids_idx].ioc_type = MPT2SAS;
-        } else {
-            continue;
-        }
+		snprintf(filename, sizeof(filename), "%s/%s/unique_id", SCSIHOST_DIR, dirent->d_name);
 
-        snprintf(filename, sizeof(filename), "%s/%s/unique_id", SCSIHOST_DIR, dirent->d_name);
+		fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			continue;
 
-        fd = open(filename, O_RDONLY);
-        if (fd < 0)
-            continue;
+		ret = read(fd, unique_id, sizeof(unique_id) - 1);
+		close(fd);
+		if (ret < 0)
+			continue;
 
-        ret = read(fd, procname, 8);
-        if (ret < 0)
-            continue;
+		unique_id[ret] = '\0';
 
-        close(fd);
+		if (ids_idx == ids_sz) {
+			int *new_ids;
 
-        if (ids_idx == ids_sz)
-        {
-            ids_sz *= 2;
-            ids = realloc(ids, sizeof(*ids) * ids_sz);
-            if (!ids)
-                break;
+			ids_sz *= 2;
+			new_ids = realloc(ids, sizeof(*ids) * ids_sz);
+			if (!new_ids)
+				break;
+			ids = new_ids;
+		}
 
-            ids[ids_idx].ioc_id = atoi(procname);
-            ids[ids_idx].ioc_last_context = 0;
-            my_syslog(LOG_INFO, "Found MPT ioc %d type %d",
-                      ids[ids_idx].ioc_id, ids[ids_idx].ioc_type);
-            ids_idx += 1;
-        }
-        else
-        {
-            ids[ids_idx].ioc_id = atoi(procname);
-            ids[ids_idx].ioc_last_context = 0;
-            my_syslog(LOG_INFO, "Found MPT ioc %d type %d",
-                      ids[ids_idx].ioc_id, ids[ids_idx].ioc_type);
-            ids_idx += 1;
-        }
+		ids[ids_idx++] = atoi(unique_id);
 	}
 
 	closedir(dir);
 
-    *ioc_ids = ids;
-    *ioc_ids_nr = ids_idx;
+	*ioc_ids = ids;
+	*ioc_ids_nr = ids_idx;
+
+	return 0;
+}
+
+static int add_dev(const char *path, mpt_type_e type)
+{
+	mpt_dev_t *dev;
+
+	if (devs_nr == MAX_DEVS) {
+		fprintf(stderr, "Too many devices given, can only monitor %d!\n", MAX_DEVS);
+		return -1;
+	}
 
-    return 0;
+	dev = &devs[devs_nr++];
+	memset(dev, 0, sizeof(*dev));
+	snprintf(dev->path, sizeof(dev->path), "%s", path);
+	dev->type = type;
+	dev->poll.fd = -1;
+	dev->retry_timer.fd = -1;
+	return 0;
 }
 
-static const char *find_mptctl_device(void)
+static int find_mptctl_devices(void)
 {
 	DIR *dir;
 	struct dirent *dirent;
-	static char matching_filename[256];
 	int count = 0;
 
-	matching_filename[0] = 0;
-
 	dir = opendir(DEV_DIR);
 	if (!dir)
-		return NULL;
+		return 0;
 
 	while ( (dirent = readdir(dir)) != NULL ) {
 		char filename[512];
@@ -199,28 +396,116 @@ static const char *find_mptctl_device(void)
 				(minor(stbuf.st_rdev) == MPT2SAS_MINOR_NUM ||
 				 minor(stbuf.st_rdev) == MPT3SAS_MINOR_NUM)) {
 			printf("Found control device: %s\n", filename);
+			if (add_dev(filename, minor(stbuf.st_rdev) == MPT2SAS_MINOR_NUM ? MPT2SAS : MPT3SAS) < 0)
+				break;
 			count++;
-
-			strcpy(matching_filename, filename);
 		}
 	}
 
 	closedir(dir);
 
-	if (count > 1) {
-		my_syslog(LOG_CRIT, "More than one control file found, cannot auto-select one!");
-		matching_filename[0] = 0; // Empty selection;
+	return count;
+}
+
+static inline int event_isset(const uint32_t *mask, unsigned event)
+{
+	return (mask[event / 32] >> (event % 32)) & 1;
+}
+
+/* Apply an --events list to a mask, see usage() for the syntax */
+static int apply_event_list(uint32_t *mask, const char *list)
+{
+	char buf[1024];
+	char *item, *save;
+	int first = 1;
+
+	if (strlen(list) >= sizeof(buf))
+		return -1;
+	strcpy(buf, list);
+
+	for (item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save), first = 0) {
+		char op = 0;
+		int event;
+
+		if (strcmp(item, "all") == 0) {
+			memset(mask, 0xFF, MPI2_EVENT_NOTIFY_EVENTMASK_WORDS * sizeof(*mask));
+			continue;
+		}
+		if (strcmp(item, "none") == 0) {
+			memset(mask, 0, MPI2_EVENT_NOTIFY_EVENTMASK_WORDS * sizeof(*mask));
+			continue;
+		}
+
+		if (*item == '-' || *item == '+')
+			op = *item++;
+
+		event = mpt_event_lookup(item);
+		if (event < 0)
+			return -1;
+
+		if (first && !op)
+			memset(mask, 0, MPI2_EVENT_NOTIFY_EVENTMASK_WORDS * sizeof(*mask));
+
+		if (op == '-')
+			mask[event / 32] &= ~(1u << (event % 32));
+		else
+			mask[event / 32] |= 1u << (event % 32);
+	}
+
+	return 0;
+}
+
+static int add_mask_rule(const char *arg)
+{
+	uint32_t mask[MPI2_EVENT_NOTIFY_EVENTMASK_WORDS];
+	struct mask_rule *rule;
+	const char *colon = strchr(arg, ':');
+
+	if (mask_rules_nr == MAX_MASK_RULES) {
+		fprintf(stderr, "Too many event lists, only %d are supported\n", MAX_MASK_RULES);
+		return -1;
+	}
+	rule = &mask_rules[mask_rules_nr];
+
+	rule->ioc_id = -1;
+	rule->list = arg;
+	if (colon) {
+		char *end;
+
+		rule->ioc_id = strtol(arg, &end, 10);
+		if (end != colon || end == arg || rule->ioc_id < 0) {
+			fprintf(stderr, "Invalid IOC number in event list %s\n", arg);
+			return -1;
+		}
+		rule->list = colon + 1;
+	}
+
+	// Catch typos now rather than when the IOC shows up
+	if (apply_event_list(mask, rule->list) < 0) {
+		fprintf(stderr, "Invalid event list %s\n", arg);
+		return -1;
 	}
 
-	// If we have something in the buffer, return it, otherwise we failed
-	return matching_filename[0] ? matching_filename : NULL;
+	mask_rules_nr++;
+	return 0;
+}
+
+static void ioc_event_mask(int ioc_id, uint32_t *mask)
+{
+	int i;
+
+	memset(mask, 0xFF, MPI2_EVENT_NOTIFY_EVENTMASK_WORDS * sizeof(*mask));
+
+	for (i = 0; i < mask_rules_nr; i++) {
+		if (mask_rules[i].ioc_id < 0 || mask_rules[i].ioc_id == ioc_id)
+			apply_event_list(mask, mask_rules[i].list);
+	}
 }
 
-static const char *parse_opts(int argc, char **argv)
+static int parse_opts(int argc, char **argv)
 {
 	int c;
 	int opt_help = 0;
-	const char *mptctl_dev = NULL;
 
 	while (1) {
 		//int this_option_optind = optind ? optind : 1;
@@ -229,11 +514,28 @@ static const char *parse_opts(int argc, char **argv)
 			{"debug",   no_argument,       0,  'd' },
 			{"stdout",  no_argument,       0,  'o' },
 			{"skip-old", no_argument,      0,  'k' },
+			{"retries", required_argument, 0,  'r' },
+			{"state-file", required_argument, 0, 's' },
+			{"events",  required_argument, 0,  'e' },
+			{"storm",   required_argument, 0,  'S' },
+			{"storm-types", required_argument, 0, 'T' },
+			{"coalesce", required_argument, 0, 'c' },
+			{"payload", required_argument, 0, 'p' },
+			{"format",  required_argument, 0, 'f' },
+			{"one-line", no_argument,      0, 'l' },
+			{"syslog",  required_argument, 0, 'y' },
+			{"journal", optional_argument, 0, 'j' },
+			{"binary",  required_argument, 0, 'b' },
+			{"file",    required_argument, 0, 'F' },
+			{"listen",  required_argument, 0, 'L' },
+			{"metrics", required_argument, 0, 'M' },
+			{"statsd",  required_argument, 0, 'D' },
+			{"statsd-interval", required_argument, 0, 'I' },
 			{"help",    no_argument,       0,  'h' },
 			{0,         0,                 0,  0 }
 		};
 
-		c = getopt_long(argc, argv, "dhok",
+		c = getopt_long(argc, argv, "dhoklr:s:e:S:T:c:p:f:y:j::b:F:L:M:D:I:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -259,85 +561,403 @@ static const char *parse_opts(int argc, char **argv)
 				opt_skip_old = 1;
 				break;
 
+			case 'l':
+				mpt_one_line_lists = 1;
+				break;
+
+			case 'r':
+				if (strcmp(optarg, "forever") == 0) {
+					opt_retries = -1;
+				} else {
+					char *end;
+
+					opt_retries = strtol(optarg, &end, 10);
+					if (*end || opt_retries < 0) {
+						fprintf(stderr, "Invalid retries count %s\n", optarg);
+						return -1;
+					}
+				}
+				break;
+
+			case 's':
+				opt_state_file = strcmp(optarg, "none") == 0 ? NULL : optarg;
+				break;
+
+			case 'e':
+				if (add_mask_rule(optarg) < 0)
+					return -1;
+				break;
+
+			case 'S':
+				{
+					char *end;
+					long rate = strtol(optarg, &end, 10);
+
+					if (*end || rate < 0 || rate > UINT16_MAX) {
+						fprintf(stderr, "Invalid storm rate %s\n", optarg);
+						return -1;
+					}
+					opt_storm_rate = rate;
+				}
+				break;
+
+			case 'T':
+				opt_storm_types = optarg;
+				break;
+
+			case 'c':
+				{
+					char *end;
+					long ms = strtol(optarg, &end, 10);
+
+					if (*end || ms < 0 || ms > 3600 * 1000) {
+						fprintf(stderr, "Invalid coalesce window %s\n", optarg);
+						return -1;
+					}
+					opt_coalesce_ms = ms;
+				}
+				break;
+
+			case 'p':
+				{
+					int encoding = mpt_encoding_lookup(optarg);
+
+					if (encoding < 0) {
+						fprintf(stderr, "Invalid payload encoding %s\n", optarg);
+						return -1;
+					}
+					mpt_payload_encoding = encoding;
+				}
+				break;
+
+			case 'f':
+				{
+					int format = mpt_format_lookup(optarg);
+
+					if (format < 0) {
+						fprintf(stderr, "Invalid format %s\n", optarg);
+						return -1;
+					}
+					opt_format = format;
+				}
+				break;
+
+			case 'y':
+				opt_syslog_format = mpt_syslog_format_lookup(optarg);
+				if (opt_syslog_format < 0) {
+					fprintf(stderr, "Invalid syslog format %s\n", optarg);
+					return -1;
+				}
+				break;
+
+			case 'j':
+				opt_journal = optarg ? optarg : MPT_JOURNAL_SOCKET;
+				break;
+
+			case 'b':
+				opt_binary = optarg;
+				break;
+
+			case 'F':
+				if (file_sinks_nr == MAX_FILE_SINKS) {
+					fprintf(stderr, "At most %d --file outputs\n", MAX_FILE_SINKS);
+					return -1;
+				}
+				if (mpt_sink_file(&file_sinks[file_sinks_nr], optarg) < 0) {
+					fprintf(stderr, "Invalid file output %s\n", optarg);
+					return -1;
+				}
+				file_sinks_nr++;
+				break;
+
+			case 'L':
+				opt_listen = optarg;
+				break;
+
+			case 'M':
+				opt_metrics = optarg;
+				break;
+
+			case 'D':
+				opt_statsd = optarg;
+				break;
+
+			case 'I':
+				{
+					char *end;
+					long ms = strtol(optarg, &end, 10);
+
+					if (*end || ms < 100 || ms > 3600 * 1000) {
+						fprintf(stderr, "Invalid statsd interval %s\n", optarg);
+						return -1;
+					}
+					opt_statsd_interval_ms = ms;
+				}
+				break;
+
 			default:
-				return NULL;
+				return -1;
 		}
 	}
 
 	if (opt_help) {
 		usage(argv[0]);
-		return NULL;
+		return -1;
+	}
+
+	if (opt_stdout && opt_syslog_format >= 0) {
+		fprintf(stderr, "--syslog and --stdout don't go together\n");
+		return -1;
+	}
+
+	if (opt_journal && (opt_stdout || opt_syslog_format >= 0 || opt_format != MPT_FORMAT_TEXT)) {
+		fprintf(stderr, "--journal goes with none of --stdout, --syslog or --format\n");
+		return -1;
+	}
+
+	if (apply_event_list(storm_types, opt_storm_types) < 0) {
+		fprintf(stderr, "Invalid storm types %s\n", opt_storm_types);
+		return -1;
 	}
 
 	if (optind == argc) {
-		// Try to autodetect a device
-		mptctl_dev = find_mptctl_device();
-		if (!mptctl_dev) {
+		// Try to autodetect the devices
+		if (find_mptctl_devices() == 0) {
 			fprintf(stderr, "Missing device name argument (auto-detection failed)\n");
 			usage(argv[0]);
-			return NULL;
+			return -1;
 		}
-	} else if (optind != argc-1) {
-		fprintf(stderr, "Too many devices given, can only monitor one!\n");
-		usage(argv[0]);
-		return NULL;
-	} else {
-		mptctl_dev = argv[optind];
-        if ((strncmp(MPT2_DIR, mptctl_dev, strlen(MPT2_DIR)) != 0)
-            && (strncmp(MPT3_DIR, mptctl_dev, strlen(MPT3_DIR)) != 0)) {
-            fprintf(stderr, "Unsupported device %s.\n", mptctl_dev);
+	}
+
+	for (; optind < argc; optind++) {
+		const char *mptctl_dev = argv[optind];
+		mpt_type_e type;
+
+		if (strncmp(MPT2_DIR, mptctl_dev, strlen(MPT2_DIR)) == 0) {
+			type = MPT2SAS;
+		} else if (strncmp(MPT3_DIR, mptctl_dev, strlen(MPT3_DIR)) == 0) {
+			type = MPT3SAS;
+		} else {
+			fprintf(stderr, "Unsupported device %s.\n", mptctl_dev);
 			usage(argv[0]);
-            return NULL;
-        }
-    }
+			return -1;
+		}
 
-	return mptctl_dev;
+		if (add_dev(mptctl_dev, type) < 0) {
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	return 0;
 }
 
-static int enable_events(int fd, int port, mpt_type_e type)
+/* The driver only logs the events in the mask, whatever we leave out does
+ * not take up room in its ring. Setting the mask again keeps the logged events.
+ */
+static int enable_events(mpt_ioc_t *ioc)
 {
 	struct mpt2_ioctl_eventenable cmd;
 	int i;
 	int ret;
 
 	memset(&cmd, 0, sizeof(cmd));
-	cmd.hdr.ioc_number = port;
+	cmd.hdr.ioc_number = ioc->ioc_id;
 	cmd.hdr.port_number = 0;
 
-	// We want all the events
-	for (i = 0; i < 4; i++)
-		cmd.event_types[i] = 0xFFFFFFFF;
+	for (i = 0; i < MPI2_EVENT_NOTIFY_EVENTMASK_WORDS; i++)
+		cmd.event_types[i] = ioc->ioc_events[i] & ~ioc->ioc_storm_masked[i];
 
-	ret = ioctl(fd, (type == MPT2SAS) ? MPT2EVENTENABLE : MPT3EVENTENABLE, &cmd);
+	ret = ioctl(ioc->ioc_dev->poll.fd, (ioc->ioc_type == MPT2SAS) ? MPT2EVENTENABLE : MPT3EVENTENABLE, &cmd);
 	if (ret < 0) {
 		my_syslog(LOG_ERR, "Failed to set the events on mpt device, this might not be a real mpt device: %d (%m)", errno);
 	}
 
-    my_syslog(LOG_INFO, "Enable the events on ioc %d", port);
+    my_syslog(LOG_INFO, "Enable the events on ioc %d", ioc->ioc_id);
 
 	return ret;
 }
 
-/* We have to read all the events and figure out which of them is new and which isn't */
-static int handle_events(int fd, int port, mpt_type_e type,
-                         uint32_t *highest_context, int first_read)
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void handle_storm_timer(struct mpt_poll *poll, uint32_t events)
+{
+	mpt_ioc_t *ioc = container_of(poll, mpt_ioc_t, ioc_storm_timer);
+	uint64_t expirations;
+
+	if (read(poll->fd, &expirations, sizeof(expirations)) < 0)
+		return;
+
+	my_syslog(LOG_NOTICE, "Event storm over on ioc %d, enabling the masked events again", ioc->ioc_id);
+
+	memset(ioc->ioc_storm_masked, 0, sizeof(ioc->ioc_storm_masked));
+	memset(ioc->ioc_storm_count, 0, sizeof(ioc->ioc_storm_count));
+	ioc->ioc_storm_start = now_ms();
+	if (ioc->ioc_enabled)
+		enable_events(ioc);
+}
+
+static void arm_storm_timer(mpt_ioc_t *ioc)
+{
+	struct itimerspec its;
+
+	if (ioc->ioc_storm_timer.fd < 0) {
+		ioc->ioc_storm_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+		if (ioc->ioc_storm_timer.fd < 0) {
+			my_syslog(LOG_ERR, "Error creating storm timer for ioc %d: %d (%m)", ioc->ioc_id, errno);
+			return;
+		}
+		ioc->ioc_storm_timer.handler = handle_storm_timer;
+		if (mpt_loop_add(&loop, &ioc->ioc_storm_timer, EPOLLIN) < 0) {
+			close(ioc->ioc_storm_timer.fd);
+			ioc->ioc_storm_timer.fd = -1;
+			return;
+		}
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = STORM_HOLD_MS / 1000;
+	its.it_value.tv_nsec = (STORM_HOLD_MS % 1000) * 1000000L;
+	timerfd_settime(ioc->ioc_storm_timer.fd, 0, &its, NULL);
+}
+
+/* Count the storm types over one second periods and mask any of them that
+ * goes above the rate, so it does not push the events that matter out of the
+ * driver ring. A timer gives them back after a quiet period.
+ */
+static void check_storm(mpt_ioc_t *ioc, const struct mpt_events *events, const struct mpt_window *window)
+{
+	uint64_t now;
+	int masked = 0;
+	int i;
+
+	if (!opt_storm_rate || window->count == 0)
+		return;
+
+	now = now_ms();
+	if (now - ioc->ioc_storm_start >= 1000) {
+		memset(ioc->ioc_storm_count, 0, sizeof(ioc->ioc_storm_count));
+		ioc->ioc_storm_start = now;
+	}
+
+	for (i = 0; i < window->count; i++) {
+		unsigned event = events->event_data[window->slot[i]].event;
+
+		if (event >= MPT_EVENT_TYPES || !event_isset(storm_types, event) ||
+		    event_isset(ioc->ioc_storm_masked, event))
+			continue;
+
+		if (++ioc->ioc_storm_count[event] <= opt_storm_rate)
+			continue;
+
+		my_syslog(LOG_WARNING, "Event storm on ioc %d: more than %u %s events per second, masking them for %d seconds",
+				ioc->ioc_id, opt_storm_rate, mpt_event_name(event), STORM_HOLD_MS / 1000);
+		ioc->ioc_storm_masked[event / 32] |= 1u << (event % 32);
+		ioc->ioc_storms++;
+		masked = 1;
+	}
+
+	if (masked) {
+		enable_events(ioc);
+		arm_storm_timer(ioc);
+	}
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int queue_raw(mpt_ioc_t *ioc, int kind, uint32_t count,
+                     const struct MPT2_IOCTL_EVENTS *event, uint64_t time_us)
+{
+	struct mpt_raw_event *raw = mpt_ring_reserve(&ring);
+
+	if (!raw)
+		return -1;
+
+	raw->kind = kind;
+	raw->ioc = ioc->ioc_id;
+	raw->state = ioc->ioc_state;
+	raw->count = count;
+	raw->time_us = time_us;
+	if (kind == MPT_RAW_EVENT) {
+		raw->event = *event;
+	} else {
+		memset(&raw->event, 0, sizeof(raw->event));
+		raw->event.context = event->context;
+	}
+	mpt_ring_commit(&ring);
+	return 0;
+}
+
+/* Queue the new events for the output thread. If it falls behind so far that
+ * the ring fills up the events are dropped and reported as lost once there is
+ * room again, the reader never waits for it.
+ */
+static void queue_window(mpt_ioc_t *ioc, const struct mpt_events *events, const struct mpt_window *window)
+{
+	uint64_t time_us = now_us();
+	uint64_t one = 1;
+	int i;
+
+	if (window->count == 0)
+		return;
+
+	if (window->reset)
+		queue_raw(ioc, MPT_RAW_RESET, 0, &events->event_data[window->slot[window->count-1]], time_us);
+
+	for (i = 0; i < window->count; i++) {
+		const struct MPT2_IOCTL_EVENTS *event = &events->event_data[window->slot[i]];
+		uint32_t lost = window->gap[i] + ioc->ioc_dropped;
+
+		if (lost) {
+			if (queue_raw(ioc, MPT_RAW_LOST, lost, event, time_us) < 0) {
+				ioc->ioc_dropped = lost + 1;
+				continue;
+			}
+			ioc->ioc_dropped = 0;
+		}
+
+		if (queue_raw(ioc, MPT_RAW_EVENT, 0, event, time_us) < 0)
+			ioc->ioc_dropped++;
+	}
+
+	if (write(ring_poll.fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		my_syslog(LOG_ERR, "Error waking up the output thread: %d (%m)", errno);
+}
+
+/* We have to read all the events and figure out which of them is new and which isn't.
+ * Returns the number of new events found, -EAGAIN if the controller is busy or
+ * -1 on error.
+ */
+static int handle_events(mpt_ioc_t *ioc)
 {
 	struct mpt_events events;
+	struct mpt_window window;
 	int ret;
 
 	memset(&events, 0, sizeof(events));
-	events.hdr.ioc_number = port;
+	events.hdr.ioc_number = ioc->ioc_id;
 	events.hdr.port_number = 0;
 	events.hdr.max_data_size = sizeof(events);
 
-	ret = ioctl(fd, (type == MPT2SAS) ? MPT2EVENTREPORT : MPT3EVENTREPORT, &events);
+	ret = ioctl(ioc->ioc_dev->poll.fd, (ioc->ioc_type == MPT2SAS) ? MPT2EVENTREPORT : MPT3EVENTREPORT, &events);
 	if (ret < 0) {
 		if (errno == EINTR)
 			return 0;
 		if (errno == EAGAIN) {
-			// mpt2sas returns EAGAIN when the controller is busy, avoid a busy loop in that case
-			sleep(1);
-			return 0;
+			// mpt2sas returns EAGAIN when the controller is busy, the caller will retry later
+			return -EAGAIN;
 		}
 		my_syslog(LOG_ERR, "Error while reading mpt events: %d (%m)", errno);
 		return -1;
@@ -353,142 +973,1050 @@ static int handle_events(int fd, int port, mpt_type_e type,
 		}
 	}
 
-	dump_all_events(&events, highest_context, first_read);
-	return 0;
+	mpt_cursor_window(&ioc->ioc_cursor, &events, &window);
+	check_storm(ioc, &events, &window);
+	queue_window(ioc, &events, &window);
+	return window.count;
 }
 
-static void monitor_mpt(int fd)
+/* Check which devices still have unread events. The driver keeps the device
+ * readable for as long as any IOC behind it has events we did not fetch yet,
+ * so once it goes quiet there is no point in reading the remaining IOCs.
+ */
+static int devs_readable(int *readable)
 {
+	struct pollfd pfds[MAX_DEVS];
+	int i;
 	int ret;
-	int poll_fd;
-	struct epoll_event event;
-    mpt_ioc_t *ids = NULL;
-    int ids_nr = 0;
-    int idx = 0;
-	void (*temp_syslog)(int priority, const char *format, ...);
-
-    ret = find_mpt_host(&ids, &ids_nr);
-    if (ret < 0)
-        return;
-
-    if (ids_nr == 0) {
-        free(ids);
-        my_syslog(LOG_ERR, "Not found any supported MPT ioc");
-        return;
-    }
-
-	for (idx = 0; idx < ids_nr; idx++) {
-		ret = enable_events(fd, idx, ids[idx].ioc_type);
-		if (ret < 0) {
-			ids[idx].ioc_enabled = 0;
-			continue;
-		}
 
-		ids[idx].ioc_enabled = 1;
+	for (i = 0; i < devs_nr; i++) {
+		pfds[i].fd = devs[i].poll.fd;
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
 	}
 
-	poll_fd = epoll_create(1);
-	if (poll_fd < 0) {
-		my_syslog(LOG_ERR, "Error creating epoll to wait for events: %d (%m)", errno);
-        free(ids);
-        return;
+	ret = poll(pfds, devs_nr, 0);
+	if (ret < 0) {
+		// Can't tell, assume everything has events to be on the safe side
+		for (i = 0; i < devs_nr; i++)
+			readable[i] = devs[i].poll.fd >= 0;
+		return devs_nr;
 	}
 
-	memset(&event, 0, sizeof(event));
-	event.events = EPOLLIN;
-	event.data.fd = fd;
+	for (i = 0; i < devs_nr; i++)
+		readable[i] = (pfds[i].revents & POLLIN) != 0;
 
-	ret = epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &event);
-	if (ret < 0) {
-		my_syslog(LOG_ERR, "Error adding fd to epoll: %d (%m)", errno);
-		close(poll_fd);
-        free(ids);
+	return ret;
+}
+
+static void read_ioc(mpt_ioc_t *ioc);
+
+static void handle_ioc_timer(struct mpt_poll *poll, uint32_t events)
+{
+	mpt_ioc_t *ioc = container_of(poll, mpt_ioc_t, ioc_timer);
+	uint64_t expirations;
+
+	if (read(poll->fd, &expirations, sizeof(expirations)) < 0)
 		return;
-	}
 
-	// First run to get the context
-	if (opt_skip_old) {
-		temp_syslog = my_syslog;
-		my_syslog = syslog_none;
-	}
+	read_ioc(ioc);
+}
 
-    for (idx = 0; idx < ids_nr; idx++) {
-        if (!ids[idx].ioc_enabled)
-            continue;
+/* The controller is busy, retry it from a timer with an exponential backoff
+ * rather than sleeping so the other IOCs keep being served meanwhile.
+ */
+static void park_ioc(mpt_ioc_t *ioc)
+{
+	struct itimerspec its;
 
-		ret = handle_events(fd, idx, ids[idx].ioc_type,
-		                    &(ids[idx].ioc_last_context), 1);
-		if (ret < 0) {
-			my_syslog(LOG_ERR, "Error while waiting for first mpt events: %d (%m) ioc %d", errno, ids[idx].ioc_id);
+	if (ioc->ioc_timer.fd < 0) {
+		ioc->ioc_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+		if (ioc->ioc_timer.fd < 0) {
+			my_syslog(LOG_ERR, "Error creating timer for ioc %d: %d (%m)", ioc->ioc_id, errno);
+			return;
 		}
+		ioc->ioc_timer.handler = handle_ioc_timer;
+		if (mpt_loop_add(&loop, &ioc->ioc_timer, EPOLLIN) < 0) {
+			close(ioc->ioc_timer.fd);
+			ioc->ioc_timer.fd = -1;
+			return;
+		}
+	}
+
+	if (ioc->ioc_backoff_ms == 0)
+		ioc->ioc_backoff_ms = BACKOFF_MIN_MS;
+	else if (ioc->ioc_backoff_ms < BACKOFF_MAX_MS)
+		ioc->ioc_backoff_ms *= 2;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ioc->ioc_backoff_ms / 1000;
+	its.it_value.tv_nsec = (ioc->ioc_backoff_ms % 1000) * 1000000L;
+	timerfd_settime(ioc->ioc_timer.fd, 0, &its, NULL);
+}
+
+static void release_ioc(mpt_ioc_t *ioc)
+{
+	if (ioc->ioc_timer.fd >= 0) {
+		mpt_loop_del(&loop, &ioc->ioc_timer);
+		close(ioc->ioc_timer.fd);
 	}
+	ioc->ioc_timer.fd = -1;
+	ioc->ioc_backoff_ms = 0;
 
-	if (opt_skip_old) {
-		my_syslog = temp_syslog;
+	// Without the timer nothing would give the masked events back
+	if (ioc->ioc_storm_timer.fd >= 0) {
+		mpt_loop_del(&loop, &ioc->ioc_storm_timer);
+		close(ioc->ioc_storm_timer.fd);
 	}
+	ioc->ioc_storm_timer.fd = -1;
+	memset(ioc->ioc_storm_masked, 0, sizeof(ioc->ioc_storm_masked));
+}
 
-	// Now we run the normal loop with the received context
-	do {
-		ret = epoll_wait(poll_fd, &event, 1, -1);
-		if (ret < 0) {
-			if (errno == EINTR) {
-				continue;
-			} else {
-				my_syslog(LOG_ERR, "Error while waiting for mpt events: %d (%m)", errno);
-				break;
-			}
-		} else if (ret == 0) {
-			continue;
-		}
+static void read_ioc(mpt_ioc_t *ioc)
+{
+	int ret;
 
-        for (idx = 0; idx < ids_nr; idx++) {
-            if (!ids[idx].ioc_enabled)
-                continue;
+	ret = handle_events(ioc);
 
-		    ret = handle_events(fd, idx, ids[idx].ioc_type,
-                                &(ids[idx].ioc_last_context), 0);
-        }
-	} while (1);
+	read_stats.ioctls++;
+	ioc->ioc_reads++;
+	if (ret == -EAGAIN) {
+		read_stats.busy_reads++;
+		park_ioc(ioc);
+		return;
+	}
+	ioc->ioc_backoff_ms = 0;
+
+	// The cursor is saved by the output thread once the events are out
+	if (ret < 0) {
+		// The IOC may have gone away, leave it out until a rescan decides
+		ioc->ioc_enabled = 0;
+		rescan_pending = 1;
+	}
 
-	close(poll_fd);
-    free(ids);
+	if (ret <= 0) {
+		read_stats.useless_reads++;
+		ioc->ioc_useless_reads++;
+		ret = 0;
+	}
+
+	// Decay the old activity and credit the new one
+	ioc->ioc_score = ioc->ioc_score / 2 + ret * 16;
+	if (ioc->ioc_score > 1 << 16)
+		ioc->ioc_score = 1 << 16;
 }
 
-int main(int argc, char **argv)
+/* Read the IOCs that are most likely to have new events first and stop as
+ * soon as the driver reports nothing else is pending. IOCs that are parked on
+ * their backoff timer are left alone until it fires.
+ */
+static void schedule_reads(void)
 {
-	int attempts;
-	const char *devname;
+	int readable[MAX_DEVS];
+	int i, j;
 
-	my_syslog = syslog_stdout;
+	read_stats.wakeups++;
 
-	devname = parse_opts(argc, argv);
-	if (devname == NULL)
-		return 1;
+	// Stable insertion sort, the list is short and mostly sorted already
+	for (i = 1; i < sched_nr; i++) {
+		mpt_ioc_t *ioc = sched[i];
 
-	if (opt_stdout) {
-		my_syslog = syslog_stdout;
-	} else {
-		openlog("mptevents", LOG_PERROR, LOG_USER);
-		my_syslog = syslog;
+		for (j = i; j > 0 && sched[j-1]->ioc_score < ioc->ioc_score; j--)
+			sched[j] = sched[j-1];
+		sched[j] = ioc;
 	}
-	my_syslog(LOG_INFO, "mptevents starting for device %s", devname);
 
-	attempts = 10;
+	for (i = 0; i < sched_nr; i++) {
+		mpt_ioc_t *ioc = sched[i];
 
-	do {
-		int fd = open(devname, O_RDWR);
-		if (fd >= 0) {
-			monitor_mpt(fd);
-			close(fd);
-		} else {
-			my_syslog(LOG_INFO, "Failed to open mpt device %s: %d (%m)", devname, errno);
-			attempts--;
+		if (devs_readable(readable) == 0) {
+			read_stats.skipped_reads += sched_nr - i;
+			break;
 		}
-		sleep(30);
-	} while (attempts > 0);
+
+		if (!ioc->ioc_enabled || ioc->ioc_backoff_ms || !readable[ioc->ioc_dev - devs]) {
+			read_stats.skipped_reads++;
+			continue;
+		}
+
+		read_ioc(ioc);
+	}
+}
+
+static void close_dev(mpt_dev_t *dev);
+static void retry_dev(mpt_dev_t *dev);
+
+static void handle_dev(struct mpt_poll *poll, uint32_t events)
+{
+	mpt_dev_t *dev = container_of(poll, mpt_dev_t, poll);
+
+	if (events & (EPOLLERR|EPOLLHUP)) {
+		my_syslog(LOG_ERR, "Error on mpt device %s", dev->path);
+		close_dev(dev);
+		retry_dev(dev);
+		return;
+	}
+
+	schedule_reads();
+}
+
+static void log_stats(void)
+{
+	int i;
+
+	my_syslog(LOG_INFO, "Read stats: wakeups=%"PRIu64" ioctls=%"PRIu64" ioctls_per_wakeup=%.2f useless_reads=%"PRIu64" useless_ratio=%.3f skipped_reads=%"PRIu64" busy_reads=%"PRIu64,
+			read_stats.wakeups, read_stats.ioctls,
+			read_stats.wakeups ? (double)read_stats.ioctls / read_stats.wakeups : 0.0,
+			read_stats.useless_reads,
+			read_stats.ioctls ? (double)read_stats.useless_reads / read_stats.ioctls : 0.0,
+			read_stats.skipped_reads,
+			read_stats.busy_reads);
+
+	my_syslog(LOG_INFO, "Ring stats: size=%u used=%u max_used=%u pushed=%"PRIu64" overflows=%"PRIu64,
+			ring.size, mpt_ring_used(&ring), ring.max_used, ring.pushed, ring.overflows);
+
+	if (opt_binary)
+		my_syslog(LOG_INFO, "Binary records stats: records=%"PRIu64" bytes=%"PRIu64" dropped=%"PRIu64" connects=%"PRIu64,
+				mpt_bin_stats.records, mpt_bin_stats.bytes, mpt_bin_stats.dropped, mpt_bin_stats.connects);
+
+	if (opt_journal)
+		my_syslog(LOG_INFO, "Journal stats: entries=%"PRIu64" memfds=%"PRIu64" dropped=%"PRIu64,
+				mpt_journal_stats.entries, mpt_journal_stats.memfds, mpt_journal_stats.dropped);
+
+	if (opt_stdout)
+		my_syslog(LOG_INFO, "Stdout stats: lines=%"PRIu64" writes=%"PRIu64" lines_per_write=%.2f dropped=%"PRIu64,
+				mpt_stdout_stats.lines, mpt_stdout_stats.writes,
+				mpt_stdout_stats.writes ? (double)mpt_stdout_stats.lines / mpt_stdout_stats.writes : 0.0,
+				mpt_stdout_stats.dropped);
+
+	if (out_started) {
+		uint64_t one = 1;
+
+		__atomic_store_n(&out_log_stats, 1, __ATOMIC_RELEASE);
+		if (write(ring_poll.fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			my_syslog(LOG_ERR, "Error waking up the output thread: %d (%m)", errno);
+	}
+
+	if (opt_listen)
+		my_syslog(LOG_INFO, "Subscriber stats: subscribers=%u accepted=%"PRIu64" rejected=%"PRIu64" overflows=%"PRIu64,
+				mpt_sub_count(), mpt_sub_stats.accepted, mpt_sub_stats.rejected, mpt_sub_stats.overflows);
+
+	if (opt_metrics)
+		my_syslog(LOG_INFO, "Metrics stats: scrapes=%"PRIu64" dropped=%"PRIu64,
+				mpt_metrics_stats.scrapes, mpt_metrics_stats.dropped);
+
+	if (opt_statsd)
+		my_syslog(LOG_INFO, "StatsD stats: metrics=%"PRIu64" packets=%"PRIu64" dropped=%"PRIu64,
+				mpt_statsd_stats.metrics, mpt_statsd_stats.packets, mpt_statsd_stats.dropped);
+
+	if (opt_syslog_format >= 0)
+		my_syslog(LOG_INFO, "Syslog stats: lines=%"PRIu64" sends=%"PRIu64" lines_per_send=%.2f dropped=%"PRIu64" reconnects=%"PRIu64,
+				mpt_syslog_stats.lines, mpt_syslog_stats.sends,
+				mpt_syslog_stats.sends ? (double)mpt_syslog_stats.lines / mpt_syslog_stats.sends : 0.0,
+				mpt_syslog_stats.dropped, mpt_syslog_stats.reconnects);
+
+	for (i = 0; i < sched_nr; i++) {
+		mpt_ioc_t *ioc = sched[i];
+
+		my_syslog(LOG_INFO, "IOC stats: ioc=%d dev=%s reads=%"PRIu64" useless_reads=%"PRIu64" events=%"PRIu64" lost=%"PRIu64" score=%u backoff_ms=%u storms=%u",
+				ioc->ioc_id, ioc->ioc_dev->path, ioc->ioc_reads, ioc->ioc_useless_reads,
+				ioc->ioc_cursor.emitted, ioc->ioc_cursor.lost, ioc->ioc_score, ioc->ioc_backoff_ms,
+				ioc->ioc_storms);
+	}
+}
+
+static void handle_signal(struct mpt_poll *poll, uint32_t events)
+{
+	struct signalfd_siginfo info;
+
+	while (read(poll->fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo == SIGUSR1)
+			log_stats();
+		else if (info.ssi_signo == SIGHUP)
+			rescan_pending = 1;
+		else if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT)
+			loop.stop = 1; // Let the output thread drain what we already read
+	}
+}
+
+static int setup_signals(void)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+		return -1;
+
+	// A reader going away from a fifo or stdout is a write error, not our end
+	signal(SIGPIPE, SIG_IGN);
+
+	signal_poll.fd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	if (signal_poll.fd < 0) {
+		my_syslog(LOG_ERR, "Error creating signalfd: %d (%m)", errno);
+		return -1;
+	}
+	signal_poll.handler = handle_signal;
+
+	return mpt_loop_add(&loop, &signal_poll, EPOLLIN);
+}
+
+static int build_schedule(void)
+{
+	int i;
+
+	free(sched);
+	sched = NULL;
+	sched_nr = 0;
+
+	for (i = 0; i < devs_nr; i++)
+		sched_nr += devs[i].iocs_nr;
+
+	sched = calloc(sched_nr ? sched_nr : 1, sizeof(*sched));
+	if (!sched)
+		return -1;
+
+	sched_nr = 0;
+	for (i = 0; i < devs_nr; i++) {
+		mpt_ioc_t *ioc;
+
+		for (ioc = devs[i].iocs; ioc; ioc = ioc->ioc_next)
+			sched[sched_nr++] = ioc;
+	}
+
+	return 0;
+}
+
+static mpt_ioc_t *find_ioc(mpt_dev_t *dev, int ioc_id)
+{
+	mpt_ioc_t *ioc;
+
+	for (ioc = dev->iocs; ioc; ioc = ioc->ioc_next) {
+		if (ioc->ioc_id == ioc_id)
+			return ioc;
+	}
+
+	return NULL;
+}
+
+static int has_id(const int *ids, int ids_nr, int ioc_id)
+{
+	int i;
+
+	for (i = 0; i < ids_nr; i++) {
+		if (ids[i] == ioc_id)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Bring the IOC list of a device in line with what sysfs currently shows.
+ * IOCs that stay keep their cursor, so nothing is replayed or skipped for
+ * them, new ones start with an empty cursor and get their whole ring.
+ */
+static int sync_iocs(mpt_dev_t *dev)
+{
+	mpt_ioc_t **pioc;
+	int *ids;
+	int ids_nr;
+	int i;
+
+	if (find_mpt_host(dev->type, &ids, &ids_nr) < 0)
+		return -1;
+
+	pioc = &dev->iocs;
+	while (*pioc) {
+		mpt_ioc_t *ioc = *pioc;
+
+		if (has_id(ids, ids_nr, ioc->ioc_id)) {
+			pioc = &ioc->ioc_next;
+			continue;
+		}
+
+		my_syslog(LOG_INFO, "Removed MPT ioc %d type %d", ioc->ioc_id, ioc->ioc_type);
+
+		// Pick up whatever it managed to log since our last read
+		if (ioc->ioc_enabled)
+			handle_events(ioc);
+
+		*pioc = ioc->ioc_next;
+		release_ioc(ioc);
+		free(ioc);
+		dev->iocs_nr--;
+	}
+
+	for (i = 0; i < ids_nr; i++) {
+		mpt_ioc_t *ioc = find_ioc(dev, ids[i]);
+
+		if (!ioc) {
+			ioc = calloc(1, sizeof(*ioc));
+			if (!ioc)
+				break;
+
+			ioc->ioc_id = ids[i];
+			ioc->ioc_type = dev->type;
+			ioc->ioc_dev = dev;
+			ioc->ioc_timer.fd = -1;
+			ioc->ioc_storm_timer.fd = -1;
+			ioc_event_mask(ioc->ioc_id, ioc->ioc_events);
+			mpt_cursor_init(&ioc->ioc_cursor);
+			*pioc = ioc;
+			pioc = &ioc->ioc_next;
+			dev->iocs_nr++;
+
+			my_syslog(LOG_INFO, "Found MPT ioc %d type %d", ioc->ioc_id, ioc->ioc_type);
+
+			ioc->ioc_state = mpt_state_get(ioc->ioc_type, ioc->ioc_id);
+			if (mpt_state_restore(ioc->ioc_state, &ioc->ioc_cursor))
+				my_syslog(LOG_INFO, "Resuming ioc %d after context %u", ioc->ioc_id, ioc->ioc_cursor.last_context);
+			else
+				ioc->ioc_cursor.skip_old = opt_skip_old;
+		}
+
+		// Enabling again is harmless and re-arms an IOC whose driver was rebound
+		ioc->ioc_enabled = enable_events(ioc) == 0;
+	}
+
+	free(ids);
+	return 0;
+}
+
+static void free_iocs(mpt_dev_t *dev)
+{
+	while (dev->iocs) {
+		mpt_ioc_t *ioc = dev->iocs;
+
+		dev->iocs = ioc->ioc_next;
+		release_ioc(ioc);
+		free(ioc);
+	}
+	dev->iocs_nr = 0;
+}
+
+static void rescan_iocs(void)
+{
+	int i;
+
+	rescan_pending = 0;
+
+	for (i = 0; i < devs_nr; i++) {
+		if (devs[i].poll.fd >= 0)
+			sync_iocs(&devs[i]);
+	}
+
+	if (build_schedule() < 0)
+		loop.stop = 1;
+}
+
+static void handle_idle(struct mpt_loop *l)
+{
+	if (rescan_pending)
+		rescan_iocs();
+}
+
+/* The kernel announces scsi_host changes on the uevent netlink socket, this
+ * tells us when an HBA was hotplugged or its driver rebound.
+ */
+static int uevent_is_scsi_host(const char *buf, ssize_t len)
+{
+	const char *p = buf;
+
+	while (p < buf + len) {
+		if (strcmp(p, "SUBSYSTEM=scsi_host") == 0)
+			return 1;
+		p += strlen(p) + 1;
+	}
+
+	return 0;
+}
+
+static void handle_uevent(struct mpt_poll *poll, uint32_t events)
+{
+	char buf[8192];
+	ssize_t len;
+
+	while ((len = recv(poll->fd, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[len] = 0;
+		if (uevent_is_scsi_host(buf, len))
+			rescan_pending = 1;
+	}
+}
+
+static int setup_uevents(void)
+{
+	struct sockaddr_nl addr;
+
+	uevent_poll.fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+	if (uevent_poll.fd < 0) {
+		my_syslog(LOG_WARNING, "Cannot watch for hotplug, send SIGHUP to rescan: %d (%m)", errno);
+		return 0;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1; // Kernel events
+	if (bind(uevent_poll.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		my_syslog(LOG_WARNING, "Cannot watch for hotplug, send SIGHUP to rescan: %d (%m)", errno);
+		close(uevent_poll.fd);
+		uevent_poll.fd = -1;
+		return 0;
+	}
+
+	uevent_poll.handler = handle_uevent;
+	return mpt_loop_add(&loop, &uevent_poll, EPOLLIN);
+}
+
+static int setup_dev(mpt_dev_t *dev)
+{
+	if (sync_iocs(dev) < 0)
+		return -1;
+
+	if (dev->iocs_nr == 0)
+		my_syslog(LOG_WARNING, "Not found any supported MPT ioc for %s yet", dev->path);
+
+	/* Edge triggered: the driver wakes us up for every new event, but a
+	 * parked IOC would otherwise keep the device readable and spin the loop
+	 * until its backoff timer fires.
+	 */
+	dev->poll.handler = handle_dev;
+	return mpt_loop_add(&loop, &dev->poll, EPOLLIN|EPOLLET);
+}
+
+static void close_dev(mpt_dev_t *dev)
+{
+	mpt_ioc_t *ioc;
+
+	if (dev->poll.fd < 0)
+		return;
+
+	mpt_loop_del(&loop, &dev->poll);
+	close(dev->poll.fd);
+	dev->poll.fd = -1;
+
+	// Keep the IOCs and their cursors, the node may well come back
+	for (ioc = dev->iocs; ioc; ioc = ioc->ioc_next) {
+		release_ioc(ioc);
+		ioc->ioc_enabled = 0;
+	}
+}
+
+static int open_dev(mpt_dev_t *dev)
+{
+	struct itimerspec its;
+
+	if (dev->poll.fd >= 0)
+		return 0;
+
+	dev->poll.fd = open(dev->path, O_RDWR|O_CLOEXEC);
+	if (dev->poll.fd < 0) {
+		my_syslog(LOG_INFO, "Failed to open mpt device %s: %d (%m)", dev->path, errno);
+		retry_dev(dev);
+		return -1;
+	}
+
+	if (setup_dev(dev) < 0) {
+		close_dev(dev);
+		retry_dev(dev);
+		return -1;
+	}
+
+	dev->retries = 0;
+	dev->retry_ms = 0;
+	dev->gave_up = 0;
+	if (dev->retry_timer.fd >= 0) {
+		memset(&its, 0, sizeof(its));
+		timerfd_settime(dev->retry_timer.fd, 0, &its, NULL);
+	}
+
+	if (build_schedule() < 0) {
+		loop.stop = 1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void reopen_dev(mpt_dev_t *dev)
+{
+	mpt_ioc_t *ioc;
+
+	if (open_dev(dev) < 0)
+		return;
+
+	my_syslog(LOG_INFO, "Opened mpt device %s", dev->path);
+	for (ioc = dev->iocs; ioc; ioc = ioc->ioc_next) {
+		if (ioc->ioc_enabled)
+			read_ioc(ioc);
+	}
+}
+
+static void handle_retry_timer(struct mpt_poll *poll, uint32_t events)
+{
+	mpt_dev_t *dev = container_of(poll, mpt_dev_t, retry_timer);
+	uint64_t expirations;
+
+	if (read(poll->fd, &expirations, sizeof(expirations)) < 0)
+		return;
+
+	reopen_dev(dev);
+}
+
+static void check_devs_alive(void)
+{
+	int i;
+
+	for (i = 0; i < devs_nr; i++) {
+		if (devs[i].poll.fd >= 0 || !devs[i].gave_up)
+			return;
+	}
+
+	my_syslog(LOG_ERR, "No mpt device left to monitor");
+	loop.stop = 1;
+}
+
+/* Inotify on /dev normally tells us as soon as the node is back, the timer
+ * is only a fallback with an exponential backoff.
+ */
+static void retry_dev(mpt_dev_t *dev)
+{
+	struct itimerspec its;
+
+	if (opt_retries >= 0 && dev->retries >= opt_retries) {
+		if (!dev->gave_up)
+			my_syslog(LOG_ERR, "Giving up on mpt device %s after %d retries", dev->path, dev->retries);
+		dev->gave_up = 1;
+		check_devs_alive();
+		return;
+	}
+	dev->retries++;
+
+	if (dev->retry_timer.fd < 0) {
+		dev->retry_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+		if (dev->retry_timer.fd < 0) {
+			my_syslog(LOG_ERR, "Error creating retry timer for %s: %d (%m)", dev->path, errno);
+			return;
+		}
+		dev->retry_timer.handler = handle_retry_timer;
+		if (mpt_loop_add(&loop, &dev->retry_timer, EPOLLIN) < 0) {
+			close(dev->retry_timer.fd);
+			dev->retry_timer.fd = -1;
+			return;
+		}
+	}
+
+	if (dev->retry_ms == 0)
+		dev->retry_ms = RETRY_MIN_MS;
+	else if (dev->retry_ms < RETRY_MAX_MS)
+		dev->retry_ms = dev->retry_ms * 2 < RETRY_MAX_MS ? dev->retry_ms * 2 : RETRY_MAX_MS;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = dev->retry_ms / 1000;
+	its.it_value.tv_nsec = (dev->retry_ms % 1000) * 1000000L;
+	timerfd_settime(dev->retry_timer.fd, 0, &its, NULL);
+}
+
+static void handle_devdir(struct mpt_poll *poll, uint32_t events)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	int i;
+
+	while ((len = read(poll->fd, buf, sizeof(buf))) > 0) {
+		char *p = buf;
+
+		while (p < buf + len) {
+			struct inotify_event *event = (struct inotify_event *)p;
+
+			p += sizeof(*event) + event->len;
+			if (!event->len)
+				continue;
+
+			for (i = 0; i < devs_nr; i++) {
+				const char *name = devs[i].path + strlen(DEV_DIR "/");
+
+				if (devs[i].poll.fd < 0 && strcmp(name, event->name) == 0)
+					reopen_dev(&devs[i]);
+			}
+		}
+	}
+}
+
+static int setup_devdir_watch(void)
+{
+	devdir_poll.fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (devdir_poll.fd < 0) {
+		my_syslog(LOG_WARNING, "Cannot watch %s, falling back to polling for devices: %d (%m)", DEV_DIR, errno);
+		return 0;
+	}
+
+	// udev may create the node before fixing its permissions, ATTRIB covers that
+	if (inotify_add_watch(devdir_poll.fd, DEV_DIR, IN_CREATE|IN_ATTRIB|IN_MOVED_TO) < 0) {
+		my_syslog(LOG_WARNING, "Cannot watch %s, falling back to polling for devices: %d (%m)", DEV_DIR, errno);
+		close(devdir_poll.fd);
+		devdir_poll.fd = -1;
+		return 0;
+	}
+
+	devdir_poll.handler = handle_devdir;
+	return mpt_loop_add(&loop, &devdir_poll, EPOLLIN);
+}
+
+static void open_state(void)
+{
+	if (!opt_state_file)
+		return;
+
+	// Only create the directory for the default location
+	if (strcmp(opt_state_file, MPT_STATE_FILE) == 0)
+		mkdir(MPT_STATE_DIR, 0755);
+
+	mpt_state_open(opt_state_file);
+}
+
+static void arm_coalesce_timer(uint64_t deadline_ms)
+{
+	struct itimerspec its;
+
+	if (coalesce_timer.fd < 0)
+		return;
+
+	// Absolute time on the same clock as now_ms(), zero disarms it
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline_ms / 1000;
+	its.it_value.tv_nsec = (deadline_ms % 1000) * 1000000L;
+	timerfd_settime(coalesce_timer.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void handle_coalesce_timer(struct mpt_poll *poll, uint32_t events)
+{
+	uint64_t expirations;
+
+	if (read(poll->fd, &expirations, sizeof(expirations)) < 0)
+		return;
+
+	arm_coalesce_timer(mpt_coalesce_expire(now_ms(), MPT_COALESCE_NONE));
+}
+
+static void output_raw(struct mpt_raw_event *raw)
+{
+	switch (raw->kind) {
+		case MPT_RAW_EVENT:
+			if (!mpt_coalesce_event(raw, now_ms()))
+				dump_event(&raw->event, raw->ioc, raw->time_us);
+			break;
+		case MPT_RAW_LOST:
+			dump_lost(raw->ioc, raw->count, raw->event.context, raw->time_us);
+			break;
+		case MPT_RAW_RESET:
+			// The held back repeats belong to the old numbering
+			mpt_coalesce_expire(now_ms(), raw->ioc);
+			dump_reset(raw->ioc, raw->event.context, raw->time_us);
+			break;
+	}
+}
+
+/* The cursor of the newest event handed to the sinks is saved once the batch
+ * of its ioc is out, never before, so a restart reports anything that wasn't.
+ */
+static void save_cursor(void)
+{
+	if (out_save_state)
+		mpt_state_save(out_save_state, &out_save_cursor);
+	out_save_state = NULL;
+}
+
+static void track_cursor(const struct mpt_raw_event *raw)
+{
+	if (raw->kind != MPT_RAW_EVENT || !raw->state)
+		return;
+
+	if (raw->state != out_save_state)
+		save_cursor();
+	out_save_state = raw->state;
+	out_save_cursor.last_context = raw->event.context;
+	out_save_cursor.last_event = raw->event.event;
+	out_save_cursor.last_hash = mpt_hash32(raw->event.data, sizeof(raw->event.data));
+	out_save_cursor.primed = 1;
+}
+
+static void drain_ring(void)
+{
+	struct mpt_raw_event *raw;
+
+	while ((raw = mpt_ring_peek(&ring)) != NULL) {
+		output_raw(raw);
+		track_cursor(raw);
+		mpt_ring_pop(&ring);
+	}
+	save_cursor();
+
+	if (opt_coalesce_ms)
+		arm_coalesce_timer(mpt_coalesce_expire(now_ms(), MPT_COALESCE_NONE));
+}
+
+static void handle_ring(struct mpt_poll *poll, uint32_t events)
+{
+	uint64_t count;
+
+	if (read(poll->fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return;
+
+	// Look before draining, whatever was queued before the stop gets out
+	if (__atomic_load_n(&out_stopping, __ATOMIC_ACQUIRE))
+		out_stop_seen = 1;
+
+	drain_ring();
+
+	if (__atomic_exchange_n(&out_log_stats, 0, __ATOMIC_ACQUIRE))
+		mpt_sink_log_stats();
+
+	if (out_stop_seen)
+		out_loop.stop = 1;
+}
+
+static void handle_flush_timer(struct mpt_poll *poll, uint32_t events)
+{
+	uint64_t expirations;
+
+	// The flush itself is in output_idle()
+	if (read(poll->fd, &expirations, sizeof(expirations)) < 0)
+		return;
+}
+
+/* Once everything a wakeup had for us is out, send what the sinks batched.
+ * The timer comes back for what they have to hold back, or want to hold for
+ * longer, even if nothing else happens.
+ */
+static void output_idle(struct mpt_loop *loop)
+{
+	struct itimerspec its;
+	int ms;
+
+	ms = mpt_sink_flush();
+	if (ms < 0)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000 ? ms % 1000 : 1) * 1000000;
+	timerfd_settime(flush_timer.fd, 0, &its, NULL);
+}
+
+static void *output_thread(void *arg)
+{
+	mpt_loop_run(&out_loop);
+	// Don't leave the held back repeats unreported
+	mpt_coalesce_expire(now_ms(), MPT_COALESCE_ALL);
+	mpt_sink_flush();
+	return NULL;
+}
+
+static int start_output(void)
+{
+	int err;
+
+	if (mpt_ring_init(&ring, RING_SIZE) < 0 || mpt_loop_init(&out_loop) < 0)
+		return -1;
+
+	if (opt_binary) {
+		if (mpt_bin_open(opt_binary) < 0)
+			return -1;
+		mpt_record_hook = mpt_bin_record;
+	}
+
+	if (mpt_sink_start(&out_loop) < 0)
+		return -1;
+	if (opt_listen && mpt_sub_listen(&out_loop, opt_listen) < 0)
+		return -1;
+	if (opt_metrics && mpt_metrics_listen(&out_loop, opt_metrics) < 0)
+		return -1;
+	if (opt_statsd && mpt_statsd_open(&out_loop, opt_statsd, opt_statsd_interval_ms) < 0)
+		return -1;
+
+	flush_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (flush_timer.fd < 0) {
+		my_syslog(LOG_ERR, "Error creating flush timer: %d (%m)", errno);
+		return -1;
+	}
+	flush_timer.handler = handle_flush_timer;
+	if (mpt_loop_add(&out_loop, &flush_timer, EPOLLIN) < 0)
+		return -1;
+	out_loop.idle = output_idle;
+
+	ring_poll.fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (ring_poll.fd < 0) {
+		my_syslog(LOG_ERR, "Error creating eventfd: %d (%m)", errno);
+		return -1;
+	}
+	ring_poll.handler = handle_ring;
+	if (mpt_loop_add(&out_loop, &ring_poll, EPOLLIN) < 0)
+		return -1;
+
+	mpt_coalesce_init(opt_coalesce_ms);
+	if (opt_coalesce_ms) {
+		coalesce_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+		if (coalesce_timer.fd < 0) {
+			my_syslog(LOG_ERR, "Error creating coalesce timer: %d (%m)", errno);
+			return -1;
+		}
+		coalesce_timer.handler = handle_coalesce_timer;
+		if (mpt_loop_add(&out_loop, &coalesce_timer, EPOLLIN) < 0)
+			return -1;
+	}
+
+	// Signals are blocked by now, the thread inherits that and leaves them to our signalfd
+	err = pthread_create(&out_thread, NULL, output_thread, NULL);
+	if (err) {
+		errno = err;
+		my_syslog(LOG_ERR, "Error starting the output thread: %d (%m)", errno);
+		return -1;
+	}
+	out_started = 1;
+
+	return 0;
+}
+
+static void stop_output(void)
+{
+	uint64_t one = 1;
+
+	if (out_started) {
+		__atomic_store_n(&out_stopping, 1, __ATOMIC_RELEASE);
+		if (write(ring_poll.fd, &one, sizeof(one)) < 0)
+			my_syslog(LOG_ERR, "Error stopping the output thread: %d (%m)", errno);
+		pthread_join(out_thread, NULL);
+		out_started = 0;
+	}
+	mpt_sub_close();
+	mpt_metrics_close();
+	mpt_statsd_close();
+	mpt_sink_close();
+
+	if (ring_poll.fd >= 0)
+		close(ring_poll.fd);
+	ring_poll.fd = -1;
+	if (coalesce_timer.fd >= 0)
+		close(coalesce_timer.fd);
+	coalesce_timer.fd = -1;
+	if (flush_timer.fd >= 0)
+		close(flush_timer.fd);
+	flush_timer.fd = -1;
+	mpt_loop_close(&out_loop);
+	mpt_ring_free(&ring);
+	mpt_record_hook = NULL;
+	mpt_bin_close();
+}
+
+static void monitor_mpt(void)
+{
+	int i;
+
+	if (mpt_loop_init(&loop) < 0)
+		return;
+	loop.idle = handle_idle;
+
+	if (setup_signals() < 0 || start_output() < 0 || setup_uevents() < 0 || setup_devdir_watch() < 0)
+		goto Exit;
+
+	for (i = 0; i < devs_nr; i++)
+		open_dev(&devs[i]);
+
+	if (loop.stop || build_schedule() < 0)
+		goto Exit;
+
+	// First run to catch up with what happened while we were not running
+	for (i = 0; i < sched_nr; i++)
+		read_ioc(sched[i]);
+
+	// Now we run the normal loop with the received context
+	mpt_loop_run(&loop);
+
+Exit:
+	stop_output();
+	if (signal_poll.fd >= 0)
+		close(signal_poll.fd);
+	signal_poll.fd = -1;
+	if (uevent_poll.fd >= 0)
+		close(uevent_poll.fd);
+	uevent_poll.fd = -1;
+	if (devdir_poll.fd >= 0)
+		close(devdir_poll.fd);
+	devdir_poll.fd = -1;
+	free(sched);
+	sched = NULL;
+	sched_nr = 0;
+	for (i = 0; i < devs_nr; i++) {
+		close_dev(&devs[i]);
+		free_iocs(&devs[i]);
+		if (devs[i].retry_timer.fd >= 0)
+			close(devs[i].retry_timer.fd);
+		devs[i].retry_timer.fd = -1;
+	}
+	mpt_loop_close(&loop);
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	my_syslog = syslog_stdout;
+
+	if (parse_opts(argc, argv) < 0)
+		return 1;
+
+	log_sink.format = opt_format;
+	if (opt_stdout) {
+		my_syslog = syslog_stdout;
+		log_sink.name = "stdout";
+		log_sink.line = mpt_stdout_line;
+		if (opt_format == MPT_FORMAT_JSON) {
+			log_stderr = 1;
+			log_sink.line = mpt_stdout_raw_line;
+		}
+		log_sink.flush = mpt_stdout_flush;
+	} else {
+		openlog("mptevents", LOG_PERROR, LOG_USER);
+		my_syslog = syslog;
+		log_sink.name = "syslog";
+		log_sink.line = my_syslog_line; // syslog(3)
+		if (opt_syslog_format >= 0) {
+			if (mpt_syslog_open("mptevents", opt_syslog_format) < 0)
+				return 1;
+			log_sink.line = mpt_syslog_line;
+			log_sink.flush = mpt_syslog_flush;
+		}
+	}
+	if (opt_journal) {
+		if (mpt_journal_open("mptevents", opt_journal) < 0)
+			return 1;
+		log_sink.name = "journal";
+		log_sink.line = NULL;
+		log_sink.record = mpt_journal_record;
+	}
+	mpt_sink_add(&log_sink);
+	for (i = 0; i < file_sinks_nr; i++)
+		mpt_sink_add(&file_sinks[i]);
+	if (opt_metrics || opt_statsd)
+		mpt_sink_add(&metrics_sink);
+	my_syslog_line = mpt_sink_line;
+	mpt_record_log = mpt_sink_record;
+	for (i = 0; i < devs_nr; i++)
+		my_syslog(LOG_INFO, "mptevents starting for device %s", devs[i].path);
+
+	open_state();
+	monitor_mpt();
+	mpt_state_close();
 
 	my_syslog(LOG_INFO, "mptevents stopping");
 
+	if (opt_syslog_format >= 0)
+		mpt_syslog_close();
+	if (opt_journal)
+		mpt_journal_close();
 	if (!opt_stdout)
 		closelog();
 	return 0;
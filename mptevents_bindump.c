@@ -0,0 +1,163 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "mptbin.h"
+
+/* Prints the binary records of mptevents --binary, from a file or stdin, or
+ * as a collector listening on unix:PATH. Mostly an example of using the
+ * reader in mptbinread.c.
+ */
+
+static const char *kind_names[] = {
+	[MPT_BIN_EVENT] = "event",
+	[MPT_BIN_LOST] = "lost",
+	[MPT_BIN_RESET] = "reset",
+	[MPT_BIN_REPEATED] = "repeated",
+};
+
+static void print_value(const struct mpt_bin_field *field)
+{
+	uint16_t i;
+
+	switch (field->type) {
+		case MPT_BIN_UINT:
+			printf("%"PRIu64, mpt_bin_uint(field));
+			break;
+		case MPT_BIN_INT:
+			printf("%"PRId64, mpt_bin_int(field));
+			break;
+		case MPT_BIN_HEX:
+		case MPT_BIN_SAS:
+			printf("0x%"PRIx64, mpt_bin_uint(field));
+			break;
+		case MPT_BIN_BYTES:
+			for (i = 0; i < field->size; i++)
+				printf("%02x", field->value[i]);
+			break;
+		default:
+			printf("?");
+			break;
+	}
+}
+
+static void print_record(const struct mpt_bin_record *rec)
+{
+	struct mpt_bin_field_iter iter;
+	struct mpt_bin_field field;
+	int ret;
+
+	printf("%"PRIu64" ioc=%d %s %.*s event=%u context=%u",
+	       rec->time_us, rec->ioc,
+	       rec->kind < sizeof(kind_names) / sizeof(kind_names[0]) ? kind_names[rec->kind] : "unknown",
+	       rec->name_len, rec->name, rec->event, rec->context);
+
+	mpt_bin_fields(rec, &iter);
+	while ((ret = mpt_bin_next_field(&iter, &field)) > 0) {
+		if (field.type == MPT_BIN_ENTRY) {
+			printf("\n  %.*s[%d]", field.name_len, field.name, field.entry);
+			continue;
+		}
+		printf(" %.*s=", field.name_len, field.name);
+		print_value(&field);
+	}
+	if (ret < 0)
+		printf(" <corrupt>");
+	putchar('\n');
+}
+
+static int dump_stream(int fd)
+{
+	static struct mpt_bin_reader reader;
+	struct mpt_bin_record rec;
+	int ret;
+
+	mpt_bin_reader_init(&reader, fd);
+	while ((ret = mpt_bin_read(&reader, &rec)) > 0)
+		print_record(&rec);
+	fflush(stdout);
+
+	if (ret < 0) {
+		perror("Error reading records");
+		return -1;
+	}
+	return 0;
+}
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return 1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Error creating socket");
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+		perror("Error listening on socket");
+		close(fd);
+		return 1;
+	}
+
+	// One mptevents at a time, it reconnects when it loses us
+	while (1) {
+		int conn = accept(fd, NULL, NULL);
+
+		if (conn < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Error accepting connection");
+			break;
+		}
+		dump_stream(conn);
+		close(conn);
+	}
+
+	close(fd);
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	int fd;
+	int rc;
+
+	if (argc != 2) {
+		fprintf(stderr, "\nmptevents_bindump %s\n", VERSION);
+		fprintf(stderr, "Usage:\n\t%s <file>|-|unix:PATH\n\n", argv[0]);
+		return 1;
+	}
+
+	if (strncmp(argv[1], "unix:", 5) == 0)
+		return listen_unix(argv[1] + 5);
+
+	if (strcmp(argv[1], "-") == 0)
+		return dump_stream(STDIN_FILENO) < 0;
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0) {
+		perror("Failed to open records file");
+		return 1;
+	}
+	rc = dump_stream(fd) < 0;
+	close(fd);
+	return rc;
+}
@@ -4,8 +4,11 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <inttypes.h>
 
 #include "mpt.h"
+#include "mptencode.h"
+#include "mptdecode.h"
 
 static void my_syslog_wrapper(int priority, const char *fmt, ...)
 {
@@ -19,10 +22,16 @@ static void my_syslog_wrapper(int priority, const char *fmt, ...)
 	(void)priority; // unused
 }
 
+static void my_syslog_line_wrapper(int priority, const char *line, size_t len)
+{
+	fwrite(line, 1, len, stdout);
+	putchar('\n');
+}
+
 static void usage(const char *name)
 {
 	fprintf(stderr, "\nmptevents_offline %s\n", VERSION);
-	fprintf(stderr, "Usage:\n\t%s <dev>\n\tFor example %s %s\n\n", name, name, MPT_EVENTS_LOG);
+	fprintf(stderr, "Usage:\n\t%s [-p hex|base64|zrun] [-f text|json] [-l] [-b records] <dev>\n\tFor example %s %s\n\n", name, name, MPT_EVENTS_LOG);
 }
 
 int main(int argc, char **argv)
@@ -31,18 +40,57 @@ int main(int argc, char **argv)
 	int fd;
 	uint32_t size;
 	int rc = -1;
-	int first_read = 1;
-	uint32_t last_context = 0;
+	struct mpt_cursor cursor;
 	int ret;
+	int c;
+	const char *binary = NULL;
 
-    if (argc == 1) {
+	while ((c = getopt(argc, argv, "p:f:lb:")) != -1) {
+		switch (c) {
+			case 'p':
+				ret = mpt_encoding_lookup(optarg);
+				if (ret < 0) {
+					fprintf(stderr, "Invalid payload encoding %s\n", optarg);
+					return 1;
+				}
+				mpt_payload_encoding = ret;
+				break;
+			case 'f':
+				ret = mpt_format_lookup(optarg);
+				if (ret < 0) {
+					fprintf(stderr, "Invalid format %s\n", optarg);
+					return 1;
+				}
+				mpt_record_log = ret == MPT_FORMAT_JSON ? mpt_record_json : NULL;
+				break;
+			case 'l':
+				mpt_one_line_lists = 1;
+				break;
+			case 'b':
+				binary = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+    if (optind == argc) {
         usage(argv[0]);
         return 1;
     }
 
 	my_syslog = my_syslog_wrapper;
+	my_syslog_line = my_syslog_line_wrapper;
+	mpt_cursor_init(&cursor);
+
+	if (binary) {
+		if (mpt_bin_open(binary) < 0)
+			return 1;
+		mpt_record_hook = mpt_bin_record;
+	}
 
-	fd = open(argv[1], O_RDONLY);
+	fd = open(argv[optind], O_RDONLY);
 	if (fd < 0) {
 		perror("Failed to open debug file");
 		return 1;
@@ -70,12 +118,14 @@ int main(int argc, char **argv)
 			goto Exit;
 		}
 
-		dump_all_events(&events, &last_context, first_read);
-		first_read = 0;
+		dump_all_events(&events, &cursor);
 	}
 
+	printf("Events: %"PRIu64" lost: %"PRIu64" unchanged reads: %"PRIu64"\n",
+	       cursor.emitted, cursor.lost, cursor.unchanged);
 	rc = 0;
 Exit:
 	close(fd);
+	mpt_bin_close();
 	return rc;
 }
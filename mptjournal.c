@@ -0,0 +1,269 @@
+#define _GNU_SOURCE // memfd_create, memrchr
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mpt.h"
+#include "mptdecode.h"
+#include "mptencode.h"
+#include "mptjournal.h"
+#include "mptline.h"
+
+/* An entry is a datagram of NAME=value lines, see systemd's
+ * journal-native-protocol. None of our values has a newline so they all take
+ * the simple form. The MESSAGE is the record as one line of text, next to it
+ * every field is MPT_NAME and what is worth looking events up by gets a
+ * common name: SAS_ADDRESS, DEV_HANDLE and REASON. A list repeats the fields
+ * of its entries, the journal keeps every value of a name.
+ *
+ * An entry that is too big for a datagram goes in a sealed memfd instead.
+ * Only the output thread logs records, nothing here is locked.
+ */
+
+#define SEND_TIMEOUT_MS 200
+#define SNDBUF_SIZE (8 * 1024 * 1024)
+
+struct mpt_journal_stats mpt_journal_stats;
+
+static int jr_fd = -1;
+static struct sockaddr_un jr_addr;
+static const char *jr_ident;
+static int jr_failing; // The last entry didn't make it, don't log every one
+
+static struct mpt_line entry;   // Only ever written from the one output thread
+static struct mpt_line message;
+
+static const char *const kind_names[] = {
+	[MPT_RECORD_EVENT] = "event",
+	[MPT_RECORD_LOST] = "lost",
+	[MPT_RECORD_RESET] = "reset",
+	[MPT_RECORD_REPEATED] = "repeated",
+};
+
+int mpt_journal_open(const char *ident, const char *path)
+{
+	struct timeval tv = { 0, SEND_TIMEOUT_MS * 1000 };
+	int sndbuf = SNDBUF_SIZE;
+
+	if (strlen(path) >= sizeof(jr_addr.sun_path)) {
+		my_syslog(LOG_ERR, "Journal socket path %s is too long", path);
+		return -1;
+	}
+
+	jr_fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+	if (jr_fd < 0) {
+		my_syslog(LOG_ERR, "Error creating journal socket: %d (%m)", errno);
+		return -1;
+	}
+
+	// A journal that falls behind costs us entries rather than the output thread
+	setsockopt(jr_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	// Capped by net.core.wmem_max, bigger entries take the memfd
+	setsockopt(jr_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	// Not connected, the journal may come and go and each entry finds it by name
+	memset(&jr_addr, 0, sizeof(jr_addr));
+	jr_addr.sun_family = AF_UNIX;
+	strcpy(jr_addr.sun_path, path);
+	jr_ident = ident;
+
+	return 0;
+}
+
+void mpt_journal_close(void)
+{
+	if (jr_fd >= 0)
+		close(jr_fd);
+	jr_fd = -1;
+}
+
+// Journal field names are upper case letters, digits and underscores
+static void put_name(struct mpt_line *line, const char *name)
+{
+	line_lit(line, "MPT_");
+	for (; *name && line_room(line); name++)
+		line_char(line, isalnum((unsigned char)*name) ? toupper((unsigned char)*name) : '_');
+}
+
+static void put_value(struct mpt_line *line, const struct mpt_field *field, const uint8_t *data, uint64_t value)
+{
+	switch (field->format) {
+		case MPT_FIELD_UINT:
+			line_u64(line, value);
+			break;
+		case MPT_FIELD_INT:
+			line_i64(line, value);
+			break;
+		case MPT_FIELD_HEX:
+			line_hex(line, value, field->digits);
+			break;
+		case MPT_FIELD_HEXUP:
+			line_hexup(line, value, field->digits);
+			break;
+		case MPT_FIELD_SAS:
+			line_hex(line, value, 16);
+			break;
+		case MPT_FIELD_BYTES:
+			{
+				char text[MPT_ENCODE_SIZE(MPT2_EVENT_DATA_SIZE)];
+
+				line_mem(line, text, mpt_encode(mpt_payload_encoding, data + field->offset, field->size, text));
+			}
+			break;
+	}
+}
+
+static void put_field(struct mpt_line *line, const struct mpt_field *field, const uint8_t *data, uint64_t value)
+{
+	char text[MPT_TEXT_SIZE];
+	const char *meaning = NULL;
+
+	put_name(line, field->name);
+	line_char(line, '=');
+	put_value(line, field, data, value);
+	line_char(line, '\n');
+
+	if (field->text) {
+		meaning = field->text(value, text, sizeof(text));
+		put_name(line, field->name);
+		line_lit(line, "_TEXT=");
+		line_str(line, meaning);
+		line_char(line, '\n');
+	}
+
+	// The same spelling whichever event they come from, to look them up by
+	if (field->format == MPT_FIELD_SAS) {
+		line_lit(line, "SAS_ADDRESS=");
+		line_hex(line, value, 16);
+		line_char(line, '\n');
+	}
+	if (field->flags & MPT_FIELD_HANDLE) {
+		line_lit(line, "DEV_HANDLE=");
+		line_hex(line, value, 4);
+		line_char(line, '\n');
+	}
+	if (field->flags & MPT_FIELD_REASON) {
+		line_lit(line, "REASON=");
+		if (meaning)
+			line_str(line, meaning);
+		else
+			line_u64(line, value);
+		line_char(line, '\n');
+	}
+}
+
+static int send_memfd(void)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	int fd;
+	int ret;
+
+	fd = memfd_create("mptevents-journal", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+
+	// The journal only takes a memfd nobody can change anymore
+	if (write(fd, entry.buf, entry.len) != (ssize_t)entry.len ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_name = &jr_addr;
+	msg.msg_namelen = sizeof(jr_addr);
+	msg.msg_control = &control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	ret = sendmsg(jr_fd, &msg, MSG_NOSIGNAL);
+	close(fd);
+	if (ret < 0)
+		return -1;
+
+	mpt_journal_stats.memfds++;
+	return 0;
+}
+
+int mpt_journal_record(const struct mpt_record *rec, int priority)
+{
+	const struct mpt_event_desc *desc = rec->desc;
+	const struct mpt_list_desc *list = desc->list;
+	unsigned i, j;
+	int ret;
+
+	if (jr_fd < 0)
+		return 0;
+
+	line_reset(&message);
+	mpt_record_line(rec, &message);
+
+	line_reset(&entry);
+	line_lit(&entry, "MESSAGE=");
+	line_mem(&entry, message.buf, message.len);
+	line_lit(&entry, "\nPRIORITY=");
+	line_u64(&entry, priority);
+	line_lit(&entry, "\nSYSLOG_IDENTIFIER=");
+	line_str(&entry, jr_ident);
+	line_lit(&entry, "\nMPT_KIND=");
+	line_str(&entry, kind_names[rec->kind]);
+	if (rec->kind == MPT_RECORD_EVENT || rec->kind == MPT_RECORD_REPEATED) {
+		line_lit(&entry, "\nMPT_EVENT=");
+		line_str(&entry, mpt_event_name(rec->event));
+	}
+	line_lit(&entry, "\nMPT_IOC=");
+	line_i64(&entry, rec->ioc);
+	line_lit(&entry, "\nMPT_CONTEXT=");
+	line_u64(&entry, rec->context);
+	line_char(&entry, '\n');
+
+	for (i = 0; i < desc->fields_nr; i++)
+		put_field(&entry, &desc->fields[i], rec->data, rec->value[i]);
+
+	for (i = 0; list && i < rec->entries_nr; i++) {
+		const uint8_t *data = rec->data + list->offset + i * list->entry_size;
+
+		for (j = 0; j < list->fields_nr; j++)
+			put_field(&entry, &list->fields[j], data, rec->entry[i][j]);
+	}
+
+	// Whatever didn't fit is cut at a whole field
+	if (!line_room(&entry)) {
+		char *end = memrchr(entry.buf, '\n', entry.len);
+
+		entry.len = end ? end + 1 - entry.buf : 0;
+	}
+
+	ret = sendto(jr_fd, entry.buf, entry.len, MSG_NOSIGNAL, (struct sockaddr *)&jr_addr, sizeof(jr_addr));
+	if (ret < 0 && (errno == EMSGSIZE || errno == ENOBUFS))
+		ret = send_memfd();
+	if (ret < 0) {
+		mpt_journal_stats.dropped++;
+		if (!jr_failing)
+			my_syslog(LOG_ERR, "Error writing to the journal at %s: %d (%m)", jr_addr.sun_path, errno);
+		jr_failing = 1;
+		return 0;
+	}
+
+	if (jr_failing)
+		my_syslog(LOG_INFO, "Writing to the journal at %s again", jr_addr.sun_path);
+	jr_failing = 0;
+	mpt_journal_stats.entries++;
+	return 0;
+}
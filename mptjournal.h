@@ -0,0 +1,26 @@
+#ifndef MPTEVENTS_MPTJOURNAL_H
+#define MPTEVENTS_MPTJOURNAL_H
+
+#include <stdint.h>
+
+#include "mptdecode.h"
+
+/* Logs the records to the systemd journal with its native protocol, each
+ * with the decoded fields as journal fields.
+ */
+
+#define MPT_JOURNAL_SOCKET "/run/systemd/journal/socket"
+
+struct mpt_journal_stats {
+	uint64_t entries;
+	uint64_t memfds;  // Entries too big for a datagram, passed in a memfd
+	uint64_t dropped;
+};
+
+extern struct mpt_journal_stats mpt_journal_stats;
+
+int mpt_journal_open(const char *ident, const char *path);
+int mpt_journal_record(const struct mpt_record *rec, int priority);
+void mpt_journal_close(void);
+
+#endif
@@ -0,0 +1,178 @@
+#include <syslog.h>
+#include <stdint.h>
+#include <strings.h>
+
+#include "mpt.h"
+#include "mptdecode.h"
+#include "mptencode.h"
+#include "mptline.h"
+
+/* JSON Lines output, one object per record. Numbers stay numbers, SAS
+ * addresses are strings of 16 hex digits since they don't fit a double, and
+ * a value with a meaning gets a NAME_text member next to it. The entries of a
+ * list are an array in the same object.
+ */
+
+static const char *const format_names[] = {
+	[MPT_FORMAT_TEXT] = "text",
+	[MPT_FORMAT_JSON] = "json",
+};
+
+int mpt_format_lookup(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+		if (strcasecmp(name, format_names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static const char *const kind_names[] = {
+	[MPT_RECORD_EVENT] = "event",
+	[MPT_RECORD_LOST] = "lost",
+	[MPT_RECORD_RESET] = "reset",
+	[MPT_RECORD_REPEATED] = "repeated",
+};
+
+static void json_str(struct mpt_line *line, const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *start = s;
+
+	line_char(line, '"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		line_mem(line, start, s - start);
+		line_char(line, '\\');
+		if (c == '"' || c == '\\') {
+			line_char(line, c);
+		} else {
+			line_lit(line, "u00");
+			line_char(line, hex[c >> 4]);
+			line_char(line, hex[c & 0xF]);
+		}
+		start = s + 1;
+	}
+	line_mem(line, start, s - start);
+	line_char(line, '"');
+}
+
+// The names in the tables are plain identifiers, they need no escaping
+static void json_key(struct mpt_line *line, const char *name)
+{
+	line_char(line, '"');
+	line_str(line, name);
+	line_lit(line, "\":");
+}
+
+static void json_field(struct mpt_line *line, const struct mpt_field *field, const uint8_t *data, uint64_t value)
+{
+	json_key(line, field->name);
+
+	switch (field->format) {
+		case MPT_FIELD_UINT:
+		case MPT_FIELD_HEX:
+		case MPT_FIELD_HEXUP:
+			line_u64(line, value);
+			break;
+		case MPT_FIELD_INT:
+			line_i64(line, value);
+			break;
+		case MPT_FIELD_SAS:
+			line_char(line, '"');
+			line_hex(line, value, 16);
+			line_char(line, '"');
+			break;
+		case MPT_FIELD_BYTES:
+			{
+				char text[MPT_ENCODE_SIZE(MPT2_EVENT_DATA_SIZE)];
+
+				// None of the encodings has anything to escape
+				line_char(line, '"');
+				line_mem(line, text, mpt_encode(mpt_payload_encoding, data + field->offset, field->size, text));
+				line_char(line, '"');
+			}
+			break;
+	}
+
+	if (field->text) {
+		char text[MPT_TEXT_SIZE];
+
+		line_lit(line, ",\"");
+		line_str(line, field->name);
+		line_lit(line, "_text\":");
+		json_str(line, field->text(value, text, sizeof(text)));
+	}
+}
+
+void mpt_record_json_line(const struct mpt_record *rec, struct mpt_line *line)
+{
+	const struct mpt_event_desc *desc = rec->desc;
+	const struct mpt_list_desc *list = desc->list;
+	unsigned i, j;
+
+	line_char(line, '{');
+	if (rec->time_us) {
+		line_lit(line, "\"time_us\":");
+		line_u64(line, rec->time_us);
+		line_char(line, ',');
+	}
+	line_lit(line, "\"kind\":");
+	json_str(line, kind_names[rec->kind]);
+	line_lit(line, ",\"name\":");
+	json_str(line, desc->name);
+	line_lit(line, ",\"ioc\":");
+	line_i64(line, rec->ioc);
+	if (rec->kind == MPT_RECORD_EVENT || rec->kind == MPT_RECORD_REPEATED) {
+		line_lit(line, ",\"event\":");
+		line_u64(line, rec->event);
+		line_lit(line, ",\"event_name\":");
+		json_str(line, mpt_event_name(rec->event));
+	}
+	line_lit(line, ",\"context\":");
+	line_u64(line, rec->context);
+
+	for (i = 0; i < desc->fields_nr; i++) {
+		line_char(line, ',');
+		json_field(line, &desc->fields[i], rec->data, rec->value[i]);
+	}
+
+	if (list) {
+		line_char(line, ',');
+		json_key(line, list->json_name);
+		line_char(line, '[');
+		for (i = 0; i < rec->entries_nr; i++) {
+			const uint8_t *entry = rec->data + list->offset + i * list->entry_size;
+
+			if (i)
+				line_char(line, ',');
+			line_char(line, '{');
+			for (j = 0; j < list->fields_nr; j++) {
+				if (j)
+					line_char(line, ',');
+				json_field(line, &list->fields[j], entry, rec->entry[i][j]);
+			}
+			line_char(line, '}');
+		}
+		line_char(line, ']');
+	}
+
+	line_char(line, '}');
+}
+
+int mpt_record_json(const struct mpt_record *rec, int priority)
+{
+	static struct mpt_line line; // Only ever written from the one output thread
+
+	line_reset(&line);
+	mpt_record_json_line(rec, &line);
+	my_syslog_line(priority, line.buf, line.len);
+	return 0;
+}
@@ -0,0 +1,125 @@
+#ifndef MPTEVENTS_MPTLINE_H
+#define MPTEVENTS_MPTLINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Builds a log line in place, one value at a time. Every appender knows the
+ * type of its value so nothing is parsed at run time the way a printf format
+ * is. What doesn't fit is cut off, the line is always NUL terminated.
+ */
+
+#define MPT_LINE_SIZE 16384 // A JSON topology list with all of its entries takes about 8k
+
+struct mpt_line {
+	size_t len;
+	char buf[MPT_LINE_SIZE];
+};
+
+static inline void line_reset(struct mpt_line *line)
+{
+	line->len = 0;
+	line->buf[0] = 0;
+}
+
+static inline size_t line_room(const struct mpt_line *line)
+{
+	return sizeof(line->buf) - 1 - line->len;
+}
+
+static inline void line_mem(struct mpt_line *line, const char *s, size_t len)
+{
+	if (len > line_room(line))
+		len = line_room(line);
+	memcpy(line->buf + line->len, s, len);
+	line->len += len;
+	line->buf[line->len] = 0;
+}
+
+// For string literals, the length is known at compile time
+#define line_lit(line, s) line_mem(line, "" s, sizeof(s) - 1)
+
+static inline void line_str(struct mpt_line *line, const char *s)
+{
+	line_mem(line, s, strlen(s));
+}
+
+static inline void line_char(struct mpt_line *line, char c)
+{
+	if (line_room(line)) {
+		line->buf[line->len++] = c;
+		line->buf[line->len] = 0;
+	}
+}
+
+static const char line_digit_pairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static inline void line_u64(struct mpt_line *line, uint64_t value)
+{
+	char digits[20];
+	char *p = digits + sizeof(digits);
+
+	while (value >= 100) {
+		p -= 2;
+		memcpy(p, line_digit_pairs + (value % 100) * 2, 2);
+		value /= 100;
+	}
+	if (value >= 10) {
+		p -= 2;
+		memcpy(p, line_digit_pairs + value * 2, 2);
+	} else {
+		*--p = '0' + value;
+	}
+
+	line_mem(line, p, digits + sizeof(digits) - p);
+}
+
+static inline void line_i64(struct mpt_line *line, int64_t value)
+{
+	if (value < 0) {
+		line_char(line, '-');
+		line_u64(line, -(uint64_t)value);
+	} else {
+		line_u64(line, value);
+	}
+}
+
+/* At least digits hex digits, zero padded, like %0*x or %0*X */
+static inline void line_hex_case(struct mpt_line *line, uint64_t value, int digits, int upper)
+{
+	const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char text[16];
+	char *p = text + sizeof(text);
+
+	if (digits > (int)sizeof(text))
+		digits = sizeof(text);
+	do {
+		*--p = hex[value & 0xF];
+		value >>= 4;
+		digits--;
+	} while (value || digits > 0);
+
+	line_mem(line, p, text + sizeof(text) - p);
+}
+
+static inline void line_hex(struct mpt_line *line, uint64_t value, int digits)
+{
+	line_hex_case(line, value, digits, 0);
+}
+
+static inline void line_hexup(struct mpt_line *line, uint64_t value, int digits)
+{
+	line_hex_case(line, value, digits, 1);
+}
+
+/* SAS addresses are logged as they were with %lx, without padding */
+static inline void line_sas(struct mpt_line *line, uint64_t sas_address)
+{
+	line_hex(line, sas_address, 0);
+}
+
+#endif
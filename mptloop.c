@@ -0,0 +1,79 @@
+#include <errno.h>
+#include <memory.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "mpt.h"
+#include "mptloop.h"
+
+#define MAX_EVENTS 16
+
+int mpt_loop_init(struct mpt_loop *loop)
+{
+	loop->stop = 0;
+	loop->idle = NULL;
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		my_syslog(LOG_ERR, "Error creating epoll to wait for events: %d (%m)", errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+void mpt_loop_close(struct mpt_loop *loop)
+{
+	if (loop->epoll_fd >= 0)
+		close(loop->epoll_fd);
+	loop->epoll_fd = -1;
+}
+
+int mpt_loop_add(struct mpt_loop *loop, struct mpt_poll *poll, uint32_t events)
+{
+	struct epoll_event event;
+	int ret;
+
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = poll;
+
+	ret = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, poll->fd, &event);
+	if (ret < 0)
+		my_syslog(LOG_ERR, "Error adding fd to epoll: %d (%m)", errno);
+
+	return ret;
+}
+
+void mpt_loop_del(struct mpt_loop *loop, struct mpt_poll *poll)
+{
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, poll->fd, NULL);
+}
+
+/* Dispatch ready fds until a handler asks us to stop or epoll itself fails */
+int mpt_loop_run(struct mpt_loop *loop)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int ret;
+	int i;
+
+	while (!loop->stop) {
+		ret = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			my_syslog(LOG_ERR, "Error while waiting for mpt events: %d (%m)", errno);
+			return -1;
+		}
+
+		for (i = 0; i < ret; i++) {
+			struct mpt_poll *poll = events[i].data.ptr;
+			poll->handler(poll, events[i].events);
+		}
+
+		if (loop->idle)
+			loop->idle(loop);
+	}
+
+	return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef MPTEVENTS_MPTLOOP_H
+#define MPTEVENTS_MPTLOOP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* Anything that wants to be woken up by the loop embeds one of these and
+ * gets its handler called with the epoll events when the fd is ready.
+ */
+struct mpt_poll {
+	int fd;
+	void (*handler)(struct mpt_poll *poll, uint32_t events);
+};
+
+struct mpt_loop {
+	int epoll_fd;
+	int stop;
+	void (*idle)(struct mpt_loop *loop); // Called after each batch of handlers
+};
+
+int mpt_loop_init(struct mpt_loop *loop);
+void mpt_loop_close(struct mpt_loop *loop);
+int mpt_loop_add(struct mpt_loop *loop, struct mpt_poll *poll, uint32_t events);
+void mpt_loop_del(struct mpt_loop *loop, struct mpt_poll *poll);
+int mpt_loop_run(struct mpt_loop *loop);
+
+#endif
@@ -0,0 +1,555 @@
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "mpt.h"
+#include "mptdecode.h"
+#include "mptmetrics.h"
+
+/* The counters are kept by ioc in blocks of cache lines, each kind in an
+ * array indexed by the value it counts, so counting a record is a few
+ * increments. They are counted and served from the loop of the output
+ * thread, a scrape is formatted there in one go and written out as the
+ * client takes it while the reader goes on queueing events in the ring.
+ *
+ * Every counter is a uint64_t in the counters array, its index there is the
+ * id that mpt_metrics_walk() gives with it.
+ */
+
+#define MAX_IOCS 16
+#define MAX_SENSORS 8
+#define MAX_CONNS 4
+#define REQUEST_MAX 2048
+#define CACHELINE __attribute__((aligned(64)))
+
+struct ioc_counters {
+	uint64_t events[MPT_EVENT_TYPES] CACHELINE;
+	uint64_t status_changes[256] CACHELINE; // By ReasonCode
+	uint64_t topo_phy[MPI2_EVENT_SAS_TOPO_RC_MASK + 1] CACHELINE;
+	uint64_t phy_changes[256] CACHELINE;    // By phy number, whichever expander it is on
+	uint64_t discovery[32] CACHELINE;       // By DiscoveryStatus bit
+	uint64_t temp_events CACHELINE;
+	uint64_t lost_gaps;
+	uint64_t lost_events;
+	uint64_t resets;
+	uint64_t temp[MAX_SENSORS] CACHELINE;
+	uint32_t temp_seen; // Sensors that reported
+};
+
+struct metrics_conn {
+	struct mpt_poll poll;
+	uint64_t serial; // The oldest one makes room for another
+	char in[REQUEST_MAX];
+	size_t in_len;
+	char *out; // The reply, once the request is in
+	size_t out_len;
+	size_t out_done;
+};
+
+struct mpt_metrics_stats mpt_metrics_stats;
+
+static struct ioc_counters counters[MAX_IOCS];
+static int ioc_ids[MAX_IOCS];
+static unsigned iocs_nr;
+
+static struct mpt_loop *metrics_loop;
+static struct mpt_poll listen_poll = { .fd = -1 };
+static const char *listen_path; // Of a unix socket
+static struct metrics_conn conns[MAX_CONNS];
+static uint64_t conns_serial;
+static const char *last_help; // Of the kind a scrape is at
+
+static struct ioc_counters *ioc_counters(int ioc)
+{
+	unsigned i;
+
+	for (i = 0; i < iocs_nr; i++)
+		if (ioc_ids[i] == ioc)
+			return &counters[i];
+	if (iocs_nr == MAX_IOCS)
+		return NULL;
+	ioc_ids[iocs_nr] = ioc;
+	return &counters[iocs_nr++];
+}
+
+static void count_event(struct ioc_counters *c, const struct mpt_record *rec)
+{
+	switch (rec->event) {
+	case MPI2_EVENT_SAS_DEVICE_STATUS_CHANGE: {
+		const MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE *evt = (const void *)rec->data;
+
+		c->status_changes[evt->ReasonCode]++;
+		break;
+	}
+	case MPI2_EVENT_SAS_TOPOLOGY_CHANGE_LIST: {
+		const MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST *evt = (const void *)rec->data;
+		const uint8_t *entry = rec->data + offsetof(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, PHY);
+		unsigned i;
+
+		for (i = 0; i < rec->entries_nr; i++, entry += sizeof(MPI2_EVENT_SAS_TOPO_PHY_ENTRY)) {
+			const MPI2_EVENT_SAS_TOPO_PHY_ENTRY *phy = (const void *)entry;
+
+			c->topo_phy[phy->PhyStatus & MPI2_EVENT_SAS_TOPO_RC_MASK]++;
+			c->phy_changes[(uint8_t)(evt->StartPhyNum + i)]++;
+		}
+		break;
+	}
+	case MPI2_EVENT_SAS_DISCOVERY: {
+		const MPI2_EVENT_DATA_SAS_DISCOVERY *evt = (const void *)rec->data;
+		uint32_t status = evt->DiscoveryStatus;
+
+		while (status) {
+			c->discovery[__builtin_ctz(status)]++;
+			status &= status - 1;
+		}
+		break;
+	}
+	case MPI2_EVENT_TEMP_THRESHOLD: {
+		const MPI2_EVENT_DATA_TEMPERATURE *evt = (const void *)rec->data;
+
+		c->temp_events++;
+		if (evt->SensorNum < MAX_SENSORS) {
+			c->temp[evt->SensorNum] = evt->CurrentTemperature;
+			c->temp_seen |= 1u << evt->SensorNum;
+		}
+		break;
+	}
+	}
+}
+
+int mpt_metrics_record(const struct mpt_record *rec, int priority)
+{
+	struct ioc_counters *c = ioc_counters(rec->ioc);
+
+	if (!c)
+		return 0;
+
+	switch (rec->kind) {
+	case MPT_RECORD_EVENT:
+		if (rec->event < MPT_EVENT_TYPES)
+			c->events[rec->event]++;
+		count_event(c, rec);
+		break;
+	case MPT_RECORD_LOST:
+		c->lost_gaps++;
+		c->lost_events += rec->value[0]; // count
+		break;
+	case MPT_RECORD_RESET:
+		c->resets++;
+		break;
+	case MPT_RECORD_REPEATED:
+		// The repeats are only counted, what they were about isn't in the record
+		if (rec->event < MPT_EVENT_TYPES)
+			c->events[rec->event] += rec->value[0];
+		break;
+	}
+	return 0;
+}
+
+// The name of a value, or its number when it has none
+static const char *label(const char *name, const char *fmt, unsigned value, char *buf, size_t size)
+{
+	if (strcmp(name, "UNKNOWN") != 0)
+		return name;
+	snprintf(buf, size, fmt, value);
+	return buf;
+}
+
+// Calls fn with each of the values of the kind that aren't zero
+static void walk_array(mpt_metric_fn fn, void *arg, struct mpt_metric *m, size_t offset, unsigned nr,
+                       const char *(*name)(uint32_t value), const char *fmt, int bit)
+{
+	char buf[16];
+	unsigned i, v;
+
+	for (i = 0; i < iocs_nr; i++) {
+		const uint64_t *values = (const void *)((const char *)&counters[i] + offset);
+
+		m->ioc = ioc_ids[i];
+		for (v = 0; v < nr; v++) {
+			uint32_t value = bit ? 1u << v : v;
+
+			if (!values[v])
+				continue;
+			m->label_value = label(name ? name(value) : "UNKNOWN", fmt, value, buf, sizeof(buf));
+			m->value = values[v];
+			m->id = &values[v] - (const uint64_t *)counters;
+			fn(m, arg);
+		}
+	}
+}
+
+static void walk_ioc(mpt_metric_fn fn, void *arg, struct mpt_metric *m, size_t offset)
+{
+	unsigned i;
+
+	for (i = 0; i < iocs_nr; i++) {
+		const uint64_t *value = (const void *)((const char *)&counters[i] + offset);
+
+		if (!*value)
+			continue;
+		m->ioc = ioc_ids[i];
+		m->value = *value;
+		m->id = value - (const uint64_t *)counters;
+		fn(m, arg);
+	}
+}
+
+static const char *event_name(uint32_t event)
+{
+	return mpt_event_name(event);
+}
+
+static const char *discovery_status_name(uint32_t status)
+{
+	return mpt_discovery_status_name(__builtin_ctz(status));
+}
+
+#define METRIC(n, l, h) (struct mpt_metric){ .name = n, .label = l, .help = h }
+#define GAUGE(n, l, h) (struct mpt_metric){ .name = n, .label = l, .help = h, .gauge = 1 }
+#define OFFSET(field) offsetof(struct ioc_counters, field)
+
+void mpt_metrics_walk(mpt_metric_fn fn, void *arg)
+{
+	struct mpt_metric m;
+	char buf[16];
+	unsigned i, v;
+
+	m = METRIC("events", "event", "Events reported by the controller, repeats included.");
+	walk_array(fn, arg, &m, OFFSET(events), MPT_EVENT_TYPES, event_name, "%u", 0);
+	m = METRIC("device_status_changes", "reason", "SAS device status changes by reason code.");
+	walk_array(fn, arg, &m, OFFSET(status_changes), 256, mpt_reason_code_name, "%u", 0);
+	m = METRIC("topology_phy_changes", "rc", "Phy entries of SAS topology change lists by reason code.");
+	walk_array(fn, arg, &m, OFFSET(topo_phy), MPI2_EVENT_SAS_TOPO_RC_MASK + 1, mpt_topo_phy_rc_name, "%u", 0);
+	m = METRIC("phy_changes", "phy", "Phy entries of SAS topology change lists by phy number.");
+	walk_array(fn, arg, &m, OFFSET(phy_changes), 256, NULL, "%u", 0);
+	m = METRIC("discovery_errors", "status", "SAS discoveries by the status bits they reported.");
+	walk_array(fn, arg, &m, OFFSET(discovery), 32, discovery_status_name, "0x%08x", 1);
+	m = METRIC("temperature_threshold_events", NULL, "Temperature threshold events.");
+	walk_ioc(fn, arg, &m, OFFSET(temp_events));
+
+	// A temperature of 0 is still a reading
+	m = GAUGE("temperature_celsius", "sensor", "The last temperature a sensor reported.");
+	for (i = 0; i < iocs_nr; i++) {
+		m.ioc = ioc_ids[i];
+		for (v = 0; v < MAX_SENSORS; v++) {
+			if (!(counters[i].temp_seen & (1u << v)))
+				continue;
+			snprintf(buf, sizeof(buf), "%u", v);
+			m.label_value = buf;
+			m.value = counters[i].temp[v];
+			m.id = &counters[i].temp[v] - (const uint64_t *)counters;
+			fn(&m, arg);
+		}
+	}
+
+	m = METRIC("lost_event_gaps", NULL, "Times events were overwritten before they were read.");
+	walk_ioc(fn, arg, &m, OFFSET(lost_gaps));
+	m = METRIC("lost_events", NULL, "Events overwritten before they were read.");
+	walk_ioc(fn, arg, &m, OFFSET(lost_events));
+	m = METRIC("context_resets", NULL, "Times the driver restarted its event numbering.");
+	walk_ioc(fn, arg, &m, OFFSET(resets));
+}
+
+unsigned mpt_metrics_ids(void)
+{
+	return MAX_IOCS * (sizeof(struct ioc_counters) / sizeof(uint64_t));
+}
+
+// In the Prometheus text format, the kinds that have no values are left out
+static void prom_metric(const struct mpt_metric *m, void *arg)
+{
+	FILE *f = arg;
+	const char *suffix = m->gauge ? "" : "_total";
+
+	if (m->help != last_help) {
+		fprintf(f, "# HELP mpt_%s%s %s\n# TYPE mpt_%s%s %s\n", m->name, suffix, m->help,
+		        m->name, suffix, m->gauge ? "gauge" : "counter");
+		last_help = m->help;
+	}
+
+	fprintf(f, "mpt_%s%s{ioc=\"%d\"", m->name, suffix, m->ioc);
+	if (m->label)
+		fprintf(f, ",%s=\"%s\"", m->label, m->label_value);
+	fprintf(f, "} %"PRIu64"\n", m->value);
+}
+
+static void write_metrics(FILE *f)
+{
+	last_help = NULL;
+	mpt_metrics_walk(prom_metric, f);
+}
+
+static void conn_close(struct metrics_conn *conn)
+{
+	mpt_loop_del(metrics_loop, &conn->poll);
+	close(conn->poll.fd);
+	conn->poll.fd = -1;
+	free(conn->out);
+	conn->out = NULL;
+}
+
+// Returns -1 once the connection is done with
+static int conn_send(struct metrics_conn *conn)
+{
+	while (conn->out_done < conn->out_len) {
+		ssize_t ret = send(conn->poll.fd, conn->out + conn->out_done, conn->out_len - conn->out_done,
+		                   MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		conn->out_done += ret;
+	}
+	return -1;
+}
+
+static int conn_reply(struct metrics_conn *conn)
+{
+	const char *path = conn->in + 4;
+	size_t path_len = strcspn(path, " \r\n");
+	FILE *f;
+
+	f = open_memstream(&conn->out, &conn->out_len);
+	if (!f)
+		return -1;
+
+	if (strncmp(conn->in, "GET ", 4) != 0) {
+		fputs("HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n", f);
+		mpt_metrics_stats.dropped++;
+	} else if ((path_len == 1 && *path == '/') || (path_len == 8 && strncmp(path, "/metrics", 8) == 0)) {
+		fputs("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n", f);
+		write_metrics(f);
+		mpt_metrics_stats.scrapes++;
+	} else {
+		fputs("HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n", f);
+		mpt_metrics_stats.dropped++;
+	}
+
+	if (fclose(f) != 0 || !conn->out)
+		return -1;
+	return conn_send(conn);
+}
+
+// Returns -1 once the connection is done with
+static int conn_read(struct metrics_conn *conn)
+{
+	while (1) {
+		ssize_t ret = read(conn->poll.fd, conn->in + conn->in_len, sizeof(conn->in) - 1 - conn->in_len);
+
+		if (ret == 0)
+			return -1;
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		conn->in_len += ret;
+		conn->in[conn->in_len] = 0;
+
+		if (strstr(conn->in, "\r\n\r\n") || strstr(conn->in, "\n\n"))
+			return conn_reply(conn);
+		if (conn->in_len == sizeof(conn->in) - 1) {
+			mpt_metrics_stats.dropped++;
+			return -1;
+		}
+	}
+}
+
+static void handle_conn(struct mpt_poll *poll, uint32_t events)
+{
+	struct metrics_conn *conn = container_of(poll, struct metrics_conn, poll);
+	int ret = 0;
+
+	if (conn->out)
+		ret = conn_send(conn);
+	else if (events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+		ret = conn_read(conn);
+
+	if (ret < 0)
+		conn_close(conn);
+}
+
+static struct metrics_conn *conn_slot(void)
+{
+	struct metrics_conn *oldest = &conns[0];
+	unsigned i;
+
+	for (i = 0; i < MAX_CONNS; i++) {
+		if (conns[i].poll.fd < 0)
+			return &conns[i];
+		if (conns[i].serial < oldest->serial)
+			oldest = &conns[i];
+	}
+
+	conn_close(oldest);
+	mpt_metrics_stats.dropped++;
+	return oldest;
+}
+
+static void handle_listen(struct mpt_poll *poll, uint32_t events)
+{
+	while (1) {
+		int fd = accept4(poll->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+		struct metrics_conn *conn;
+
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				my_syslog(LOG_ERR, "Error accepting a metrics connection: %d (%m)", errno);
+			return;
+		}
+
+		conn = conn_slot();
+		conn->poll.fd = fd;
+		conn->poll.handler = handle_conn;
+		conn->serial = ++conns_serial;
+		conn->in_len = 0;
+		conn->out_len = 0;
+		conn->out_done = 0;
+		if (mpt_loop_add(metrics_loop, &conn->poll, EPOLLIN|EPOLLOUT|EPOLLET) < 0) {
+			close(fd);
+			conn->poll.fd = -1;
+		}
+	}
+}
+
+static int bind_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		my_syslog(LOG_ERR, "Metrics socket path %s is too long", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		my_syslog(LOG_ERR, "Error creating metrics socket: %d (%m)", errno);
+		return -1;
+	}
+
+	// A socket left by an earlier run is in the way, anything else is kept
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		my_syslog(LOG_ERR, "Error binding metrics socket %s: %d (%m)", path, errno);
+		close(fd);
+		return -1;
+	}
+	listen_path = path;
+	return fd;
+}
+
+int mpt_metrics_inet_addr(const char *spec, struct sockaddr_in *addr)
+{
+	const char *colon = strrchr(spec, ':');
+	const char *port = colon ? colon + 1 : spec;
+	char host[INET_ADDRSTRLEN] = "127.0.0.1";
+	unsigned long n;
+	char *end;
+
+	n = strtoul(port, &end, 10);
+	if (!*port || *end || n == 0 || n > UINT16_MAX)
+		return -1;
+	if (colon) {
+		if ((size_t)(colon - spec) >= sizeof(host))
+			return -1;
+		memcpy(host, spec, colon - spec);
+		host[colon - spec] = 0;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(n);
+	return inet_pton(AF_INET, host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+static int bind_tcp(const char *addr_spec)
+{
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	if (mpt_metrics_inet_addr(addr_spec, &addr) < 0) {
+		my_syslog(LOG_ERR, "Invalid metrics address %s", addr_spec);
+		return -1;
+	}
+
+	fd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		my_syslog(LOG_ERR, "Error creating metrics socket: %d (%m)", errno);
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		my_syslog(LOG_ERR, "Error binding metrics socket %s: %d (%m)", addr_spec, errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int mpt_metrics_listen(struct mpt_loop *loop, const char *addr)
+{
+	unsigned i;
+	int fd;
+
+	if (strncmp(addr, "unix:", 5) == 0)
+		fd = bind_unix(addr + 5);
+	else
+		fd = bind_tcp(addr);
+	if (fd < 0)
+		return -1;
+
+	if (listen(fd, MAX_CONNS) < 0) {
+		my_syslog(LOG_ERR, "Error listening on %s: %d (%m)", addr, errno);
+		close(fd);
+		return -1;
+	}
+
+	for (i = 0; i < MAX_CONNS; i++)
+		conns[i].poll.fd = -1;
+	metrics_loop = loop;
+	listen_poll.fd = fd;
+	listen_poll.handler = handle_listen;
+	return mpt_loop_add(loop, &listen_poll, EPOLLIN);
+}
+
+void mpt_metrics_close(void)
+{
+	unsigned i;
+
+	if (listen_poll.fd < 0)
+		return;
+
+	for (i = 0; i < MAX_CONNS; i++)
+		if (conns[i].poll.fd >= 0)
+			conn_close(&conns[i]);
+
+	close(listen_poll.fd);
+	listen_poll.fd = -1;
+	if (listen_path)
+		unlink(listen_path);
+	listen_path = NULL;
+}
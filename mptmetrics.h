@@ -0,0 +1,66 @@
+#ifndef MPTEVENTS_MPTMETRICS_H
+#define MPTEVENTS_MPTMETRICS_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "mptdecode.h"
+#include "mptloop.h"
+
+/* Counts the records as they are logged and serves the counters in the
+ * Prometheus text format to whoever connects with an HTTP GET, on a unix
+ * socket (unix:PATH) or on a TCP port ([HOST:]PORT, by default on
+ * 127.0.0.1):
+ *
+ *   mpt_events_total{ioc,event}                 repeats included
+ *   mpt_device_status_changes_total{ioc,reason}
+ *   mpt_topology_phy_changes_total{ioc,rc}      per phy entry
+ *   mpt_phy_changes_total{ioc,phy}              per phy entry, by phy number
+ *   mpt_discovery_errors_total{ioc,status}      per DiscoveryStatus bit
+ *   mpt_temperature_threshold_events_total{ioc}
+ *   mpt_temperature_celsius{ioc,sensor}         the last one reported
+ *   mpt_lost_event_gaps_total{ioc}
+ *   mpt_lost_events_total{ioc}
+ *   mpt_context_resets_total{ioc}
+ *
+ * mptstatsd.c pushes the same counters.
+ */
+
+struct mpt_metrics_stats {
+	uint64_t scrapes;
+	uint64_t dropped; // Connections closed for another or a bad request
+};
+
+extern struct mpt_metrics_stats mpt_metrics_stats;
+
+// The record callback of a sink
+int mpt_metrics_record(const struct mpt_record *rec, int priority);
+
+/* A value of one of the kinds above, by ioc and the label when it has one.
+ * The id tells the same counter apart from one walk to the next and is
+ * below mpt_metrics_ids().
+ */
+struct mpt_metric {
+	const char *name; // Without the mpt_ and _total
+	const char *help;
+	int gauge;
+	int ioc;
+	const char *label;
+	const char *label_value;
+	uint64_t value;
+	unsigned id;
+};
+
+typedef void (*mpt_metric_fn)(const struct mpt_metric *m, void *arg);
+
+// Calls fn with each value that isn't zero, in the order of the list above
+void mpt_metrics_walk(mpt_metric_fn fn, void *arg);
+unsigned mpt_metrics_ids(void);
+
+// [HOST:]PORT, 127.0.0.1 by default
+int mpt_metrics_inet_addr(const char *spec, struct sockaddr_in *addr);
+
+int mpt_metrics_listen(struct mpt_loop *loop, const char *addr);
+void mpt_metrics_close(void);
+
+#endif
@@ -1,838 +1,1133 @@
 #include <syslog.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #include "mpt.h"
+#include "mptdecode.h"
+#include "mptencode.h"
+#include "mptline.h"
 
 void (*my_syslog)(int priority, const char *format, ...);
 
-static inline char nibble_to_hex(char nibble)
+static void syslog_line(int priority, const char *line, size_t len)
 {
-	nibble &= 0xF;
-	if (nibble < 10)
-		return '0' + nibble;
-	else
-		return 'A' + nibble - 10;
+	my_syslog(priority, "%s", line);
 }
 
-static void buf2hex(char *buf, int buf_len, char *hexbuf, int hexbuf_sz)
-{
-	int i, j;
+void (*my_syslog_line)(int priority, const char *line, size_t len) = syslog_line;
 
-	for (i = 0, j = 0; i < buf_len && j < hexbuf_sz - 4; i++) {
-		hexbuf[j++] = nibble_to_hex(buf[i] >> 4);
-		hexbuf[j++] = nibble_to_hex(buf[i]);
-		hexbuf[j++] = ' ';
-	}
-	hexbuf[j] = 0;
-}
-
-static const char *reason_code_to_text(unsigned rc)
-{
-	switch (rc) {
-		case MPI2_EVENT_SAS_DEV_STAT_RC_SMART_DATA:
-			return "SMART_DATA";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_UNSUPPORTED:
-			return "UNSUPPORTED";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_INTERNAL_DEVICE_RESET:
-			return "INTERNAL_DEVICE_RESET";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_TASK_ABORT_INTERNAL:
-			return "TASK_ABORT_INTERNAL";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_ABORT_TASK_SET_INTERNAL:
-			return "ABORT_TASK_SET_INTERNAL";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_CLEAR_TASK_SET_INTERNAL:
-			return "CLEAR_TASK_SET_INTERNAL";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_QUERY_TASK_INTERNAL:
-			return "QUERY_TASK_INTERNAL";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_ASYNC_NOTIFICATION:
-			return "ASYNC_NOTIFICATION";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_CMP_INTERNAL_DEV_RESET:
-			return "COMPLETED_INTERNAL_DEV_RESET";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_CMP_TASK_ABORT_INTERNAL:
-			return "COMPLETED_TASK_ABORT_INTERNAL";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_SATA_INIT_FAILURE:
-			return "SATA_INIT_FAILURE";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_EXPANDER_REDUCED_FUNCTIONALITY:
-			return "EXPANDER_REDUCED_FUNCTIONALITY";
-		case MPI2_EVENT_SAS_DEV_STAT_RC_CMP_EXPANDER_REDUCED_FUNCTIONALITY:
-			return "COMPLETED_EXPANDER_REDUCED_FUNCTIONALITY";
-	}
+/* The meaning of the values is looked up in dense tables indexed by the
+ * value, a formatter that needs to build its text does so in the buffer of
+ * the caller so the decoder can be used from any thread.
+ */
 
-	return "UNKNOWN";
-}
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
-static void dump_sas_device_status_change(struct MPT2_IOCTL_EVENTS *event,
-                                          int ioc)
+static inline const char *name_lookup(const char *const *names, size_t nr, uint32_t value, const char *unknown)
 {
-	MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "SAS Device Status Change: ioc=%d context=%u tag=%04x rc=%u(%s) port=%u asc=%02X ascq=%02X handle=%04x reserved2=%u SASAddress=%"PRIx64, ioc, event->context, evt->TaskTag, evt->ReasonCode, reason_code_to_text(evt->ReasonCode), evt->PhysicalPort, evt->ASC, evt->ASCQ, evt->DevHandle, evt->Reserved2, evt->SASAddress);
+	if (value < nr && names[value])
+		return names[value];
+	return unknown;
 }
 
-static void dump_log_data(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_LOG_ENTRY_ADDED *evt = (void*)&event->data;
-	char log_data_hex[MPI2_EVENT_DATA_LOG_DATA_LENGTH*3]; // Add place for a space after each hex number and a null
+#define NAME(names, value) name_lookup(names, ARRAY_SIZE(names), value, "UNKNOWN")
 
-	buf2hex((char*)evt->LogData, MPI2_EVENT_DATA_LOG_DATA_LENGTH, log_data_hex, sizeof(log_data_hex));
-	my_syslog(LOG_INFO, "Log Entry Added: context=%u timestamp=%"PRIu64" reserved1=%u seq=%u entry_qualifier=%u vp_id=%u vf_id=%u reserved2=%u log_data='%s'",
-			event->context, evt->TimeStamp, evt->Reserved1, evt->LogSequence, evt->LogEntryQualifier, evt->VP_ID, evt->VF_ID, evt->Reserved2, log_data_hex);
-}
+struct flag_name {
+	uint32_t flag;
+	const char *name;
+};
 
-static void dump_gpio_interrupt(struct MPT2_IOCTL_EVENTS *event)
+/* Append to a NUL terminated buffer, truncating what doesn't fit */
+static size_t text_append(char *buf, size_t size, size_t len, const char *s)
 {
-	MPI2_EVENT_DATA_GPIO_INTERRUPT *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "GPIO Interrupt: context=%u gpionum=%u reserved1=%u reserved2=%u", event->context, evt->GPIONum, evt->Reserved1, evt->Reserved2);
+	while (*s && len + 1 < size)
+		buf[len++] = *s++;
+	if (len < size)
+		buf[len] = 0;
+	return len;
 }
 
-static void dump_name_only(const char *name, struct MPT2_IOCTL_EVENTS *event)
+/* The names of the flags that are set, separated by commas */
+static size_t flags_text(const struct flag_name *flags, size_t nr, uint32_t value, char *buf, size_t size, size_t len)
 {
-	char hexbuf[512];
+	size_t start = len;
+	size_t i;
 
-	buf2hex((char *)event->data, sizeof(event->data), hexbuf, sizeof(hexbuf));
-	my_syslog(LOG_INFO, "%s: event=%u context=%u buf=%s", name, event->event, event->context, hexbuf);
+	for (i = 0; i < nr; i++) {
+		if (!(value & flags[i].flag))
+			continue;
+		if (len > start)
+			len = text_append(buf, size, len, ",");
+		len = text_append(buf, size, len, flags[i].name);
+	}
+	return len;
 }
 
-static void dump_temperature_threshold(struct MPT2_IOCTL_EVENTS *event)
+static const char *const reason_code_names[] = {
+	[MPI2_EVENT_SAS_DEV_STAT_RC_SMART_DATA] = "SMART_DATA",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_UNSUPPORTED] = "UNSUPPORTED",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_INTERNAL_DEVICE_RESET] = "INTERNAL_DEVICE_RESET",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_TASK_ABORT_INTERNAL] = "TASK_ABORT_INTERNAL",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_ABORT_TASK_SET_INTERNAL] = "ABORT_TASK_SET_INTERNAL",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_CLEAR_TASK_SET_INTERNAL] = "CLEAR_TASK_SET_INTERNAL",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_QUERY_TASK_INTERNAL] = "QUERY_TASK_INTERNAL",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_ASYNC_NOTIFICATION] = "ASYNC_NOTIFICATION",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_CMP_INTERNAL_DEV_RESET] = "COMPLETED_INTERNAL_DEV_RESET",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_CMP_TASK_ABORT_INTERNAL] = "COMPLETED_TASK_ABORT_INTERNAL",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_SATA_INIT_FAILURE] = "SATA_INIT_FAILURE",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_EXPANDER_REDUCED_FUNCTIONALITY] = "EXPANDER_REDUCED_FUNCTIONALITY",
+	[MPI2_EVENT_SAS_DEV_STAT_RC_CMP_EXPANDER_REDUCED_FUNCTIONALITY] = "COMPLETED_EXPANDER_REDUCED_FUNCTIONALITY",
+};
+
+static const char *reason_code_to_text(uint32_t rc, char *buf, size_t size)
 {
-	MPI2_EVENT_DATA_TEMPERATURE *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "Temperature Threshold: context=%u status=%04x sensornum=%u current_temp=%u reversed1=%u reserved2=%u reserved3=%u reserved4=%u", event->context, evt->Status, evt->SensorNum, evt->CurrentTemperature, evt->Reserved1, evt->Reserved2, evt->Reserved3, evt->Reserved4);
+	return NAME(reason_code_names, rc);
 }
 
-static void dump_hard_reset_received(struct MPT2_IOCTL_EVENTS *event)
+const char *mpt_reason_code_name(uint32_t rc)
 {
-	MPI2_EVENT_DATA_HARD_RESET_RECEIVED *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "Hard Reset Received: context=%u port=%u reserved1=%u reserved2=%u",
-			event->context,
-			evt->Port,
-			evt->Reserved1,
-			evt->Reserved2);
+	return NAME(reason_code_names, rc);
 }
 
-static void dump_task_set_full(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_TASK_SET_FULL *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "Task Set Full: context=%u dev_handle=%hx current_depth=%hu", event->context, evt->DevHandle, evt->CurrentDepth);
-}
+static const char *const raid_op_names[] = {
+	[MPI2_EVENT_IR_RAIDOP_RESYNC] = "RESYNC",
+	[MPI2_EVENT_IR_RAIDOP_ONLINE_CAP_EXPANSION] = "ONLINE_CAPACITY_EXPANSION",
+	[MPI2_EVENT_IR_RAIDOP_CONSISTENCY_CHECK] = "CONSISTENCY_CHECK",
+	[MPI2_EVENT_IR_RAIDOP_BACKGROUND_INIT] = "BACKGROUND_INIT",
+	[MPI2_EVENT_IR_RAIDOP_MAKE_DATA_CONSISTENT] = "MAKE_DATA_CONSISTENT",
+};
 
-static const char *raid_op_to_text(uint8_t raid_op)
+static const char *raid_op_to_text(uint32_t raid_op, char *buf, size_t size)
 {
-	switch (raid_op) {
-		case MPI2_EVENT_IR_RAIDOP_RESYNC:
-			return "RESYNC";
-		case MPI2_EVENT_IR_RAIDOP_ONLINE_CAP_EXPANSION:
-			return "ONLINE_CAPACITY_EXPANSION";
-		case MPI2_EVENT_IR_RAIDOP_CONSISTENCY_CHECK:
-			return "CONSISTENCY_CHECK";
-		case MPI2_EVENT_IR_RAIDOP_BACKGROUND_INIT:
-			return "BACKGROUND_INIT";
-		case MPI2_EVENT_IR_RAIDOP_MAKE_DATA_CONSISTENT:
-			return "MAKE_DATA_CONSISTENT";
-	}
-
-	return "UNKNOWN";
+	return NAME(raid_op_names, raid_op);
 }
 
-static void dump_ir_operation_status(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_IR_OPERATION_STATUS *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "IR Operation Status: context=%u vol_dev_handle=%hx raid_op=%hhu(%s) percent=%hhu elapsed_sec=%u reserved1=%hu reserved2=%hu",
-			event->context,
-			evt->VolDevHandle,
-			evt->RAIDOperation, raid_op_to_text(evt->RAIDOperation),
-			evt->PercentComplete,
-			evt->ElapsedSeconds,
-			evt->Reserved1,
-			evt->Reserved2);
-}
+static const char *const ir_volume_code_names[] = {
+	[MPI2_EVENT_IR_VOLUME_RC_SETTINGS_CHANGED] = "SETTINGS_CHANGED",
+	[MPI2_EVENT_IR_VOLUME_RC_STATUS_FLAGS_CHANGED] = "STATUS_FLAGS_CHANGED",
+	[MPI2_EVENT_IR_VOLUME_RC_STATE_CHANGED] = "STATE_CHANGED",
+};
 
-static const char *ir_volume_code_to_text(uint8_t rc)
+static const char *ir_volume_code_to_text(uint32_t rc, char *buf, size_t size)
 {
-	switch (rc) {
-		case MPI2_EVENT_IR_VOLUME_RC_SETTINGS_CHANGED: return "SETTINGS_CHANGED";
-		case MPI2_EVENT_IR_VOLUME_RC_STATUS_FLAGS_CHANGED: return "STATUS_FLAGS_CHANGED";
-		case MPI2_EVENT_IR_VOLUME_RC_STATE_CHANGED: return "STATE_CHANGED";
-	}
-
-	return "UNKNOWN";
+	return NAME(ir_volume_code_names, rc);
 }
 
-static void dump_ir_volume(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_IR_VOLUME *evt = (void*)&event->data;
+static const char *const ir_physical_disk_rc_names[] = {
+	[MPI2_EVENT_IR_PHYSDISK_RC_SETTINGS_CHANGED] = "SETTINGS_CHANGED",
+	[MPI2_EVENT_IR_PHYSDISK_RC_STATUS_FLAGS_CHANGED] = "STATUS_FLAGS_CHANGED",
+	[MPI2_EVENT_IR_PHYSDISK_RC_STATE_CHANGED] = "STATE_CHANGED",
+};
 
-	my_syslog(LOG_INFO, "IR Volume: context=%u vol_dev_handle=%hx reason=%hhu(%s) new_value=%u prev_value=%u reserved1=%hhu",
-			event->context,
-			evt->VolDevHandle,
-			evt->ReasonCode, ir_volume_code_to_text(evt->ReasonCode),
-			evt->NewValue,
-			evt->PreviousValue,
-			evt->Reserved1);
+static const char *ir_physical_disk_rc_to_text(uint32_t rc, char *buf, size_t size)
+{
+	return NAME(ir_physical_disk_rc_names, rc);
 }
 
-static const char *ir_physical_disk_rc_to_text(uint8_t rc)
-{
-	switch (rc) {
-		case MPI2_EVENT_IR_PHYSDISK_RC_SETTINGS_CHANGED: return "SETTINGS_CHANGED";
-		case MPI2_EVENT_IR_PHYSDISK_RC_STATUS_FLAGS_CHANGED: return "STATUS_FLAGS_CHANGED";
-		case MPI2_EVENT_IR_PHYSDISK_RC_STATE_CHANGED: return "STATE_CHANGED";
-	}
+static const char *const ir_config_element_flag_names[] = {
+	[MPI2_EVENT_IR_CHANGE_EFLAGS_VOLUME_ELEMENT] = "VOLUME_ELEMENT",
+	[MPI2_EVENT_IR_CHANGE_EFLAGS_VOLPHYSDISK_ELEMENT] = "VOLPHYSDISK_ELEMENT",
+	[MPI2_EVENT_IR_CHANGE_EFLAGS_HOTSPARE_ELEMENT] = "HOTSPARE_ELEMENT",
+};
 
-	return "UNKNOWN";
+static const char *ir_config_element_flag_to_text(uint32_t flags, char *buf, size_t size)
+{
+	return NAME(ir_config_element_flag_names, flags & MPI2_EVENT_IR_CHANGE_EFLAGS_ELEMENT_TYPE_MASK);
 }
 
-static void dump_ir_physical_disk(struct MPT2_IOCTL_EVENTS *event)
+static const char *const ir_config_element_reason_names[] = {
+	[MPI2_EVENT_IR_CHANGE_RC_ADDED] = "ADDED",
+	[MPI2_EVENT_IR_CHANGE_RC_REMOVED] = "REMOVED",
+	[MPI2_EVENT_IR_CHANGE_RC_NO_CHANGE] = "NO_CHANGE",
+	[MPI2_EVENT_IR_CHANGE_RC_HIDE] = "HIDE",
+	[MPI2_EVENT_IR_CHANGE_RC_UNHIDE] = "UNHIDE",
+	[MPI2_EVENT_IR_CHANGE_RC_VOLUME_CREATED] = "VOLUME_CREATED",
+	[MPI2_EVENT_IR_CHANGE_RC_VOLUME_DELETED] = "VOLUME_DELETED",
+	[MPI2_EVENT_IR_CHANGE_RC_PD_CREATED] = "PD_CREATED",
+	[MPI2_EVENT_IR_CHANGE_RC_PD_DELETED] = "PD_DELETED",
+};
+
+static const char *ir_config_element_reason_to_text(uint32_t rc, char *buf, size_t size)
 {
-	MPI2_EVENT_DATA_IR_PHYSICAL_DISK *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "IR Physical Disk: context=%u reason=%hhu(%s) phys_disk_num=%hhu phys_disk_dev_handle=%hx slot=%hu enclosure_handle=%hu new_value=%u prev_value=%u reserved1=%hu reserved2=%hu",
-			event->context,
-			evt->ReasonCode, ir_physical_disk_rc_to_text(evt->ReasonCode),
-			evt->PhysDiskNum,
-			evt->PhysDiskDevHandle,
-			evt->Slot,
-			evt->EnclosureHandle,
-			evt->NewValue,
-			evt->PreviousValue,
-			evt->Reserved1,
-			evt->Reserved2);
+	return NAME(ir_config_element_reason_names, rc);
 }
 
-static const char *ir_config_element_flag_to_text(uint16_t flags)
-{
-	switch (flags & MPI2_EVENT_IR_CHANGE_EFLAGS_ELEMENT_TYPE_MASK) {
-		case MPI2_EVENT_IR_CHANGE_EFLAGS_VOLUME_ELEMENT: return "VOLUME_ELEMENT";
-		case MPI2_EVENT_IR_CHANGE_EFLAGS_VOLPHYSDISK_ELEMENT: return "VOLPHYSDISK_ELEMENT";
-		case MPI2_EVENT_IR_CHANGE_EFLAGS_HOTSPARE_ELEMENT: return "HOTSPARE_ELEMENT";
-	}
+static const struct flag_name sas_discovery_flags[] = {
+	{ MPI2_EVENT_SAS_DISC_IN_PROGRESS, "IN_PROGRESS" },
+	{ MPI2_EVENT_SAS_DISC_DEVICE_CHANGE, "DEVICE_CHANGE" },
+};
 
-	return "UNKNOWN";
+static const char *sas_discovery_flags_to_text(uint32_t flags, char *buf, size_t size)
+{
+	buf[0] = 0;
+	flags_text(sas_discovery_flags, ARRAY_SIZE(sas_discovery_flags), flags, buf, size, 0);
+	return buf;
 }
 
-static const char *ir_config_element_reason_to_text(uint8_t rc)
-{
-	switch (rc) {
-		case MPI2_EVENT_IR_CHANGE_RC_ADDED: return "ADDED";
-		case MPI2_EVENT_IR_CHANGE_RC_REMOVED: return "REMOVED";
-		case MPI2_EVENT_IR_CHANGE_RC_NO_CHANGE: return "NO_CHANGE";
-		case MPI2_EVENT_IR_CHANGE_RC_HIDE: return "HIDE";
-		case MPI2_EVENT_IR_CHANGE_RC_UNHIDE: return "UNHIDE";
-		case MPI2_EVENT_IR_CHANGE_RC_VOLUME_CREATED: return "VOLUME_CREATED";
-		case MPI2_EVENT_IR_CHANGE_RC_VOLUME_DELETED: return "VOLUME_DELETED";
-		case MPI2_EVENT_IR_CHANGE_RC_PD_CREATED: return "PD_CREATED";
-		case MPI2_EVENT_IR_CHANGE_RC_PD_DELETED: return "PD_DELETED";
-	}
+static const char *const sas_discovery_reason_names[] = {
+	[MPI2_EVENT_SAS_DISC_RC_STARTED] = "STARTED",
+	[MPI2_EVENT_SAS_DISC_RC_COMPLETED] = "COMPLETED",
+};
 
-	return "UNKNOWN";
+static const char *sas_discovery_reason_to_text(uint32_t reason, char *buf, size_t size)
+{
+	return NAME(sas_discovery_reason_names, reason);
 }
 
-static void dump_ir_config_change_list(struct MPT2_IOCTL_EVENTS *event)
+static const struct flag_name sas_discovery_status_flags[] = {
+	{ MPI2_EVENT_SAS_DISC_DS_MAX_ENCLOSURES_EXCEED, "MAX_ENCLOSURES_EXCEED" },
+	{ MPI2_EVENT_SAS_DISC_DS_MAX_EXPANDERS_EXCEED, "MAX_EXPANDERS_EXCEED" },
+	{ MPI2_EVENT_SAS_DISC_DS_MAX_DEVICES_EXCEED, "MAX_DEVICES_EXCEED" },
+	{ MPI2_EVENT_SAS_DISC_DS_MAX_TOPO_PHYS_EXCEED, "MAX_TOPO_PHYS_EXCEED" },
+	{ MPI2_EVENT_SAS_DISC_DS_DOWNSTREAM_INITIATOR, "DOWNSTREAM_INITIATOR" },
+	{ MPI2_EVENT_SAS_DISC_DS_MULTI_SUBTRACTIVE_SUBTRACTIVE, "MULTI_SUBTRACTIVE_SUBTRACTIVE" },
+	{ MPI2_EVENT_SAS_DISC_DS_EXP_MULTI_SUBTRACTIVE, "EXP_MULTI_SUBTRACTIVE" },
+	{ MPI2_EVENT_SAS_DISC_DS_MULTI_PORT_DOMAIN, "MULTI_PORT_DOMAIN" },
+	{ MPI2_EVENT_SAS_DISC_DS_TABLE_TO_SUBTRACTIVE_LINK, "TABLE_TO_SUBTRACTIVE_LINK" },
+	{ MPI2_EVENT_SAS_DISC_DS_UNSUPPORTED_DEVICE, "UNSUPPORTED_DEVICE" },
+	{ MPI2_EVENT_SAS_DISC_DS_TABLE_LINK, "TABLE_LINK" },
+	{ MPI2_EVENT_SAS_DISC_DS_SUBTRACTIVE_LINK, "SUBTRACTIVE_LINK" },
+	{ MPI2_EVENT_SAS_DISC_DS_SMP_CRC_ERROR, "SMP_CRC_ERROR" },
+	{ MPI2_EVENT_SAS_DISC_DS_SMP_FUNCTION_FAILED, "SMP_FUNCTION_FAILED" },
+	{ MPI2_EVENT_SAS_DISC_DS_INDEX_NOT_EXIST, "INDEX_NOT_EXIST" },
+	{ MPI2_EVENT_SAS_DISC_DS_OUT_ROUTE_ENTRIES, "OUT_ROUTE_ENTRIES" },
+	{ MPI2_EVENT_SAS_DISC_DS_SMP_TIMEOUT, "SMP_TIMEOUT" },
+	{ MPI2_EVENT_SAS_DISC_DS_MULTIPLE_PORTS, "MULTIPLE_PORTS" },
+	{ MPI2_EVENT_SAS_DISC_DS_UNADDRESSABLE_DEVICE, "UNADDRESSABLE_DEVICE" },
+	{ MPI2_EVENT_SAS_DISC_DS_LOOP_DETECTED, "LOOP_DETECTED" },
+};
+
+static const char *sas_discovery_status_to_text(uint32_t status, char *buf, size_t size)
 {
-	MPI2_EVENT_DATA_IR_CONFIG_CHANGE_LIST *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "IR Config Change List: context=%u num_elements=%hhu config_num=%hhu flags=%x reserved1=%hhu reserved2=%hhu",
-			event->context,
-			evt->NumElements,
-			evt->ConfigNum,
-			evt->Flags,
-			evt->Reserved1,
-			evt->Reserved2);
-
-	int i;
-	for (i = 0; i < evt->NumElements; i++) {
-		MPI2_EVENT_IR_CONFIG_ELEMENT *elem = &evt->ConfigElement[i];
-		my_syslog(LOG_INFO, "IR Config Change List Element (%d/%d): flags=%hx(%s) vol_dev_handle=%hx reason=%hhu(%s) phys_disk_num=%hhu phys_disk_dev_handle=%hx",
-				i+1, evt->NumElements,
-				elem->ElementFlags, ir_config_element_flag_to_text(elem->ElementFlags),
-				elem->VolDevHandle,
-				elem->ReasonCode, ir_config_element_reason_to_text(elem->ReasonCode),
-				elem->PhysDiskNum,
-				elem->PhysDiskDevHandle);
-	}
+	buf[0] = 0;
+	flags_text(sas_discovery_status_flags, ARRAY_SIZE(sas_discovery_status_flags), status, buf, size, 0);
+	return buf;
 }
 
-static const char *sas_discovery_flags_to_text(uint8_t flags)
+const char *mpt_discovery_status_name(unsigned bit)
 {
-	static char text[128];
-	int i = 0;
-
-	text[0] = 0; // Re-initialize static buffer
-	if (flags & MPI2_EVENT_SAS_DISC_IN_PROGRESS)
-		i += sprintf(text, "%s", "IN_PROGRESS");
-	if (flags & MPI2_EVENT_SAS_DISC_DEVICE_CHANGE) {
-		if (i > 0)
-			text[i++] = ',';
-		sprintf(text + i, "%s", "DEVICE_CHANGE");
-	}
-	return text;
-}
-
-static const char *sas_discovery_reason_to_text(uint8_t reason)
-{
-	if (reason == MPI2_EVENT_SAS_DISC_RC_STARTED)
-		return "STARTED";
-	else if (reason == MPI2_EVENT_SAS_DISC_RC_COMPLETED)
-		return "COMPLETED";
-	else
-		return "UNKNOWN";
-}
-
-static const char *sas_discovery_status_to_text(uint32_t status)
-{
-	static char text[256];
-	int i = 0;
-
-	text[0] = 0; // Re-initialize static buffer
-#define OUTPUT_FLAG(val, name) \
-	do { \
-		if (status & val) { \
-			if (i > 0) \
-				text[i++] = ','; \
-			i += sprintf(text+i, "%s", name); \
-		} \
-	} while (0)
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_MAX_ENCLOSURES_EXCEED, "MAX_ENCLOSURES_EXCEED");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_MAX_EXPANDERS_EXCEED, "MAX_EXPANDERS_EXCEED");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_MAX_DEVICES_EXCEED, "MAX_DEVICES_EXCEED");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_MAX_TOPO_PHYS_EXCEED, "MAX_TOPO_PHYS_EXCEED");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_DOWNSTREAM_INITIATOR, "DOWNSTREAM_INITIATOR");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_MULTI_SUBTRACTIVE_SUBTRACTIVE, "MULTI_SUBTRACTIVE_SUBTRACTIVE");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_EXP_MULTI_SUBTRACTIVE, "EXP_MULTI_SUBTRACTIVE");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_MULTI_PORT_DOMAIN, "MULTI_PORT_DOMAIN");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_TABLE_TO_SUBTRACTIVE_LINK, "TABLE_TO_SUBTRACTIVE_LINK");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_UNSUPPORTED_DEVICE, "UNSUPPORTED_DEVICE");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_TABLE_LINK, "TABLE_LINK");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_SUBTRACTIVE_LINK, "SUBTRACTIVE_LINK");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_SMP_CRC_ERROR, "SMP_CRC_ERROR");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_SMP_FUNCTION_FAILED, "SMP_FUNCTION_FAILED");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_INDEX_NOT_EXIST, "INDEX_NOT_EXIST");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_OUT_ROUTE_ENTRIES, "OUT_ROUTE_ENTRIES");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_SMP_TIMEOUT, "SMP_TIMEOUT");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_MULTIPLE_PORTS, "MULTIPLE_PORTS");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_UNADDRESSABLE_DEVICE, "UNADDRESSABLE_DEVICE");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_DISC_DS_LOOP_DETECTED, "LOOP_DETECTED");
-#undef OUTPUT_FLAG
-
-	return text;
-}
-
-
-static void dump_sas_discovery(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_SAS_DISCOVERY *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "SAS Discovery: context=%u flags=%02hhx(%s) reason=%hhx(%s) physical_port=%hhx discovery_status=%x(%s) reserved1=%hhx",
-			event->context,
-			evt->Flags, sas_discovery_flags_to_text(evt->Flags),
-			evt->ReasonCode, sas_discovery_reason_to_text(evt->ReasonCode),
-			evt->PhysicalPort,
-			evt->DiscoveryStatus, sas_discovery_status_to_text(evt->DiscoveryStatus),
-			evt->Reserved1);
-}
-
-static const char *sas_broadcast_primitive_to_text(uint8_t primitive)
-{
-	switch (primitive) {
-		case MPI2_EVENT_PRIMITIVE_CHANGE: return "CHANGE";
-		case MPI2_EVENT_PRIMITIVE_SES: return "SES";
-		case MPI2_EVENT_PRIMITIVE_EXPANDER: return "EXPANDER";
-		case MPI2_EVENT_PRIMITIVE_ASYNCHRONOUS_EVENT: return "ASYNCHRONOUS_EVENT";
-		case MPI2_EVENT_PRIMITIVE_RESERVED3: return "RESERVED3";
-		case MPI2_EVENT_PRIMITIVE_RESERVED4: return "RESERVED4";
-		case MPI2_EVENT_PRIMITIVE_CHANGE0_RESERVED: return "CHANGE0_RESERVED";
-		case MPI2_EVENT_PRIMITIVE_CHANGE1_RESERVED: return "CHANGE1_RESERVED";
-	}
+	size_t i;
 
+	for (i = 0; i < ARRAY_SIZE(sas_discovery_status_flags); i++)
+		if (sas_discovery_status_flags[i].flag == 1u << bit)
+			return sas_discovery_status_flags[i].name;
 	return "UNKNOWN";
 }
 
-static void dump_sas_broadcast_primitive(struct MPT2_IOCTL_EVENTS *event)
+static const char *const sas_broadcast_primitive_names[] = {
+	[MPI2_EVENT_PRIMITIVE_CHANGE] = "CHANGE",
+	[MPI2_EVENT_PRIMITIVE_SES] = "SES",
+	[MPI2_EVENT_PRIMITIVE_EXPANDER] = "EXPANDER",
+	[MPI2_EVENT_PRIMITIVE_ASYNCHRONOUS_EVENT] = "ASYNCHRONOUS_EVENT",
+	[MPI2_EVENT_PRIMITIVE_RESERVED3] = "RESERVED3",
+	[MPI2_EVENT_PRIMITIVE_RESERVED4] = "RESERVED4",
+	[MPI2_EVENT_PRIMITIVE_CHANGE0_RESERVED] = "CHANGE0_RESERVED",
+	[MPI2_EVENT_PRIMITIVE_CHANGE1_RESERVED] = "CHANGE1_RESERVED",
+};
+
+static const char *sas_broadcast_primitive_to_text(uint32_t primitive, char *buf, size_t size)
 {
-	MPI2_EVENT_DATA_SAS_BROADCAST_PRIMITIVE *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "SAS Broadcast Primitive: context=%u phy_num=%hhu port=%hhu port_width=%hhu primitive=%hhu(%s)",
-			event->context,
-			evt->PhyNum,
-			evt->Port,
-			evt->PortWidth,
-			evt->Primitive, sas_broadcast_primitive_to_text(evt->Primitive));
+	return NAME(sas_broadcast_primitive_names, primitive);
 }
 
-static const char *sas_notify_primitive_to_text(uint8_t primitive)
-{
-	switch (primitive) {
-		case MPI2_EVENT_NOTIFY_ENABLE_SPINUP: return "ENABLE_SPINUP";
-		case MPI2_EVENT_NOTIFY_POWER_LOSS_EXPECTED: return "POWER_LOSS_EXPECTED";
-		case MPI2_EVENT_NOTIFY_RESERVED1: return "RESERVED1";
-		case MPI2_EVENT_NOTIFY_RESERVED2: return "RESERVED2";
-	}
+static const char *const sas_notify_primitive_names[] = {
+	[MPI2_EVENT_NOTIFY_ENABLE_SPINUP] = "ENABLE_SPINUP",
+	[MPI2_EVENT_NOTIFY_POWER_LOSS_EXPECTED] = "POWER_LOSS_EXPECTED",
+	[MPI2_EVENT_NOTIFY_RESERVED1] = "RESERVED1",
+	[MPI2_EVENT_NOTIFY_RESERVED2] = "RESERVED2",
+};
 
-	return "UNKNOWN";
+static const char *sas_notify_primitive_to_text(uint32_t primitive, char *buf, size_t size)
+{
+	return NAME(sas_notify_primitive_names, primitive);
 }
 
-static void dump_sas_notify_primitive(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_SAS_NOTIFY_PRIMITIVE *evt = (void*)&event->data;
+static const char *const sas_init_dev_status_reason_names[] = {
+	[MPI2_EVENT_SAS_INIT_RC_ADDED] = "ADDED",
+	[MPI2_EVENT_SAS_INIT_RC_NOT_RESPONDING] = "NOT_RESPONDING",
+};
 
-	my_syslog(LOG_INFO, "SAS Notify Primitive: context=%u phy_num=%hhu port=%hhu primitive=%hhu(%s) reserved1=%hhx",
-			event->context,
-			evt->PhyNum,
-			evt->Port,
-			evt->Primitive, sas_notify_primitive_to_text(evt->Primitive),
-			evt->Reserved1);
+static const char *sas_init_dev_status_reason_to_text(uint32_t reason, char *buf, size_t size)
+{
+	return NAME(sas_init_dev_status_reason_names, reason);
 }
 
-static const char *sas_init_dev_status_reason_to_text(uint8_t reason)
-{
-	switch (reason) {
-		case MPI2_EVENT_SAS_INIT_RC_ADDED: return "ADDED";
-		case MPI2_EVENT_SAS_INIT_RC_NOT_RESPONDING: return "NOT_RESPONDING";
-	}
+static const char *const sas_topology_change_list_status_names[] = {
+	[MPI2_EVENT_SAS_TOPO_ES_NO_EXPANDER] = "NO_EXPANDER",
+	[MPI2_EVENT_SAS_TOPO_ES_ADDED] = "ADDED",
+	[MPI2_EVENT_SAS_TOPO_ES_NOT_RESPONDING] = "NOT_RESPONDING",
+	[MPI2_EVENT_SAS_TOPO_ES_RESPONDING] = "RESPONDING",
+	[MPI2_EVENT_SAS_TOPO_ES_DELAY_NOT_RESPONDING] = "DELAY_NOT_RESPONDING",
+};
 
-	return "UNKNOWN";
+static const char *sas_topology_change_list_status_to_text(uint32_t status, char *buf, size_t size)
+{
+	return NAME(sas_topology_change_list_status_names, status);
 }
 
-static void dump_sas_init_dev_status_change(struct MPT2_IOCTL_EVENTS *event)
+static const char *const sas_topo_link_rate_names[] = {
+	[MPI2_EVENT_SAS_TOPO_LR_UNKNOWN_LINK_RATE] = "UNKNOWN_LINK_RATE",
+	[MPI2_EVENT_SAS_TOPO_LR_PHY_DISABLED] = "PHY_DISABLED",
+	[MPI2_EVENT_SAS_TOPO_LR_NEGOTIATION_FAILED] = "NEGOTIATION_FAILED",
+	[MPI2_EVENT_SAS_TOPO_LR_SATA_OOB_COMPLETE] = "SATA_OOB_COMPLETE",
+	[MPI2_EVENT_SAS_TOPO_LR_PORT_SELECTOR] = "PORT_SELECTOR",
+	[MPI2_EVENT_SAS_TOPO_LR_SMP_RESET_IN_PROGRESS] = "SMP_RESET_IN_PROGRESS",
+	[MPI2_EVENT_SAS_TOPO_LR_UNSUPPORTED_PHY] = "UNSUPPORTED_PHY",
+	[MPI2_EVENT_SAS_TOPO_LR_RATE_1_5] = "RATE_1_5",
+	[MPI2_EVENT_SAS_TOPO_LR_RATE_3_0] = "RATE_3_0",
+	[MPI2_EVENT_SAS_TOPO_LR_RATE_6_0] = "RATE_6_0",
+	[MPI25_EVENT_SAS_TOPO_LR_RATE_12_0] = "RATE_12_0",
+};
+
+static const char *sas_topo_link_rates_to_text(uint32_t link_rate, char *buf, size_t size)
 {
-	MPI2_EVENT_DATA_SAS_INIT_DEV_STATUS_CHANGE *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "SAS Init Dev Status Change: context=%u reason=%hhd(%s) phys_port=%hhu dev_handle=%hu sas_address=%"PRIx64,
-			event->context,
-			evt->ReasonCode, sas_init_dev_status_reason_to_text(evt->ReasonCode),
-			evt->PhysicalPort,
-			evt->DevHandle,
-			evt->SASAddress);
+	size_t len;
+
+	len = text_append(buf, size, 0, "prev=");
+	len = text_append(buf, size, len, NAME(sas_topo_link_rate_names,
+				(link_rate & MPI2_EVENT_SAS_TOPO_LR_PREV_MASK) >> MPI2_EVENT_SAS_TOPO_LR_PREV_SHIFT));
+	len = text_append(buf, size, len, ",next=");
+	text_append(buf, size, len, NAME(sas_topo_link_rate_names,
+				(link_rate & MPI2_EVENT_SAS_TOPO_LR_CURRENT_MASK) >> MPI2_EVENT_SAS_TOPO_LR_CURRENT_SHIFT));
+	return buf;
 }
 
-static void dump_sas_init_table_overflow(struct MPT2_IOCTL_EVENTS *event)
+static const struct flag_name sas_topo_phy_status_flags[] = {
+	{ MPI2_EVENT_SAS_TOPO_PHYSTATUS_VACANT, "PHYSTATUS_VACANT" },
+	{ 0x40, "UNKNOWN_40" },
+	{ 0x20, "UNKNOWN_20" },
+	{ MPI2_EVENT_SAS_TOPO_PS_MULTIPLEX_CHANGE, "PS_MULTIPLEX_CHANGE" },
+};
+
+static const char *const sas_topo_phy_rc_names[] = {
+	[MPI2_EVENT_SAS_TOPO_RC_TARG_ADDED] = "TARG_ADDED",
+	[MPI2_EVENT_SAS_TOPO_RC_TARG_NOT_RESPONDING] = "TARG_NOT_RESPONDING",
+	[MPI2_EVENT_SAS_TOPO_RC_PHY_CHANGED] = "PHY_CHANGED",
+	[MPI2_EVENT_SAS_TOPO_RC_NO_CHANGE] = "NO_CHANGE",
+	[MPI2_EVENT_SAS_TOPO_RC_DELAY_NOT_RESPONDING] = "DELAY_NOT_RESPONDING",
+};
+
+static const char *sas_topo_phy_status_to_text(uint32_t status, char *buf, size_t size)
 {
-	MPI2_EVENT_DATA_SAS_INIT_TABLE_OVERFLOW *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "SAS Init Table Overflow: context=%u max_init=%hu current_init=%hu sas_address=%"PRIx64,
-			event->context,
-			evt->MaxInit,
-			evt->CurrentInit,
-			evt->SASAddress);
+	size_t len;
+
+	buf[0] = 0;
+	len = flags_text(sas_topo_phy_status_flags, ARRAY_SIZE(sas_topo_phy_status_flags), status, buf, size, 0);
+	if (len > 0)
+		len = text_append(buf, size, len, ",");
+	text_append(buf, size, len, NAME(sas_topo_phy_rc_names, status & MPI2_EVENT_SAS_TOPO_RC_MASK));
+	return buf;
 }
 
-static const char *sas_topology_change_list_status_to_text(uint8_t status)
+const char *mpt_topo_phy_rc_name(uint32_t rc)
 {
-	switch (status) {
-		case MPI2_EVENT_SAS_TOPO_ES_NO_EXPANDER: return "NO_EXPANDER";
-		case MPI2_EVENT_SAS_TOPO_ES_ADDED: return "ADDED";
-		case MPI2_EVENT_SAS_TOPO_ES_NOT_RESPONDING: return "NOT_RESPONDING";
-		case MPI2_EVENT_SAS_TOPO_ES_RESPONDING: return "RESPONDING";
-		case MPI2_EVENT_SAS_TOPO_ES_DELAY_NOT_RESPONDING: return "DELAY_NOT_RESPONDING";
-	}
-
-	return "UNKNOWN";
+	return NAME(sas_topo_phy_rc_names, rc);
 }
 
-static const char *sas_topo_link_rate_to_text(uint8_t link_rate)
-{
-	switch (link_rate) {
-		case MPI2_EVENT_SAS_TOPO_LR_UNKNOWN_LINK_RATE: return "UNKNOWN_LINK_RATE";
-		case MPI2_EVENT_SAS_TOPO_LR_PHY_DISABLED: return "PHY_DISABLED";
-		case MPI2_EVENT_SAS_TOPO_LR_NEGOTIATION_FAILED: return "NEGOTIATION_FAILED";
-		case MPI2_EVENT_SAS_TOPO_LR_SATA_OOB_COMPLETE: return "SATA_OOB_COMPLETE";
-		case MPI2_EVENT_SAS_TOPO_LR_PORT_SELECTOR: return "PORT_SELECTOR";
-		case MPI2_EVENT_SAS_TOPO_LR_SMP_RESET_IN_PROGRESS: return "SMP_RESET_IN_PROGRESS";
-		case MPI2_EVENT_SAS_TOPO_LR_UNSUPPORTED_PHY: return "UNSUPPORTED_PHY";
-		case MPI2_EVENT_SAS_TOPO_LR_RATE_1_5: return "RATE_1_5";
-		case MPI2_EVENT_SAS_TOPO_LR_RATE_3_0: return "RATE_3_0";
-		case MPI2_EVENT_SAS_TOPO_LR_RATE_6_0: return "RATE_6_0";
-		case MPI25_EVENT_SAS_TOPO_LR_RATE_12_0: return "RATE_12_0";
-	}
+static const char *const sas_enclosure_dev_status_change_reason_names[] = {
+	[MPI2_EVENT_SAS_ENCL_RC_ADDED] = "ADDED",
+	[MPI2_EVENT_SAS_ENCL_RC_NOT_RESPONDING] = "NOT_RESPONDING",
+};
 
-	return "UNKNOWN";
+static const char *sas_enclosure_dev_status_change_reason_to_text(uint32_t reason, char *buf, size_t size)
+{
+	return NAME(sas_enclosure_dev_status_change_reason_names, reason);
 }
 
-static const char *sas_topo_phy_status_to_text(uint8_t status)
-{
-	static char text[256];
-	int i = 0;
-
-	text[0] = 0; // Re-initialize static buffer
-#define OUTPUT_FLAG(val, name) \
-	do { \
-		if (status & val) { \
-			if (i > 0) \
-				text[i++] = ','; \
-			i += sprintf(text+i, "%s", name); \
-		} \
-	} while (0)
-	OUTPUT_FLAG(MPI2_EVENT_SAS_TOPO_PHYSTATUS_VACANT, "PHYSTATUS_VACANT");
-	OUTPUT_FLAG(0x40, "UNKNOWN_40");
-	OUTPUT_FLAG(0x20, "UNKNOWN_20");
-	OUTPUT_FLAG(MPI2_EVENT_SAS_TOPO_PS_MULTIPLEX_CHANGE, "PS_MULTIPLEX_CHANGE");
-#undef OUTPUT_FLAG
-
-	const char *rc = "UNKNOWN";
-	switch (status & MPI2_EVENT_SAS_TOPO_RC_MASK) {
-		case MPI2_EVENT_SAS_TOPO_RC_TARG_ADDED: rc = "TARG_ADDED"; break;
-		case MPI2_EVENT_SAS_TOPO_RC_TARG_NOT_RESPONDING: rc = "TARG_NOT_RESPONDING"; break;
-		case MPI2_EVENT_SAS_TOPO_RC_PHY_CHANGED: rc = "PHY_CHANGED"; break;
-		case MPI2_EVENT_SAS_TOPO_RC_NO_CHANGE: rc = "NO_CHANGE"; break;
-		case MPI2_EVENT_SAS_TOPO_RC_DELAY_NOT_RESPONDING: rc = "DELAY_NOT_RESPONDING"; break;
-	}
-
-	if (i > 0)
-		text[i++] = ',';
-	sprintf(text+i, "%s", rc);
+static const char *const sas_quiesce_reason_names[] = {
+	[MPI2_EVENT_SAS_QUIESCE_RC_STARTED] = "STARTED",
+	[MPI2_EVENT_SAS_QUIESCE_RC_COMPLETED] = "COMPLETED",
+};
 
-	return text;
+static const char *sas_quiesce_reason_to_text(uint32_t reason, char *buf, size_t size)
+{
+	return NAME(sas_quiesce_reason_names, reason);
 }
 
-static void dump_sas_topology_change_list(struct MPT2_IOCTL_EVENTS *event)
+static const char *const phy_event_code_names[] = {
+	[MPI2_SASPHY3_EVENT_CODE_NO_EVENT] = "NO_EVENT",
+	[MPI2_SASPHY3_EVENT_CODE_INVALID_DWORD] = "INVALID_DWORD",
+	[MPI2_SASPHY3_EVENT_CODE_RUNNING_DISPARITY_ERROR] = "RUNNING_DISPARITY_ERROR",
+	[MPI2_SASPHY3_EVENT_CODE_LOSS_DWORD_SYNC] = "LOSS_DWORD_SYNC",
+	[MPI2_SASPHY3_EVENT_CODE_PHY_RESET_PROBLEM] = "PHY_RESET_PROBLEM",
+	[MPI2_SASPHY3_EVENT_CODE_ELASTICITY_BUF_OVERFLOW] = "ELASTICITY_BUF_OVERFLOW",
+	[MPI2_SASPHY3_EVENT_CODE_RX_ERROR] = "RX_ERROR",
+	[MPI2_SASPHY3_EVENT_CODE_RX_ADDR_FRAME_ERROR] = "RX_ADDR_FRAME_ERROR",
+	[MPI2_SASPHY3_EVENT_CODE_TX_AC_OPEN_REJECT] = "TX_AC_OPEN_REJECT",
+	[MPI2_SASPHY3_EVENT_CODE_RX_AC_OPEN_REJECT] = "RX_AC_OPEN_REJECT",
+	[MPI2_SASPHY3_EVENT_CODE_TX_RC_OPEN_REJECT] = "TX_RC_OPEN_REJECT",
+	[MPI2_SASPHY3_EVENT_CODE_RX_RC_OPEN_REJECT] = "RX_RC_OPEN_REJECT",
+	[MPI2_SASPHY3_EVENT_CODE_RX_AIP_PARTIAL_WAITING_ON] = "RX_AIP_PARTIAL_WAITING_ON",
+	[MPI2_SASPHY3_EVENT_CODE_RX_AIP_CONNECT_WAITING_ON] = "RX_AIP_CONNECT_WAITING_ON",
+	[MPI2_SASPHY3_EVENT_CODE_TX_BREAK] = "TX_BREAK",
+	[MPI2_SASPHY3_EVENT_CODE_RX_BREAK] = "RX_BREAK",
+	[MPI2_SASPHY3_EVENT_CODE_BREAK_TIMEOUT] = "BREAK_TIMEOUT",
+	[MPI2_SASPHY3_EVENT_CODE_CONNECTION] = "CONNECTION",
+	[MPI2_SASPHY3_EVENT_CODE_PEAKTX_PATHWAY_BLOCKED] = "PEAKTX_PATHWAY_BLOCKED",
+	[MPI2_SASPHY3_EVENT_CODE_PEAKTX_ARB_WAIT_TIME] = "PEAKTX_ARB_WAIT_TIME",
+	[MPI2_SASPHY3_EVENT_CODE_PEAK_ARB_WAIT_TIME] = "PEAK_ARB_WAIT_TIME",
+	[MPI2_SASPHY3_EVENT_CODE_PEAK_CONNECT_TIME] = "PEAK_CONNECT_TIME",
+	[MPI2_SASPHY3_EVENT_CODE_TX_SSP_FRAMES] = "TX_SSP_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_RX_SSP_FRAMES] = "RX_SSP_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_TX_SSP_ERROR_FRAMES] = "TX_SSP_ERROR_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_RX_SSP_ERROR_FRAMES] = "RX_SSP_ERROR_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_TX_CREDIT_BLOCKED] = "TX_CREDIT_BLOCKED",
+	[MPI2_SASPHY3_EVENT_CODE_RX_CREDIT_BLOCKED] = "RX_CREDIT_BLOCKED",
+	[MPI2_SASPHY3_EVENT_CODE_TX_SATA_FRAMES] = "TX_SATA_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_RX_SATA_FRAMES] = "RX_SATA_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_SATA_OVERFLOW] = "SATA_OVERFLOW",
+	[MPI2_SASPHY3_EVENT_CODE_TX_SMP_FRAMES] = "TX_SMP_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_RX_SMP_FRAMES] = "RX_SMP_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_RX_SMP_ERROR_FRAMES] = "RX_SMP_ERROR_FRAMES",
+	[MPI2_SASPHY3_EVENT_CODE_HOTPLUG_TIMEOUT] = "HOTPLUG_TIMEOUT",
+	[MPI2_SASPHY3_EVENT_CODE_MISALIGNED_MUX_PRIMITIVE] = "MISALIGNED_MUX_PRIMITIVE",
+	[MPI2_SASPHY3_EVENT_CODE_RX_AIP] = "RX_AIP",
+};
+
+static const char *phy_event_code_to_text(uint32_t code, char *buf, size_t size)
 {
-	MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "SAS Topology Change List: context=%u enclosure_handle=%hx expander_dev_handle=%hx num_phys=%hhu num_entries=%hhu start_phy_num=%hhu exp_status=%hhu(%s) physical_port=%hhu reserved1=%hhu reserved2=%hu",
-			event->context,
-			evt->EnclosureHandle,
-			evt->ExpanderDevHandle,
-			evt->NumPhys,
-			evt->NumEntries,
-			evt->StartPhyNum,
-			evt->ExpStatus, sas_topology_change_list_status_to_text(evt->ExpStatus),
-			evt->PhysicalPort,
-			evt->Reserved1,
-			evt->Reserved2);
-
-	int i;
-	for (i = 0; i < evt->NumEntries; i++) {
-		MPI2_EVENT_SAS_TOPO_PHY_ENTRY *entry = &evt->PHY[i];
-		my_syslog(LOG_INFO, "SAS Topology Change List Entry (%d/%d): attached_dev_handle=%hx link_rate=%hhx(prev=%s,next=%s) phy_status=%hhu(%s)",
-				i+1, evt->NumEntries,
-				entry->AttachedDevHandle,
-				entry->LinkRate,
-				sas_topo_link_rate_to_text((entry->LinkRate & MPI2_EVENT_SAS_TOPO_LR_PREV_MASK) >> MPI2_EVENT_SAS_TOPO_LR_PREV_SHIFT),
-				sas_topo_link_rate_to_text((entry->LinkRate & MPI2_EVENT_SAS_TOPO_LR_CURRENT_MASK) >> MPI2_EVENT_SAS_TOPO_LR_CURRENT_SHIFT),
-				entry->PhyStatus, sas_topo_phy_status_to_text(entry->PhyStatus));
-	}
+	return NAME(phy_event_code_names, code);
 }
 
-static const char *sas_enclosure_dev_status_change_reason_to_text(uint8_t reason)
-{
-	switch (reason) {
-		case MPI2_EVENT_SAS_ENCL_RC_ADDED: return "ADDED";
-		case MPI2_EVENT_SAS_ENCL_RC_NOT_RESPONDING: return "NOT_RESPONDING";
-	}
+static const char *const counter_type_names[] = {
+	[MPI2_SASPHY3_COUNTER_TYPE_WRAPPING] = "WRAPPING",
+	[MPI2_SASPHY3_COUNTER_TYPE_SATURATING] = "SATURATING",
+	[MPI2_SASPHY3_COUNTER_TYPE_PEAK_VALUE] = "PEAK_VALUE",
+};
 
-	return "UNKNOWN";
+static const char *counter_type_to_text(uint32_t type, char *buf, size_t size)
+{
+	return NAME(counter_type_names, type);
 }
 
-static void dump_sas_enclosure_device_status_change(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_SAS_ENCL_DEV_STATUS_CHANGE *evt = (void*)&event->data;
+static const char *const time_units_names[] = {
+	[MPI2_SASPHY3_TIME_UNITS_10_MICROSECONDS] = "10_MICROSECONDS",
+	[MPI2_SASPHY3_TIME_UNITS_100_MICROSECONDS] = "100_MICROSECONDS",
+	[MPI2_SASPHY3_TIME_UNITS_1_MILLISECOND] = "1_MILLISECOND",
+	[MPI2_SASPHY3_TIME_UNITS_10_MILLISECONDS] = "10_MILLISECONDS",
+};
 
-	my_syslog(LOG_INFO, "SAS Enclosure Device Status Change: context=%u enclosure_handle=%hx reason=%hhu(%s) enclosure_logical_id=%"PRIx64" num_slots=%hu start_slot=%hu phy_bits=%x",
-			event->context,
-			evt->EnclosureHandle,
-			evt->ReasonCode, sas_enclosure_dev_status_change_reason_to_text(evt->ReasonCode),
-			evt->EnclosureLogicalID,
-			evt->NumSlots,
-			evt->StartSlot,
-			evt->PhyBits);
+static const char *time_units_to_text(uint32_t unit, char *buf, size_t size)
+{
+	return NAME(time_units_names, unit);
 }
 
-static const char *sas_quiesce_reason_to_text(uint8_t reason)
-{
-	switch (reason) {
-		case MPI2_EVENT_SAS_QUIESCE_RC_STARTED: return "STARTED";
-		case MPI2_EVENT_SAS_QUIESCE_RC_COMPLETED: return "COMPLETED";
-	}
+static const char *const threshold_flags_names[] = {
+	[MPI2_SASPHY3_TFLAGS_PHY_RESET] = "PHY_RESET",
+	[MPI2_SASPHY3_TFLAGS_EVENT_NOTIFY] = "EVENT_NOTIFY",
+	[MPI2_SASPHY3_TFLAGS_EVENT_NOTIFY|MPI2_SASPHY3_TFLAGS_PHY_RESET] = "PHY_RESET,EVENT_NOTIFY",
+};
 
-	return "UNKNOWN";
+static const char *threshold_flags_to_text(uint32_t flags, char *buf, size_t size)
+{
+	// The flags only take the low byte
+	return NAME(threshold_flags_names, flags & 0xFF);
 }
 
-static void dump_sas_quiesce(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_SAS_QUIESCE *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "SAS Quiesce: context=%u reason=%hhu(%s) reserved1=%hhu reserved2=%hu reserved3=%u",
-			event->context,
-			evt->ReasonCode, sas_quiesce_reason_to_text(evt->ReasonCode),
-			evt->Reserved1,
-			evt->Reserved2,
-			evt->Reserved3);
-}
-
-static const char *phy_event_code_to_text(uint8_t code)
-{
-	switch (code) {
-		case MPI2_SASPHY3_EVENT_CODE_NO_EVENT: return "NO_EVENT";
-		case MPI2_SASPHY3_EVENT_CODE_INVALID_DWORD: return "INVALID_DWORD";
-		case MPI2_SASPHY3_EVENT_CODE_RUNNING_DISPARITY_ERROR: return "RUNNING_DISPARITY_ERROR";
-		case MPI2_SASPHY3_EVENT_CODE_LOSS_DWORD_SYNC: return "LOSS_DWORD_SYNC";
-		case MPI2_SASPHY3_EVENT_CODE_PHY_RESET_PROBLEM: return "PHY_RESET_PROBLEM";
-		case MPI2_SASPHY3_EVENT_CODE_ELASTICITY_BUF_OVERFLOW: return "ELASTICITY_BUF_OVERFLOW";
-		case MPI2_SASPHY3_EVENT_CODE_RX_ERROR: return "RX_ERROR";
-		case MPI2_SASPHY3_EVENT_CODE_RX_ADDR_FRAME_ERROR: return "RX_ADDR_FRAME_ERROR";
-		case MPI2_SASPHY3_EVENT_CODE_TX_AC_OPEN_REJECT: return "TX_AC_OPEN_REJECT";
-		case MPI2_SASPHY3_EVENT_CODE_RX_AC_OPEN_REJECT: return "RX_AC_OPEN_REJECT";
-		case MPI2_SASPHY3_EVENT_CODE_TX_RC_OPEN_REJECT: return "TX_RC_OPEN_REJECT";
-		case MPI2_SASPHY3_EVENT_CODE_RX_RC_OPEN_REJECT: return "RX_RC_OPEN_REJECT";
-		case MPI2_SASPHY3_EVENT_CODE_RX_AIP_PARTIAL_WAITING_ON: return "RX_AIP_PARTIAL_WAITING_ON";
-		case MPI2_SASPHY3_EVENT_CODE_RX_AIP_CONNECT_WAITING_ON: return "RX_AIP_CONNECT_WAITING_ON";
-		case MPI2_SASPHY3_EVENT_CODE_TX_BREAK: return "TX_BREAK";
-		case MPI2_SASPHY3_EVENT_CODE_RX_BREAK: return "RX_BREAK";
-		case MPI2_SASPHY3_EVENT_CODE_BREAK_TIMEOUT: return "BREAK_TIMEOUT";
-		case MPI2_SASPHY3_EVENT_CODE_CONNECTION: return "CONNECTION";
-		case MPI2_SASPHY3_EVENT_CODE_PEAKTX_PATHWAY_BLOCKED: return "PEAKTX_PATHWAY_BLOCKED";
-		case MPI2_SASPHY3_EVENT_CODE_PEAKTX_ARB_WAIT_TIME: return "PEAKTX_ARB_WAIT_TIME";
-		case MPI2_SASPHY3_EVENT_CODE_PEAK_ARB_WAIT_TIME: return "PEAK_ARB_WAIT_TIME";
-		case MPI2_SASPHY3_EVENT_CODE_PEAK_CONNECT_TIME: return "PEAK_CONNECT_TIME";
-		case MPI2_SASPHY3_EVENT_CODE_TX_SSP_FRAMES: return "TX_SSP_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_RX_SSP_FRAMES: return "RX_SSP_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_TX_SSP_ERROR_FRAMES: return "TX_SSP_ERROR_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_RX_SSP_ERROR_FRAMES: return "RX_SSP_ERROR_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_TX_CREDIT_BLOCKED: return "TX_CREDIT_BLOCKED";
-		case MPI2_SASPHY3_EVENT_CODE_RX_CREDIT_BLOCKED: return "RX_CREDIT_BLOCKED";
-		case MPI2_SASPHY3_EVENT_CODE_TX_SATA_FRAMES: return "TX_SATA_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_RX_SATA_FRAMES: return "RX_SATA_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_SATA_OVERFLOW: return "SATA_OVERFLOW";
-		case MPI2_SASPHY3_EVENT_CODE_TX_SMP_FRAMES: return "TX_SMP_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_RX_SMP_FRAMES: return "RX_SMP_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_RX_SMP_ERROR_FRAMES: return "RX_SMP_ERROR_FRAMES";
-		case MPI2_SASPHY3_EVENT_CODE_HOTPLUG_TIMEOUT: return "HOTPLUG_TIMEOUT";
-		case MPI2_SASPHY3_EVENT_CODE_MISALIGNED_MUX_PRIMITIVE: return "MISALIGNED_MUX_PRIMITIVE";
-		case MPI2_SASPHY3_EVENT_CODE_RX_AIP: return "RX_AIP";
-	}
+#define MPI2_EVENT_PM_INIT_SHIFT 6
 
-	return "UNKNOWN";
-}
+static const char *const power_mode_init_names[] = {
+	[MPI2_EVENT_PM_INIT_UNAVAILABLE >> MPI2_EVENT_PM_INIT_SHIFT] = "INIT_UNAVAILABLE",
+	[MPI2_EVENT_PM_INIT_HOST >> MPI2_EVENT_PM_INIT_SHIFT] = "INIT_HOST",
+	[MPI2_EVENT_PM_INIT_IO_UNIT >> MPI2_EVENT_PM_INIT_SHIFT] = "INIT_IO_UNIT",
+	[MPI2_EVENT_PM_INIT_PCIE_DPA >> MPI2_EVENT_PM_INIT_SHIFT] = "INIT_PCIE_DPA",
+};
 
-static const char *counter_type_to_text(uint8_t type)
-{
-	switch (type) {
-		case MPI2_SASPHY3_COUNTER_TYPE_WRAPPING: return "WRAPPING";
-		case MPI2_SASPHY3_COUNTER_TYPE_SATURATING: return "SATURATING";
-		case MPI2_SASPHY3_COUNTER_TYPE_PEAK_VALUE: return "PEAK_VALUE";
-	}
+static const char *const power_mode_mode_names[] = {
+	[MPI2_EVENT_PM_MODE_UNAVAILABLE] = "MODE_UNAVAILABLE",
+	[MPI2_EVENT_PM_MODE_UNKNOWN] = "MODE_UNKNOWN",
+	[MPI2_EVENT_PM_MODE_FULL_POWER] = "MODE_FULL_POWER",
+	[MPI2_EVENT_PM_MODE_REDUCED_POWER] = "MODE_REDUCED_POWER",
+	[MPI2_EVENT_PM_MODE_STANDBY] = "MODE_STANDBY",
+};
 
-	return "UNKNOWN";
+static const char *power_mode_to_text(uint32_t val, char *buf, size_t size)
+{
+	size_t len;
+
+	len = text_append(buf, size, 0, name_lookup(power_mode_init_names, ARRAY_SIZE(power_mode_init_names),
+				(val & MPI2_EVENT_PM_INIT_MASK) >> MPI2_EVENT_PM_INIT_SHIFT, "INIT_UNKNOWN"));
+	len = text_append(buf, size, len, " ");
+	text_append(buf, size, len, name_lookup(power_mode_mode_names, ARRAY_SIZE(power_mode_mode_names),
+				val & MPI2_EVENT_PM_MODE_MASK, "MODE_UNKNOWN_FALLOUT"));
+	return buf;
 }
 
-static const char *time_units_to_text(uint8_t unit)
+static const char *event_names[] = {
+	[MPI2_EVENT_LOG_DATA] = "LOG_DATA",
+	[MPI2_EVENT_STATE_CHANGE] = "STATE_CHANGE",
+	[MPI2_EVENT_HARD_RESET_RECEIVED] = "HARD_RESET_RECEIVED",
+	[MPI2_EVENT_EVENT_CHANGE] = "EVENT_CHANGE",
+	[MPI2_EVENT_TASK_SET_FULL] = "TASK_SET_FULL",
+	[MPI2_EVENT_SAS_DEVICE_STATUS_CHANGE] = "SAS_DEVICE_STATUS_CHANGE",
+	[MPI2_EVENT_IR_OPERATION_STATUS] = "IR_OPERATION_STATUS",
+	[MPI2_EVENT_SAS_DISCOVERY] = "SAS_DISCOVERY",
+	[MPI2_EVENT_SAS_BROADCAST_PRIMITIVE] = "SAS_BROADCAST_PRIMITIVE",
+	[MPI2_EVENT_SAS_INIT_DEVICE_STATUS_CHANGE] = "SAS_INIT_DEVICE_STATUS_CHANGE",
+	[MPI2_EVENT_SAS_INIT_TABLE_OVERFLOW] = "SAS_INIT_TABLE_OVERFLOW",
+	[MPI2_EVENT_SAS_TOPOLOGY_CHANGE_LIST] = "SAS_TOPOLOGY_CHANGE_LIST",
+	[MPI2_EVENT_SAS_ENCL_DEVICE_STATUS_CHANGE] = "SAS_ENCL_DEVICE_STATUS_CHANGE",
+	[MPI2_EVENT_IR_VOLUME] = "IR_VOLUME",
+	[MPI2_EVENT_IR_PHYSICAL_DISK] = "IR_PHYSICAL_DISK",
+	[MPI2_EVENT_IR_CONFIGURATION_CHANGE_LIST] = "IR_CONFIGURATION_CHANGE_LIST",
+	[MPI2_EVENT_LOG_ENTRY_ADDED] = "LOG_ENTRY_ADDED",
+	[MPI2_EVENT_SAS_PHY_COUNTER] = "SAS_PHY_COUNTER",
+	[MPI2_EVENT_GPIO_INTERRUPT] = "GPIO_INTERRUPT",
+	[MPI2_EVENT_HOST_BASED_DISCOVERY_PHY] = "HOST_BASED_DISCOVERY_PHY",
+	[MPI2_EVENT_SAS_QUIESCE] = "SAS_QUIESCE",
+	[MPI2_EVENT_SAS_NOTIFY_PRIMITIVE] = "SAS_NOTIFY_PRIMITIVE",
+	[MPI2_EVENT_TEMP_THRESHOLD] = "TEMP_THRESHOLD",
+	[MPI2_EVENT_HOST_MESSAGE] = "HOST_MESSAGE",
+	[MPI2_EVENT_POWER_PERFORMANCE_CHANGE] = "POWER_PERFORMANCE_CHANGE",
+};
+
+const char *mpt_event_name(unsigned event)
 {
-	switch (unit) {
-		case MPI2_SASPHY3_TIME_UNITS_10_MICROSECONDS: return "10_MICROSECONDS";
-		case MPI2_SASPHY3_TIME_UNITS_100_MICROSECONDS: return "100_MICROSECONDS";
-		case MPI2_SASPHY3_TIME_UNITS_1_MILLISECOND: return "1_MILLISECOND";
-		case MPI2_SASPHY3_TIME_UNITS_10_MILLISECONDS: return "10_MILLISECONDS";
-	}
-
+	if (event < sizeof(event_names)/sizeof(event_names[0]) && event_names[event])
+		return event_names[event];
 	return "UNKNOWN";
 }
 
-static const char *threshold_flags_to_text(uint8_t flags)
+/* Accepts the event name as above in any case or its number */
+int mpt_event_lookup(const char *name)
 {
-	switch (flags) {
-		case MPI2_SASPHY3_TFLAGS_PHY_RESET: return "PHY_RESET";
-		case MPI2_SASPHY3_TFLAGS_EVENT_NOTIFY: return "EVENT_NOTIFY";
-		case MPI2_SASPHY3_TFLAGS_EVENT_NOTIFY|MPI2_SASPHY3_TFLAGS_PHY_RESET: return "PHY_RESET,EVENT_NOTIFY";
-	}
+	unsigned i;
+	char *end;
+	long num;
 
-	return "UNKNOWN";
-}
+	for (i = 0; i < sizeof(event_names)/sizeof(event_names[0]); i++) {
+		if (event_names[i] && strcasecmp(event_names[i], name) == 0)
+			return i;
+	}
 
-static void dump_sas_phy_counter(struct MPT2_IOCTL_EVENTS *event)
-{
-	MPI2_EVENT_DATA_SAS_PHY_COUNTER *evt = (void*)&event->data;
+	num = strtol(name, &end, 0);
+	if (*name && !*end && num >= 0 && num < MPT_EVENT_TYPES)
+		return num;
 
-	my_syslog(LOG_INFO, "SAS Phy Counter: context=%u timestamp=%"PRIu64" phy_event_code=%hhu(%s) phy_num=%hhu phy_event_info=%x counter_type=%hhu(%s) threshold_window=%hhu time_units=%hhu(%s) event_threshold=%u threshold_flags=%hx(%s) reserved1=%u reserved2=%hu reserved3=%hhu reserved4=%hu",
-			event->context,
-			evt->TimeStamp,
-			evt->PhyEventCode, phy_event_code_to_text(evt->PhyEventCode),
-			evt->PhyNum,
-			evt->PhyEventInfo,
-			evt->CounterType, counter_type_to_text(evt->CounterType),
-			evt->ThresholdWindow,
-			evt->TimeUnits, time_units_to_text(evt->TimeUnits),
-			evt->EventThreshold,
-			evt->ThresholdFlags, threshold_flags_to_text(evt->ThresholdFlags),
-			evt->Reserved1,
-			evt->Reserved2,
-			evt->Reserved3,
-			evt->Reserved4);
+	return -1;
 }
 
-static const char *power_mode_init_to_text(uint8_t val)
+/* Event descriptors, the fields are listed in the order they are output */
+
+#define FIELD_FLAGS(type, member, name, format, digits, flags, text) \
+	{ name, offsetof(type, member), sizeof(((type *)0)->member), format, digits, flags, text }
+#define FIELD(type, member, name, format, digits, text) FIELD_FLAGS(type, member, name, format, digits, 0, text)
+#define UINT(type, member, name) FIELD(type, member, name, MPT_FIELD_UINT, 0, NULL)
+#define HEX(type, member, name) FIELD(type, member, name, MPT_FIELD_HEX, 0, NULL)
+#define SAS(type, member, name) FIELD(type, member, name, MPT_FIELD_SAS, 0, NULL)
+#define HANDLE(type, member, name) FIELD_FLAGS(type, member, name, MPT_FIELD_HEX, 0, MPT_FIELD_HANDLE, NULL)
+#define REASON(type, member, name, format, text) FIELD_FLAGS(type, member, name, format, 0, MPT_FIELD_REASON, text)
+
+static const struct mpt_field sas_device_status_change_fields[] = {
+	FIELD(MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE, TaskTag, "tag", MPT_FIELD_HEX, 4, NULL),
+	REASON(MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE, ReasonCode, "rc", MPT_FIELD_UINT, reason_code_to_text),
+	UINT(MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE, PhysicalPort, "port"),
+	FIELD(MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE, ASC, "asc", MPT_FIELD_HEXUP, 2, NULL),
+	FIELD(MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE, ASCQ, "ascq", MPT_FIELD_HEXUP, 2, NULL),
+	FIELD_FLAGS(MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE, DevHandle, "handle", MPT_FIELD_HEX, 4, MPT_FIELD_HANDLE, NULL),
+	UINT(MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE, Reserved2, "reserved2"),
+	SAS(MPI2_EVENT_DATA_SAS_DEVICE_STATUS_CHANGE, SASAddress, "SASAddress"),
+};
+
+// LOG_DATA is reported with the layout of LOG_ENTRY_ADDED
+static const struct mpt_field log_data_fields[] = {
+	UINT(MPI2_EVENT_DATA_LOG_ENTRY_ADDED, TimeStamp, "timestamp"),
+	UINT(MPI2_EVENT_DATA_LOG_ENTRY_ADDED, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_LOG_ENTRY_ADDED, LogSequence, "seq"),
+	UINT(MPI2_EVENT_DATA_LOG_ENTRY_ADDED, LogEntryQualifier, "entry_qualifier"),
+	UINT(MPI2_EVENT_DATA_LOG_ENTRY_ADDED, VP_ID, "vp_id"),
+	UINT(MPI2_EVENT_DATA_LOG_ENTRY_ADDED, VF_ID, "vf_id"),
+	UINT(MPI2_EVENT_DATA_LOG_ENTRY_ADDED, Reserved2, "reserved2"),
+	{ "log_data", offsetof(MPI2_EVENT_DATA_LOG_ENTRY_ADDED, LogData), MPI2_EVENT_DATA_LOG_DATA_LENGTH,
+	  MPT_FIELD_BYTES, 0, MPT_FIELD_QUOTE, NULL },
+};
+
+static const struct mpt_field gpio_interrupt_fields[] = {
+	UINT(MPI2_EVENT_DATA_GPIO_INTERRUPT, GPIONum, "gpionum"),
+	UINT(MPI2_EVENT_DATA_GPIO_INTERRUPT, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_GPIO_INTERRUPT, Reserved2, "reserved2"),
+};
+
+// Events we don't decode, the whole payload
+static const struct mpt_field name_only_fields[] = {
+	{ "buf", 0, MPT2_EVENT_DATA_SIZE, MPT_FIELD_BYTES, 0, 0, NULL },
+};
+
+static const struct mpt_field temperature_threshold_fields[] = {
+	FIELD(MPI2_EVENT_DATA_TEMPERATURE, Status, "status", MPT_FIELD_HEX, 4, NULL),
+	UINT(MPI2_EVENT_DATA_TEMPERATURE, SensorNum, "sensornum"),
+	UINT(MPI2_EVENT_DATA_TEMPERATURE, CurrentTemperature, "current_temp"),
+	UINT(MPI2_EVENT_DATA_TEMPERATURE, Reserved1, "reversed1"),
+	UINT(MPI2_EVENT_DATA_TEMPERATURE, Reserved2, "reserved2"),
+	UINT(MPI2_EVENT_DATA_TEMPERATURE, Reserved3, "reserved3"),
+	UINT(MPI2_EVENT_DATA_TEMPERATURE, Reserved4, "reserved4"),
+};
+
+static const struct mpt_field hard_reset_received_fields[] = {
+	UINT(MPI2_EVENT_DATA_HARD_RESET_RECEIVED, Port, "port"),
+	UINT(MPI2_EVENT_DATA_HARD_RESET_RECEIVED, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_HARD_RESET_RECEIVED, Reserved2, "reserved2"),
+};
+
+static const struct mpt_field task_set_full_fields[] = {
+	HANDLE(MPI2_EVENT_DATA_TASK_SET_FULL, DevHandle, "dev_handle"),
+	UINT(MPI2_EVENT_DATA_TASK_SET_FULL, CurrentDepth, "current_depth"),
+};
+
+static const struct mpt_field ir_operation_status_fields[] = {
+	HANDLE(MPI2_EVENT_DATA_IR_OPERATION_STATUS, VolDevHandle, "vol_dev_handle"),
+	FIELD(MPI2_EVENT_DATA_IR_OPERATION_STATUS, RAIDOperation, "raid_op", MPT_FIELD_UINT, 0, raid_op_to_text),
+	UINT(MPI2_EVENT_DATA_IR_OPERATION_STATUS, PercentComplete, "percent"),
+	UINT(MPI2_EVENT_DATA_IR_OPERATION_STATUS, ElapsedSeconds, "elapsed_sec"),
+	UINT(MPI2_EVENT_DATA_IR_OPERATION_STATUS, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_IR_OPERATION_STATUS, Reserved2, "reserved2"),
+};
+
+static const struct mpt_field ir_volume_fields[] = {
+	HANDLE(MPI2_EVENT_DATA_IR_VOLUME, VolDevHandle, "vol_dev_handle"),
+	REASON(MPI2_EVENT_DATA_IR_VOLUME, ReasonCode, "reason", MPT_FIELD_UINT, ir_volume_code_to_text),
+	UINT(MPI2_EVENT_DATA_IR_VOLUME, NewValue, "new_value"),
+	UINT(MPI2_EVENT_DATA_IR_VOLUME, PreviousValue, "prev_value"),
+	UINT(MPI2_EVENT_DATA_IR_VOLUME, Reserved1, "reserved1"),
+};
+
+static const struct mpt_field ir_physical_disk_fields[] = {
+	REASON(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, ReasonCode, "reason", MPT_FIELD_UINT, ir_physical_disk_rc_to_text),
+	UINT(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, PhysDiskNum, "phys_disk_num"),
+	HANDLE(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, PhysDiskDevHandle, "phys_disk_dev_handle"),
+	UINT(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, Slot, "slot"),
+	UINT(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, EnclosureHandle, "enclosure_handle"),
+	UINT(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, NewValue, "new_value"),
+	UINT(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, PreviousValue, "prev_value"),
+	UINT(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_IR_PHYSICAL_DISK, Reserved2, "reserved2"),
+};
+
+static const struct mpt_field ir_config_change_list_fields[] = {
+	UINT(MPI2_EVENT_DATA_IR_CONFIG_CHANGE_LIST, NumElements, "num_elements"),
+	UINT(MPI2_EVENT_DATA_IR_CONFIG_CHANGE_LIST, ConfigNum, "config_num"),
+	HEX(MPI2_EVENT_DATA_IR_CONFIG_CHANGE_LIST, Flags, "flags"),
+	UINT(MPI2_EVENT_DATA_IR_CONFIG_CHANGE_LIST, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_IR_CONFIG_CHANGE_LIST, Reserved2, "reserved2"),
+};
+
+static const struct mpt_field ir_config_element_fields[] = {
+	FIELD(MPI2_EVENT_IR_CONFIG_ELEMENT, ElementFlags, "flags", MPT_FIELD_HEX, 0, ir_config_element_flag_to_text),
+	HANDLE(MPI2_EVENT_IR_CONFIG_ELEMENT, VolDevHandle, "vol_dev_handle"),
+	REASON(MPI2_EVENT_IR_CONFIG_ELEMENT, ReasonCode, "reason", MPT_FIELD_UINT, ir_config_element_reason_to_text),
+	UINT(MPI2_EVENT_IR_CONFIG_ELEMENT, PhysDiskNum, "phys_disk_num"),
+	HANDLE(MPI2_EVENT_IR_CONFIG_ELEMENT, PhysDiskDevHandle, "phys_disk_dev_handle"),
+};
+
+static const struct mpt_list_desc ir_config_element_list = {
+	"IR Config Change List Element",
+	offsetof(MPI2_EVENT_DATA_IR_CONFIG_CHANGE_LIST, NumElements),
+	offsetof(MPI2_EVENT_DATA_IR_CONFIG_CHANGE_LIST, ConfigElement),
+	sizeof(MPI2_EVENT_IR_CONFIG_ELEMENT),
+	ir_config_element_fields, ARRAY_SIZE(ir_config_element_fields),
+	"elements",
+};
+
+static const struct mpt_field sas_discovery_fields[] = {
+	FIELD(MPI2_EVENT_DATA_SAS_DISCOVERY, Flags, "flags", MPT_FIELD_HEX, 2, sas_discovery_flags_to_text),
+	REASON(MPI2_EVENT_DATA_SAS_DISCOVERY, ReasonCode, "reason", MPT_FIELD_HEX, sas_discovery_reason_to_text),
+	HEX(MPI2_EVENT_DATA_SAS_DISCOVERY, PhysicalPort, "physical_port"),
+	FIELD(MPI2_EVENT_DATA_SAS_DISCOVERY, DiscoveryStatus, "discovery_status", MPT_FIELD_HEX, 0, sas_discovery_status_to_text),
+	HEX(MPI2_EVENT_DATA_SAS_DISCOVERY, Reserved1, "reserved1"),
+};
+
+static const struct mpt_field sas_broadcast_primitive_fields[] = {
+	UINT(MPI2_EVENT_DATA_SAS_BROADCAST_PRIMITIVE, PhyNum, "phy_num"),
+	UINT(MPI2_EVENT_DATA_SAS_BROADCAST_PRIMITIVE, Port, "port"),
+	UINT(MPI2_EVENT_DATA_SAS_BROADCAST_PRIMITIVE, PortWidth, "port_width"),
+	FIELD(MPI2_EVENT_DATA_SAS_BROADCAST_PRIMITIVE, Primitive, "primitive", MPT_FIELD_UINT, 0, sas_broadcast_primitive_to_text),
+};
+
+static const struct mpt_field sas_notify_primitive_fields[] = {
+	UINT(MPI2_EVENT_DATA_SAS_NOTIFY_PRIMITIVE, PhyNum, "phy_num"),
+	UINT(MPI2_EVENT_DATA_SAS_NOTIFY_PRIMITIVE, Port, "port"),
+	FIELD(MPI2_EVENT_DATA_SAS_NOTIFY_PRIMITIVE, Primitive, "primitive", MPT_FIELD_UINT, 0, sas_notify_primitive_to_text),
+	HEX(MPI2_EVENT_DATA_SAS_NOTIFY_PRIMITIVE, Reserved1, "reserved1"),
+};
+
+static const struct mpt_field sas_init_dev_status_change_fields[] = {
+	REASON(MPI2_EVENT_DATA_SAS_INIT_DEV_STATUS_CHANGE, ReasonCode, "reason", MPT_FIELD_INT, sas_init_dev_status_reason_to_text),
+	UINT(MPI2_EVENT_DATA_SAS_INIT_DEV_STATUS_CHANGE, PhysicalPort, "phys_port"),
+	FIELD_FLAGS(MPI2_EVENT_DATA_SAS_INIT_DEV_STATUS_CHANGE, DevHandle, "dev_handle", MPT_FIELD_UINT, 0, MPT_FIELD_HANDLE, NULL),
+	SAS(MPI2_EVENT_DATA_SAS_INIT_DEV_STATUS_CHANGE, SASAddress, "sas_address"),
+};
+
+static const struct mpt_field sas_init_table_overflow_fields[] = {
+	UINT(MPI2_EVENT_DATA_SAS_INIT_TABLE_OVERFLOW, MaxInit, "max_init"),
+	UINT(MPI2_EVENT_DATA_SAS_INIT_TABLE_OVERFLOW, CurrentInit, "current_init"),
+	SAS(MPI2_EVENT_DATA_SAS_INIT_TABLE_OVERFLOW, SASAddress, "sas_address"),
+};
+
+static const struct mpt_field sas_topology_change_list_fields[] = {
+	HEX(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, EnclosureHandle, "enclosure_handle"),
+	HANDLE(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, ExpanderDevHandle, "expander_dev_handle"),
+	UINT(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, NumPhys, "num_phys"),
+	UINT(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, NumEntries, "num_entries"),
+	UINT(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, StartPhyNum, "start_phy_num"),
+	FIELD(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, ExpStatus, "exp_status", MPT_FIELD_UINT, 0, sas_topology_change_list_status_to_text),
+	UINT(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, PhysicalPort, "physical_port"),
+	UINT(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, Reserved2, "reserved2"),
+};
+
+static const struct mpt_field sas_topo_phy_entry_fields[] = {
+	HANDLE(MPI2_EVENT_SAS_TOPO_PHY_ENTRY, AttachedDevHandle, "attached_dev_handle"),
+	FIELD(MPI2_EVENT_SAS_TOPO_PHY_ENTRY, LinkRate, "link_rate", MPT_FIELD_HEX, 0, sas_topo_link_rates_to_text),
+	FIELD(MPI2_EVENT_SAS_TOPO_PHY_ENTRY, PhyStatus, "phy_status", MPT_FIELD_UINT, 0, sas_topo_phy_status_to_text),
+};
+
+static const struct mpt_list_desc sas_topo_phy_entry_list = {
+	"SAS Topology Change List Entry",
+	offsetof(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, NumEntries),
+	offsetof(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, PHY),
+	sizeof(MPI2_EVENT_SAS_TOPO_PHY_ENTRY),
+	sas_topo_phy_entry_fields, ARRAY_SIZE(sas_topo_phy_entry_fields),
+	"phys",
+};
+
+static const struct mpt_field sas_enclosure_device_status_change_fields[] = {
+	HEX(MPI2_EVENT_DATA_SAS_ENCL_DEV_STATUS_CHANGE, EnclosureHandle, "enclosure_handle"),
+	REASON(MPI2_EVENT_DATA_SAS_ENCL_DEV_STATUS_CHANGE, ReasonCode, "reason", MPT_FIELD_UINT, sas_enclosure_dev_status_change_reason_to_text),
+	HEX(MPI2_EVENT_DATA_SAS_ENCL_DEV_STATUS_CHANGE, EnclosureLogicalID, "enclosure_logical_id"),
+	UINT(MPI2_EVENT_DATA_SAS_ENCL_DEV_STATUS_CHANGE, NumSlots, "num_slots"),
+	UINT(MPI2_EVENT_DATA_SAS_ENCL_DEV_STATUS_CHANGE, StartSlot, "start_slot"),
+	HEX(MPI2_EVENT_DATA_SAS_ENCL_DEV_STATUS_CHANGE, PhyBits, "phy_bits"),
+};
+
+static const struct mpt_field sas_quiesce_fields[] = {
+	REASON(MPI2_EVENT_DATA_SAS_QUIESCE, ReasonCode, "reason", MPT_FIELD_UINT, sas_quiesce_reason_to_text),
+	UINT(MPI2_EVENT_DATA_SAS_QUIESCE, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_SAS_QUIESCE, Reserved2, "reserved2"),
+	UINT(MPI2_EVENT_DATA_SAS_QUIESCE, Reserved3, "reserved3"),
+};
+
+static const struct mpt_field sas_phy_counter_fields[] = {
+	UINT(MPI2_EVENT_DATA_SAS_PHY_COUNTER, TimeStamp, "timestamp"),
+	FIELD(MPI2_EVENT_DATA_SAS_PHY_COUNTER, PhyEventCode, "phy_event_code", MPT_FIELD_UINT, 0, phy_event_code_to_text),
+	UINT(MPI2_EVENT_DATA_SAS_PHY_COUNTER, PhyNum, "phy_num"),
+	HEX(MPI2_EVENT_DATA_SAS_PHY_COUNTER, PhyEventInfo, "phy_event_info"),
+	FIELD(MPI2_EVENT_DATA_SAS_PHY_COUNTER, CounterType, "counter_type", MPT_FIELD_UINT, 0, counter_type_to_text),
+	UINT(MPI2_EVENT_DATA_SAS_PHY_COUNTER, ThresholdWindow, "threshold_window"),
+	FIELD(MPI2_EVENT_DATA_SAS_PHY_COUNTER, TimeUnits, "time_units", MPT_FIELD_UINT, 0, time_units_to_text),
+	UINT(MPI2_EVENT_DATA_SAS_PHY_COUNTER, EventThreshold, "event_threshold"),
+	FIELD(MPI2_EVENT_DATA_SAS_PHY_COUNTER, ThresholdFlags, "threshold_flags", MPT_FIELD_HEX, 0, threshold_flags_to_text),
+	UINT(MPI2_EVENT_DATA_SAS_PHY_COUNTER, Reserved1, "reserved1"),
+	UINT(MPI2_EVENT_DATA_SAS_PHY_COUNTER, Reserved2, "reserved2"),
+	UINT(MPI2_EVENT_DATA_SAS_PHY_COUNTER, Reserved3, "reserved3"),
+	UINT(MPI2_EVENT_DATA_SAS_PHY_COUNTER, Reserved4, "reserved4"),
+};
+
+static const struct mpt_field power_performance_change_fields[] = {
+	FIELD(MPI2_EVENT_DATA_POWER_PERF_CHANGE, CurrentPowerMode, "current_power_mode", MPT_FIELD_HEXUP, 2, power_mode_to_text),
+	FIELD(MPI2_EVENT_DATA_POWER_PERF_CHANGE, PreviousPowerMode, "prev_power_mode", MPT_FIELD_HEXUP, 2, power_mode_to_text),
+	FIELD(MPI2_EVENT_DATA_POWER_PERF_CHANGE, Reserved1, "reserved1", MPT_FIELD_HEXUP, 4, NULL),
+};
+
+#define EVENT(name, header, fields, list) { name, header, fields, ARRAY_SIZE(fields), list }
+#define NAME_ONLY(name) EVENT(name, MPT_HDR_EVENT, name_only_fields, NULL)
+
+static const struct mpt_event_desc unknown_event_desc = NAME_ONLY("Unknown Event");
+
+static const struct mpt_event_desc event_descs[MPT_EVENT_TYPES] = {
+	[MPI2_EVENT_SAS_DEVICE_STATUS_CHANGE] = EVENT("SAS Device Status Change", MPT_HDR_IOC, sas_device_status_change_fields, NULL),
+	[MPI2_EVENT_LOG_DATA] = EVENT("Log Entry Added", 0, log_data_fields, NULL),
+	[MPI2_EVENT_GPIO_INTERRUPT] = EVENT("GPIO Interrupt", 0, gpio_interrupt_fields, NULL),
+	[MPI2_EVENT_STATE_CHANGE] = NAME_ONLY("State Change"),
+	[MPI2_EVENT_HARD_RESET_RECEIVED] = EVENT("Hard Reset Received", 0, hard_reset_received_fields, NULL),
+	[MPI2_EVENT_EVENT_CHANGE] = NAME_ONLY("Event Change"),
+	[MPI2_EVENT_TASK_SET_FULL] = EVENT("Task Set Full", 0, task_set_full_fields, NULL),
+	[MPI2_EVENT_IR_OPERATION_STATUS] = EVENT("IR Operation Status", 0, ir_operation_status_fields, NULL),
+	[MPI2_EVENT_SAS_DISCOVERY] = EVENT("SAS Discovery", 0, sas_discovery_fields, NULL),
+	[MPI2_EVENT_SAS_BROADCAST_PRIMITIVE] = EVENT("SAS Broadcast Primitive", 0, sas_broadcast_primitive_fields, NULL),
+	[MPI2_EVENT_SAS_INIT_DEVICE_STATUS_CHANGE] = EVENT("SAS Init Dev Status Change", 0, sas_init_dev_status_change_fields, NULL),
+	[MPI2_EVENT_SAS_INIT_TABLE_OVERFLOW] = EVENT("SAS Init Table Overflow", 0, sas_init_table_overflow_fields, NULL),
+	[MPI2_EVENT_SAS_TOPOLOGY_CHANGE_LIST] = EVENT("SAS Topology Change List", 0, sas_topology_change_list_fields, &sas_topo_phy_entry_list),
+	[MPI2_EVENT_SAS_ENCL_DEVICE_STATUS_CHANGE] = EVENT("SAS Enclosure Device Status Change", 0, sas_enclosure_device_status_change_fields, NULL),
+	[MPI2_EVENT_IR_VOLUME] = EVENT("IR Volume", 0, ir_volume_fields, NULL),
+	[MPI2_EVENT_IR_PHYSICAL_DISK] = EVENT("IR Physical Disk", 0, ir_physical_disk_fields, NULL),
+	[MPI2_EVENT_IR_CONFIGURATION_CHANGE_LIST] = EVENT("IR Config Change List", 0, ir_config_change_list_fields, &ir_config_element_list),
+	[MPI2_EVENT_LOG_ENTRY_ADDED] = NAME_ONLY("Log Entry Added"),
+	[MPI2_EVENT_SAS_PHY_COUNTER] = EVENT("SAS Phy Counter", 0, sas_phy_counter_fields, NULL),
+	[MPI2_EVENT_HOST_BASED_DISCOVERY_PHY] = NAME_ONLY("Host Based Discovery Phy"),
+	[MPI2_EVENT_SAS_QUIESCE] = EVENT("SAS Quiesce", 0, sas_quiesce_fields, NULL),
+	[MPI2_EVENT_SAS_NOTIFY_PRIMITIVE] = EVENT("SAS Notify Primitive", 0, sas_notify_primitive_fields, NULL),
+	[MPI2_EVENT_TEMP_THRESHOLD] = EVENT("Temperature Threshold", 0, temperature_threshold_fields, NULL),
+	[MPI2_EVENT_HOST_MESSAGE] = NAME_ONLY("Host Message"),
+	[MPI2_EVENT_POWER_PERFORMANCE_CHANGE] = EVENT("Power Performance Change", 0, power_performance_change_fields, NULL),
+};
+
+_Static_assert((MPT2_EVENT_DATA_SIZE - offsetof(MPI2_EVENT_DATA_SAS_TOPOLOGY_CHANGE_LIST, PHY)) /
+               sizeof(MPI2_EVENT_SAS_TOPO_PHY_ENTRY) <= MPT_MAX_ENTRIES, "topology entries don't fit a record");
+
+/* What is reported about the event log itself, as records */
+
+struct lost_data {
+	uint32_t count;
+};
+
+struct repeated_data {
+	uint32_t count;
+	uint32_t span_ms;
+	uint32_t last_context;
+};
+
+static const struct mpt_field lost_fields[] = {
+	UINT(struct lost_data, count, "count"),
+};
+
+static const struct mpt_field repeated_fields[] = {
+	UINT(struct repeated_data, count, "count"),
+	UINT(struct repeated_data, span_ms, "span_ms"),
+	UINT(struct repeated_data, last_context, "last_context"),
+};
+
+static const struct mpt_event_desc lost_desc = EVENT("Lost Events", MPT_HDR_IOC, lost_fields, NULL);
+static const struct mpt_event_desc reset_desc = { "Event Context Reset", MPT_HDR_IOC, NULL, 0, NULL };
+static const struct mpt_event_desc repeated_desc = EVENT("Repeated Events", MPT_HDR_IOC|MPT_HDR_EVENT, repeated_fields, NULL);
+
+static uint64_t field_value(const uint8_t *data, const struct mpt_field *field)
 {
-	val &= MPI2_EVENT_PM_INIT_MASK;
-
-	switch (val) {
-		case MPI2_EVENT_PM_INIT_UNAVAILABLE: return "INIT_UNAVAILABLE";
-		case MPI2_EVENT_PM_INIT_HOST: return "INIT_HOST";
-		case MPI2_EVENT_PM_INIT_IO_UNIT: return "INIT_IO_UNIT";
-		case MPI2_EVENT_PM_INIT_PCIE_DPA: return "INIT_PCIE_DPA";
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (field->size) {
+		case 1:
+			if (field->format == MPT_FIELD_INT)
+				return (int64_t)(int8_t)data[field->offset];
+			return data[field->offset];
+		case 2:
+			memcpy(&v16, data + field->offset, sizeof(v16));
+			if (field->format == MPT_FIELD_INT)
+				return (int64_t)(int16_t)v16;
+			return v16;
+		case 4:
+			memcpy(&v32, data + field->offset, sizeof(v32));
+			if (field->format == MPT_FIELD_INT)
+				return (int64_t)(int32_t)v32;
+			return v32;
+		case 8:
+			memcpy(&v64, data + field->offset, sizeof(v64));
+			return v64;
 	}
 
-	return "INIT_UNKNOWN";
+	return 0;
 }
 
-static const char *power_mode_mode_to_text(uint8_t val)
+static void decode_fields(const uint8_t *data, const struct mpt_field *fields, int fields_nr, uint64_t *values)
 {
-	val &= MPI2_EVENT_PM_MODE_MASK;
+	int i;
 
-	switch (val) {
-		case MPI2_EVENT_PM_MODE_UNAVAILABLE: return "MODE_UNAVAILABLE";
-		case MPI2_EVENT_PM_MODE_UNKNOWN: return "MODE_UNKNOWN";
-		case MPI2_EVENT_PM_MODE_FULL_POWER: return "MODE_FULL_POWER";
-		case MPI2_EVENT_PM_MODE_REDUCED_POWER: return "MODE_REDUCED_POWER";
-		case MPI2_EVENT_PM_MODE_STANDBY: return "MODE_STANDBY";
+	for (i = 0; i < fields_nr; i++) {
+		if (fields[i].format != MPT_FIELD_BYTES)
+			values[i] = field_value(data, &fields[i]);
 	}
-
-	return "MODE_UNKNOWN_FALLOUT";
 }
 
-static void dump_power_performance_change(struct MPT2_IOCTL_EVENTS *event)
+void mpt_decode(const struct MPT2_IOCTL_EVENTS *event, int ioc, struct mpt_record *rec)
 {
-	MPI2_EVENT_DATA_POWER_PERF_CHANGE *evt = (void*)&event->data;
-
-	my_syslog(LOG_INFO, "Power Performance Change: context=%u current_power_mode=%02X(%s %s) prev_power_mode=%02X(%s %s) reserved1=%04X",
-			event->context,
-			evt->CurrentPowerMode, power_mode_init_to_text(evt->CurrentPowerMode), power_mode_mode_to_text(evt->CurrentPowerMode),
-			evt->PreviousPowerMode, power_mode_init_to_text(evt->PreviousPowerMode), power_mode_mode_to_text(evt->PreviousPowerMode),
-			evt->Reserved1);
+	const struct mpt_event_desc *desc = NULL;
+	const struct mpt_list_desc *list;
+	unsigned fit;
+	unsigned i;
+
+	if (event->event < MPT_EVENT_TYPES)
+		desc = &event_descs[event->event];
+	if (!desc || !desc->name)
+		desc = &unknown_event_desc;
+
+	rec->kind = MPT_RECORD_EVENT;
+	rec->desc = desc;
+	rec->ioc = ioc;
+	rec->event = event->event;
+	rec->context = event->context;
+	rec->time_us = 0;
+	rec->data = event->data;
+	rec->entries_total = 0;
+	rec->entries_nr = 0;
+
+	decode_fields(event->data, desc->fields, desc->fields_nr, rec->value);
+
+	list = desc->list;
+	if (!list)
+		return;
+
+	// Never trust the count to stay within the payload
+	rec->entries_total = event->data[list->count_offset];
+	fit = (sizeof(event->data) - list->offset) / list->entry_size;
+	rec->entries_nr = rec->entries_total < fit ? rec->entries_total : fit;
+
+	for (i = 0; i < rec->entries_nr; i++)
+		decode_fields(event->data + list->offset + i * list->entry_size,
+		              list->fields, list->fields_nr, rec->entry[i]);
 }
 
-static void dump_event(struct MPT2_IOCTL_EVENTS *event, int ioc)
+static void text_field(struct mpt_line *line, const struct mpt_field *field, const uint8_t *data, uint64_t value)
 {
-	switch (event->event) {
-		case MPI2_EVENT_SAS_DEVICE_STATUS_CHANGE:
-			dump_sas_device_status_change(event, ioc);
-			break;
+	line_str(line, field->name);
+	line_char(line, '=');
 
-		case MPI2_EVENT_LOG_DATA:
-			dump_log_data(event);
+	switch (field->format) {
+		case MPT_FIELD_UINT:
+			line_u64(line, value);
 			break;
-
-		case MPI2_EVENT_GPIO_INTERRUPT:
-			dump_gpio_interrupt(event);
+		case MPT_FIELD_INT:
+			line_i64(line, value);
 			break;
-
-		case MPI2_EVENT_STATE_CHANGE:
-			dump_name_only("State Change", event);
+		case MPT_FIELD_HEX:
+			line_hex(line, value, field->digits);
 			break;
-
-		case MPI2_EVENT_HARD_RESET_RECEIVED:
-			dump_hard_reset_received(event);
+		case MPT_FIELD_HEXUP:
+			line_hexup(line, value, field->digits);
 			break;
-
-		case MPI2_EVENT_EVENT_CHANGE:
-			dump_name_only("Event Change", event);
+		case MPT_FIELD_SAS:
+			line_sas(line, value);
 			break;
-
-		case MPI2_EVENT_TASK_SET_FULL:
-			dump_task_set_full(event);
+		case MPT_FIELD_BYTES:
+			if (field->flags & MPT_FIELD_QUOTE)
+				line_char(line, '\'');
+			if (line_room(line) >= MPT_ENCODE_SIZE(field->size)) {
+				// Straight into the line
+				line->len += mpt_encode(mpt_payload_encoding, data + field->offset, field->size,
+				                        line->buf + line->len);
+			} else {
+				char text[MPT_ENCODE_SIZE(MPT2_EVENT_DATA_SIZE)];
+
+				line_mem(line, text, mpt_encode(mpt_payload_encoding, data + field->offset, field->size, text));
+			}
+			if (field->flags & MPT_FIELD_QUOTE)
+				line_char(line, '\'');
 			break;
+	}
 
-		case MPI2_EVENT_IR_OPERATION_STATUS:
-			dump_ir_operation_status(event);
-			break;
+	if (field->text) {
+		char text[MPT_TEXT_SIZE];
 
-		case MPI2_EVENT_SAS_DISCOVERY:
-			dump_sas_discovery(event);
-			break;
+		line_char(line, '(');
+		line_str(line, field->text(value, text, sizeof(text)));
+		line_char(line, ')');
+	}
+}
 
-		case MPI2_EVENT_SAS_BROADCAST_PRIMITIVE:
-			dump_sas_broadcast_primitive(event);
-			break;
+int mpt_one_line_lists;
 
-		case MPI2_EVENT_SAS_INIT_DEVICE_STATUS_CHANGE:
-			dump_sas_init_dev_status_change(event);
-			break;
+static void text_head(const struct mpt_record *rec, struct mpt_line *line)
+{
+	const struct mpt_event_desc *desc = rec->desc;
+	unsigned i;
+
+	line_str(line, desc->name);
+	line_lit(line, ": ");
+	if (desc->header & MPT_HDR_IOC) {
+		line_lit(line, "ioc=");
+		line_i64(line, rec->ioc);
+		line_char(line, ' ');
+	}
+	if (desc->header & MPT_HDR_EVENT) {
+		line_lit(line, "event=");
+		line_u64(line, rec->event);
+		line_char(line, ' ');
+	}
+	line_lit(line, "context=");
+	line_u64(line, rec->context);
 
-		case MPI2_EVENT_SAS_INIT_TABLE_OVERFLOW:
-			dump_sas_init_table_overflow(event);
-			break;
+	for (i = 0; i < desc->fields_nr; i++) {
+		line_char(line, ' ');
+		text_field(line, &desc->fields[i], rec->data, rec->value[i]);
+	}
+}
 
-		case MPI2_EVENT_SAS_TOPOLOGY_CHANGE_LIST:
-			dump_sas_topology_change_list(event);
-			break;
+// The number of the entry and its fields
+static void text_entry(const struct mpt_record *rec, unsigned i, struct mpt_line *line, const char *sep)
+{
+	const struct mpt_list_desc *list = rec->desc->list;
+	const uint8_t *entry = rec->data + list->offset + i * list->entry_size;
+	unsigned j;
+
+	line_u64(line, i + 1);
+	line_char(line, '/');
+	line_u64(line, rec->entries_total);
+	line_str(line, sep);
+	for (j = 0; j < list->fields_nr; j++) {
+		line_char(line, ' ');
+		text_field(line, &list->fields[j], entry, rec->entry[i][j]);
+	}
+}
 
-		case MPI2_EVENT_SAS_ENCL_DEVICE_STATUS_CHANGE:
-			dump_sas_enclosure_device_status_change(event);
-			break;
+void mpt_record_line(const struct mpt_record *rec, struct mpt_line *line)
+{
+	unsigned i;
 
-		case MPI2_EVENT_IR_VOLUME:
-			dump_ir_volume(event);
-			break;
+	text_head(rec, line);
+	for (i = 0; rec->desc->list && i < rec->entries_nr; i++) {
+		line_lit(line, " [");
+		text_entry(rec, i, line, ":");
+		line_char(line, ']');
+	}
+}
 
-		case MPI2_EVENT_IR_PHYSICAL_DISK:
-			dump_ir_physical_disk(event);
-			break;
+void mpt_record_text(const struct mpt_record *rec)
+{
+	const struct mpt_list_desc *list = rec->desc->list;
+	struct mpt_line line;
+	unsigned i;
+
+	line_reset(&line);
+	if (!list || mpt_one_line_lists) {
+		mpt_record_line(rec, &line);
+		my_syslog_line(LOG_INFO, line.buf, line.len);
+		return;
+	}
 
-		case MPI2_EVENT_IR_CONFIGURATION_CHANGE_LIST:
-			dump_ir_config_change_list(event);
-			break;
+	text_head(rec, &line);
+	my_syslog_line(LOG_INFO, line.buf, line.len);
 
-		case MPI2_EVENT_LOG_ENTRY_ADDED:
-			dump_name_only("Log Entry Added", event);
-			break;
+	for (i = 0; i < rec->entries_nr; i++) {
+		line_reset(&line);
+		line_str(&line, list->name);
+		line_lit(&line, " (");
+		text_entry(rec, i, &line, "):");
+		my_syslog_line(LOG_INFO, line.buf, line.len);
+	}
+}
 
-		case MPI2_EVENT_SAS_PHY_COUNTER:
-			dump_sas_phy_counter(event);
-			break;
+int (*mpt_record_log)(const struct mpt_record *rec, int priority);
 
-		case MPI2_EVENT_HOST_BASED_DISCOVERY_PHY:
-			dump_name_only("Host Based Discovery Phy", event);
-			break;
+void (*mpt_record_hook)(const struct mpt_record *rec);
 
-		case MPI2_EVENT_SAS_QUIESCE:
-			dump_sas_quiesce(event);
-			break;
+void dump_event(struct MPT2_IOCTL_EVENTS *event, int ioc, uint64_t time_us)
+{
+	struct mpt_record rec;
+
+	mpt_decode(event, ioc, &rec);
+	rec.time_us = time_us;
+	if (!mpt_record_log || mpt_record_log(&rec, LOG_INFO))
+		mpt_record_text(&rec);
+	if (mpt_record_hook)
+		mpt_record_hook(&rec);
+}
 
-		case MPI2_EVENT_SAS_NOTIFY_PRIMITIVE:
-			dump_sas_notify_primitive(event);
-			break;
+/* The reports about the event log itself have their own text lines, they are
+ * records for everything else. Returns 0 if the text line is still needed.
+ */
+static int log_record(uint8_t kind, const struct mpt_event_desc *desc, int ioc, unsigned event,
+                      uint32_t context, const void *data, uint64_t time_us, int priority)
+{
+	struct mpt_record rec;
+	int text;
+
+	if (!mpt_record_hook && !mpt_record_log)
+		return 0;
+
+	rec.kind = kind;
+	rec.desc = desc;
+	rec.ioc = ioc;
+	rec.event = event;
+	rec.context = context;
+	rec.time_us = time_us;
+	rec.data = data;
+	rec.entries_total = 0;
+	rec.entries_nr = 0;
+	decode_fields(data, desc->fields, desc->fields_nr, rec.value);
+
+	text = !mpt_record_log || mpt_record_log(&rec, priority);
+	if (mpt_record_hook)
+		mpt_record_hook(&rec);
+
+	return !text;
+}
 
-		case MPI2_EVENT_TEMP_THRESHOLD:
-			dump_temperature_threshold(event);
-			break;
+void dump_reset(int ioc, uint32_t context, uint64_t time_us)
+{
+	struct mpt_line line;
 
-		case MPI2_EVENT_HOST_MESSAGE:
-			dump_name_only("Host Message", event);
-			break;
+	if (log_record(MPT_RECORD_RESET, &reset_desc, ioc, 0, context, NULL, time_us, LOG_WARNING))
+		return;
 
-		case MPI2_EVENT_POWER_PERFORMANCE_CHANGE:
-			dump_power_performance_change(event);
-			break;
+	line_reset(&line);
+	line_lit(&line, "Event Context Reset: ioc=");
+	line_i64(&line, ioc);
+	line_lit(&line, " context=");
+	line_u64(&line, context);
+	my_syslog_line(LOG_WARNING, line.buf, line.len);
+}
 
-		default:
-			dump_name_only("Unknown Event", event);
-			break;
-	}
+void dump_lost(int ioc, uint32_t count, uint32_t before_context, uint64_t time_us)
+{
+	struct lost_data data = { count };
+	struct mpt_line line;
+
+	if (log_record(MPT_RECORD_LOST, &lost_desc, ioc, 0, before_context, &data, time_us, LOG_WARNING))
+		return;
+
+	line_reset(&line);
+	line_lit(&line, "Lost Events: ioc=");
+	line_i64(&line, ioc);
+	line_lit(&line, " count=");
+	line_u64(&line, count);
+	line_lit(&line, " before_context=");
+	line_u64(&line, before_context);
+	my_syslog_line(LOG_WARNING, line.buf, line.len);
+}
+
+void dump_repeated(int ioc, unsigned event, uint32_t first_context, uint32_t last_context,
+                   uint32_t count, uint32_t span_ms, uint64_t time_us)
+{
+	struct repeated_data data = { count, span_ms, last_context };
+	struct mpt_line line;
+
+	if (log_record(MPT_RECORD_REPEATED, &repeated_desc, ioc, event, first_context, &data, time_us, LOG_INFO))
+		return;
+
+	line_reset(&line);
+	line_lit(&line, "Repeated Events: ioc=");
+	line_i64(&line, ioc);
+	line_lit(&line, " event=");
+	line_str(&line, mpt_event_name(event));
+	line_lit(&line, " like_context=");
+	line_u64(&line, first_context);
+	line_lit(&line, " x");
+	line_u64(&line, count);
+	line_lit(&line, " over ");
+	line_u64(&line, span_ms);
+	line_lit(&line, " ms last_context=");
+	line_u64(&line, last_context);
+	my_syslog_line(LOG_INFO, line.buf, line.len);
 }
 
-void dump_all_events(struct mpt_events *events, uint32_t *highest_context, int first_read)
+void dump_window(struct mpt_events *events, const struct mpt_window *window)
 {
 	int i;
-	uint32_t new_context = *highest_context;
 
-	for (i = 0; i < MPT2SAS_CTL_EVENT_LOG_SIZE; i++) {
-		struct MPT2_IOCTL_EVENTS *event = &events->event_data[i];
+	if (window->count == 0)
+		return;
 
-		if (!event->event)
-			continue;
+	if (window->reset)
+		dump_reset(events->hdr.ioc_number, events->event_data[window->slot[window->count-1]].context, 0);
+
+	for (i = 0; i < window->count; i++) {
+		struct MPT2_IOCTL_EVENTS *event = &events->event_data[window->slot[i]];
 
-		/* Because we read the entire circular buffer we can get the highest
-		 * context before the older contexts that we didn't read yet. As such
-		 * we need to compare the context to the old context we had and only
-		 * replace it once we finished the read
-		 */
-		if (first_read || (int)(event->context - *highest_context) > 0) {
-			dump_event(event, events->hdr.ioc_number);
-			new_context = event->context;
-		}
+		if (window->gap[i])
+			dump_lost(events->hdr.ioc_number, window->gap[i], event->context, 0);
+		dump_event(event, events->hdr.ioc_number, 0);
 	}
+}
+
+int dump_all_events(struct mpt_events *events, struct mpt_cursor *cursor)
+{
+	struct mpt_window window;
 
-	*highest_context = new_context;
+	mpt_cursor_window(cursor, events, &window);
+	dump_window(events, &window);
+	return window.count;
 }
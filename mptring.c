@@ -0,0 +1,34 @@
+#include <errno.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <syslog.h>
+
+#include "mpt.h"
+#include "mptring.h"
+
+int mpt_ring_init(struct mpt_ring *ring, uint32_t size)
+{
+	memset(ring, 0, sizeof(*ring));
+
+	if (size == 0 || (size & (size - 1))) {
+		my_syslog(LOG_ERR, "Ring size %u is not a power of two", size);
+		return -1;
+	}
+
+	ring->slots = calloc(size, sizeof(*ring->slots));
+	if (!ring->slots) {
+		my_syslog(LOG_ERR, "Error allocating event ring: %d (%m)", errno);
+		return -1;
+	}
+	ring->size = size;
+	ring->mask = size - 1;
+
+	return 0;
+}
+
+void mpt_ring_free(struct mpt_ring *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+	ring->size = 0;
+}
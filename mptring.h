@@ -0,0 +1,98 @@
+#ifndef MPTEVENTS_MPTRING_H
+#define MPTEVENTS_MPTRING_H
+
+#include "mpt.h"
+
+#define MPT_CACHELINE 64
+
+enum mpt_raw_kind {
+	MPT_RAW_EVENT,
+	MPT_RAW_LOST,  // count events were lost before event.context
+	MPT_RAW_RESET, // The driver restarted its numbering, event.context is the newest one
+};
+
+/* An event as the reader got it from the driver, decoding is left to the
+ * consumer so the reader can go straight back to the driver.
+ */
+struct mpt_raw_event {
+	uint8_t kind;
+	int ioc;
+	struct mpt_state_record *state; // Of the ioc, its cursor is saved once this is out
+	uint32_t count;
+	uint64_t time_us; // CLOCK_REALTIME when it was read
+	struct MPT2_IOCTL_EVENTS event;
+};
+
+/* Single producer, single consumer. Each side owns its index and only reads
+ * the other one, keeping a cached copy of it so it rarely has to touch the
+ * other side's cache line.
+ */
+struct mpt_ring {
+	struct mpt_raw_event *slots;
+	uint32_t size; // Power of two
+	uint32_t mask;
+
+	// Producer side
+	uint32_t head __attribute__((aligned(MPT_CACHELINE)));
+	uint32_t tail_cache;
+	uint32_t max_used;
+	uint64_t pushed;
+	uint64_t overflows;
+
+	// Consumer side
+	uint32_t tail __attribute__((aligned(MPT_CACHELINE)));
+	uint32_t head_cache;
+};
+
+int mpt_ring_init(struct mpt_ring *ring, uint32_t size);
+void mpt_ring_free(struct mpt_ring *ring);
+
+static inline uint32_t mpt_ring_used(struct mpt_ring *ring)
+{
+	return __atomic_load_n(&ring->head, __ATOMIC_RELAXED) - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+}
+
+/* Producer: get the next free slot or NULL if the ring is full, the slot is
+ * only handed to the consumer by mpt_ring_commit().
+ */
+static inline struct mpt_raw_event *mpt_ring_reserve(struct mpt_ring *ring)
+{
+	if (ring->head - ring->tail_cache == ring->size) {
+		ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (ring->head - ring->tail_cache == ring->size) {
+			ring->overflows++;
+			return NULL;
+		}
+	}
+
+	return &ring->slots[ring->head & ring->mask];
+}
+
+static inline void mpt_ring_commit(struct mpt_ring *ring)
+{
+	uint32_t used = ring->head + 1 - ring->tail_cache;
+
+	if (used > ring->max_used)
+		ring->max_used = used;
+	ring->pushed++;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Consumer: look at the oldest slot without taking it, NULL when empty */
+static inline struct mpt_raw_event *mpt_ring_peek(struct mpt_ring *ring)
+{
+	if (ring->tail == ring->head_cache) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (ring->tail == ring->head_cache)
+			return NULL;
+	}
+
+	return &ring->slots[ring->tail & ring->mask];
+}
+
+static inline void mpt_ring_pop(struct mpt_ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+#endif
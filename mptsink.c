@@ -0,0 +1,659 @@
+#define _GNU_SOURCE // fallocate
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "mpt.h"
+#include "mptline.h"
+#include "mptsink.h"
+
+/* The queue of a fd sink is written with a single writev() however it wraps.
+ *
+ * A file that rotates has its segment preallocated with fallocate(), so the
+ * appends don't leave it in fragments. The size stays that of what was
+ * written, and what is left past the end is given back on rotation. A
+ * segment is rotated before a line would take it past its size, or at the
+ * first line once it got too old, to PATH.1 with the older ones moving up
+ * to PATH.keep.
+ *
+ * A grow sink that falls behind has its queue moved to one twice as big, up
+ * to MPT_SINK_GROW_MAX times its size, and back to its size once it is all
+ * written.
+ *
+ * Only the output thread logs records, nothing here is locked.
+ */
+
+#define RETRY_MS 1000
+#define QUEUE_MIN_KB 64
+#define QUEUE_MAX_KB (1024 * 1024)
+#define FLUSH_MAX_MS 60000
+#define SEG_MAX_MB (64 * 1024)
+#define SEG_MAX_AGE_S (31 * 24 * 3600)
+#define SEG_MAX_KEEP 100
+#define NOTICE_ROOM 64     // Kept free for the notice of a sink that hangs up
+#define HANGUP_MS 5000     // Time it gets to take the notice
+
+static struct mpt_sink *sinks;
+static struct mpt_loop *sink_loop;
+static unsigned text_sinks;
+static unsigned json_sinks;
+
+static uint64_t sink_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void mpt_sink_add(struct mpt_sink *sink)
+{
+	struct mpt_sink **p;
+
+	// They get the lines in the order they were added
+	for (p = &sinks; *p; p = &(*p)->next)
+		;
+	sink->next = NULL;
+	*p = sink;
+
+	if (sink->record)
+		return;
+	if (sink->format == MPT_FORMAT_JSON)
+		json_sinks++;
+	else
+		text_sinks++;
+}
+
+void mpt_sink_del(struct mpt_sink *sink)
+{
+	struct mpt_sink **p;
+
+	for (p = &sinks; *p && *p != sink; p = &(*p)->next)
+		;
+	if (!*p)
+		return;
+	*p = sink->next;
+
+	if (!sink->record) {
+		if (sink->format == MPT_FORMAT_JSON)
+			json_sinks--;
+		else
+			text_sinks--;
+	}
+
+	free(sink->queue);
+	sink->queue = NULL;
+}
+
+void mpt_sink_set_format(struct mpt_sink *sink, int format)
+{
+	if (sink->format == format || sink->record)
+		return;
+
+	if (format == MPT_FORMAT_JSON) {
+		json_sinks++;
+		text_sinks--;
+	} else {
+		json_sinks--;
+		text_sinks++;
+	}
+	sink->format = format;
+}
+
+int mpt_sink_add_fd(struct mpt_sink *sink, int fd)
+{
+	sink->queue = malloc(sink->queue_size);
+	if (!sink->queue) {
+		my_syslog(LOG_ERR, "Error allocating the queue of %s", sink->name);
+		return -1;
+	}
+	sink->queue_cap = sink->queue_size;
+
+	sink->fd = fd;
+	mpt_sink_add(sink);
+	return 0;
+}
+
+static int parse_opt(struct mpt_sink *sink, const char *opt, size_t len)
+{
+	char buf[32];
+	char *end;
+	long n;
+	int format;
+
+	if (len >= sizeof(buf))
+		return -1;
+	memcpy(buf, opt, len);
+	buf[len] = 0;
+
+	format = mpt_format_lookup(buf);
+	if (format >= 0) {
+		sink->format = format;
+	} else if (strcmp(buf, "drop") == 0) {
+		sink->policy = MPT_SINK_DROP;
+	} else if (strcmp(buf, "grow") == 0) {
+		sink->policy = MPT_SINK_GROW;
+	} else if (strncmp(buf, "queue=", 6) == 0) {
+		n = strtol(buf + 6, &end, 10);
+		if (end == buf + 6 || *end || n < QUEUE_MIN_KB || n > QUEUE_MAX_KB)
+			return -1;
+		sink->queue_size = n * 1024;
+	} else if (strncmp(buf, "flush=", 6) == 0) {
+		n = strtol(buf + 6, &end, 10);
+		if (end == buf + 6 || *end || n < 0 || n > FLUSH_MAX_MS)
+			return -1;
+		sink->flush_ms = n;
+	} else if (strncmp(buf, "size=", 5) == 0) {
+		n = strtol(buf + 5, &end, 10);
+		if (end == buf + 5 || *end || n < 1 || n > SEG_MAX_MB)
+			return -1;
+		sink->seg_size = (uint64_t)n * 1024 * 1024;
+	} else if (strncmp(buf, "age=", 4) == 0) {
+		n = strtol(buf + 4, &end, 10);
+		if (end == buf + 4 || *end || n < 1 || n > SEG_MAX_AGE_S)
+			return -1;
+		sink->seg_age_s = n;
+	} else if (strncmp(buf, "keep=", 5) == 0) {
+		n = strtol(buf + 5, &end, 10);
+		if (end == buf + 5 || *end || n < 0 || n > SEG_MAX_KEEP)
+			return -1;
+		sink->seg_keep = n;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+int mpt_sink_file(struct mpt_sink *sink, const char *spec)
+{
+	const char *colon = strchr(spec, ':');
+	const char *opt = spec;
+
+	memset(sink, 0, sizeof(*sink));
+	sink->format = MPT_FORMAT_TEXT;
+	sink->policy = MPT_SINK_DROP;
+	sink->flush_ms = MPT_SINK_FLUSH_BATCH;
+	sink->queue_size = MPT_SINK_QUEUE;
+	sink->seg_keep = MPT_SINK_KEEP;
+	sink->fd = -1;
+	sink->poll.fd = -1;
+	sink->path = spec;
+	sink->name = spec;
+
+	// The options are before the first colon, unless it is part of the path
+	if (!colon || memchr(spec, '/', colon - spec))
+		return 0;
+
+	while (opt < colon) {
+		const char *comma = memchr(opt, ',', colon - opt);
+		const char *end = comma ? comma : colon;
+
+		if (parse_opt(sink, opt, end - opt) < 0)
+			return -1;
+		opt = end + 1;
+	}
+
+	sink->path = colon + 1;
+	sink->name = colon + 1;
+	return *sink->path ? 0 : -1;
+}
+
+static int open_fd(struct mpt_sink *sink);
+static void close_segment(struct mpt_sink *sink);
+
+static void queue_put(struct mpt_sink *sink, const char *data, size_t len)
+{
+	size_t tail = (sink->head + sink->queued) % sink->queue_cap;
+	size_t first = sink->queue_cap - tail;
+
+	if (first > len)
+		first = len;
+	memcpy(sink->queue + tail, data, first);
+	memcpy(sink->queue, data + first, len - first);
+	sink->queued += len;
+}
+
+// Writes as much of the queue as the fd takes
+static void write_queue(struct mpt_sink *sink)
+{
+	int wrote = 0;
+
+	if (sink->waiting)
+		return;
+	if (sink->fd < 0 && (!sink->path || open_fd(sink) < 0))
+		return;
+
+	while (sink->queued) {
+		struct iovec iov[2];
+		size_t first = sink->queue_cap - sink->head;
+		int iovcnt = 1;
+		ssize_t ret;
+
+		iov[0].iov_base = sink->queue + sink->head;
+		iov[0].iov_len = sink->queued;
+		if (first < sink->queued) {
+			iov[0].iov_len = first;
+			iov[1].iov_base = sink->queue;
+			iov[1].iov_len = sink->queued - first;
+			iovcnt = 2;
+		}
+
+		ret = writev(sink->fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				sink->waiting = 1;
+				return;
+			}
+
+			// The reader went away or the disk is full, blocking on it gets nowhere
+			if (sink->policy == MPT_SINK_HANGUP)
+				sink->closing = 1; // It left, nothing to tell
+			else if (!sink->failing)
+				my_syslog(LOG_ERR, "Error writing to %s: %d (%m)", sink->name, errno);
+			sink->failing = 1;
+			sink->stats.dropped += sink->queued_lines;
+			sink->head = 0;
+			sink->queued = 0;
+			sink->queued_lines = 0;
+
+			// A fifo gets a new reader on a new fd, open it again for the next lines
+			if (sink->path)
+				close_segment(sink);
+			return;
+		}
+
+		sink->stats.writes++;
+		sink->stats.bytes += ret;
+		sink->seg_bytes += ret;
+		sink->head = (sink->head + ret) % sink->queue_cap;
+		sink->queued -= ret;
+		wrote = 1;
+	}
+
+	if (wrote && sink->failing) {
+		my_syslog(LOG_INFO, "Writing to %s again", sink->name);
+		sink->failing = 0;
+	}
+
+	// All written, start from the front to wrap less
+	sink->head = 0;
+	sink->queued_lines = 0;
+
+	if (sink->queue_cap > sink->queue_size) {
+		char *queue = realloc(sink->queue, sink->queue_size);
+
+		if (queue) {
+			sink->queue = queue;
+			sink->queue_cap = sink->queue_size;
+		}
+	}
+}
+
+// Moves the queue of a grow sink that is behind to a bigger one
+static int grow_queue(struct mpt_sink *sink, size_t need)
+{
+	size_t max = sink->queue_size * MPT_SINK_GROW_MAX;
+	size_t cap = sink->queue_cap;
+	size_t first = cap - sink->head;
+	char *queue;
+
+	if (need > max)
+		return -1;
+	while (cap < need)
+		cap *= 2;
+	if (cap > max)
+		cap = max;
+
+	queue = malloc(cap);
+	if (!queue)
+		return -1;
+
+	if (first > sink->queued)
+		first = sink->queued;
+	memcpy(queue, sink->queue + sink->head, first);
+	memcpy(queue + first, sink->queue, sink->queued - first);
+	free(sink->queue);
+	sink->queue = queue;
+	sink->queue_cap = cap;
+	sink->head = 0;
+	sink->stats.grown++;
+
+	return 0;
+}
+
+static void segment_name(char *name, size_t size, const char *path, unsigned i)
+{
+	if (i)
+		snprintf(name, size, "%s.%u", path, i);
+	else
+		snprintf(name, size, "%s", path);
+}
+
+static void close_fd(struct mpt_sink *sink)
+{
+	if (sink->poll.fd >= 0)
+		mpt_loop_del(sink_loop, &sink->poll);
+	sink->poll.fd = -1;
+	close(sink->fd);
+	sink->fd = -1;
+	sink->waiting = 0;
+}
+
+// Gives back the preallocated room past what was written
+static void close_segment(struct mpt_sink *sink)
+{
+	if (sink->seg_size && ftruncate(sink->fd, sink->seg_bytes) < 0)
+		my_syslog(LOG_ERR, "Error trimming %s: %d (%m)", sink->path, errno);
+	close_fd(sink);
+}
+
+static void rotate(struct mpt_sink *sink)
+{
+	char from[PATH_MAX];
+	char to[PATH_MAX];
+	unsigned i;
+
+	close_segment(sink);
+
+	for (i = sink->seg_keep; i > 0; i--) {
+		segment_name(from, sizeof(from), sink->path, i - 1);
+		segment_name(to, sizeof(to), sink->path, i);
+		if (rename(from, to) < 0 && errno != ENOENT)
+			my_syslog(LOG_ERR, "Error renaming %s to %s: %d (%m)", from, to, errno);
+	}
+	if (sink->seg_keep == 0 && unlink(sink->path) < 0 && errno != ENOENT)
+		my_syslog(LOG_ERR, "Error removing %s: %d (%m)", sink->path, errno);
+
+	sink->stats.rotations++;
+	open_fd(sink);
+}
+
+static int segment_due(struct mpt_sink *sink, size_t len)
+{
+	if (sink->fd < 0 || sink->seg_bytes == 0)
+		return 0;
+	if (sink->seg_size && sink->seg_bytes + sink->queued + len > sink->seg_size)
+		return 1;
+	// Only looked at for the first line of a batch, that is often enough
+	return sink->seg_age_s && sink->queued == 0 &&
+	       sink_now_ms() - sink->seg_ms >= (uint64_t)sink->seg_age_s * 1000;
+}
+
+// What the reader of a sink that hangs up is told last
+static void queue_notice(struct mpt_sink *sink)
+{
+	static const char text[] = "Queue overflow, disconnecting\n";
+	static const char json[] = "{\"kind\":\"overflow\"}\n";
+
+	if (sink->format == MPT_FORMAT_JSON)
+		queue_put(sink, json, sizeof(json) - 1);
+	else
+		queue_put(sink, text, sizeof(text) - 1);
+	sink->closing = 1;
+	sink->closing_ms = sink_now_ms();
+	write_queue(sink);
+}
+
+static void queue_line(struct mpt_sink *sink, const char *line, size_t len)
+{
+	size_t keep = 0; // Free at the end of the queue
+
+	if (sink->closing) {
+		sink->stats.dropped++;
+		return;
+	}
+
+	if ((sink->seg_size || sink->seg_age_s) && segment_due(sink, len + 1)) {
+		write_queue(sink);
+		if (sink->queued == 0)
+			rotate(sink);
+	}
+
+	if (sink->policy == MPT_SINK_HANGUP)
+		keep = NOTICE_ROOM;
+	if (sink->queued + len + 1 + keep > sink->queue_cap)
+		write_queue(sink);
+	if (sink->queued + len + 1 > sink->queue_cap && sink->policy == MPT_SINK_GROW)
+		grow_queue(sink, sink->queued + len + 1);
+	if (sink->queued + len + 1 + keep > sink->queue_cap) {
+		sink->stats.dropped++;
+		if (sink->policy == MPT_SINK_HANGUP)
+			queue_notice(sink);
+		return;
+	}
+
+	if (sink->queued_lines++ == 0 && sink->flush_ms > 0)
+		sink->queued_ms = sink_now_ms();
+	queue_put(sink, line, len);
+	queue_put(sink, "\n", 1);
+	sink->stats.lines++;
+
+	if (sink->flush_ms == 0)
+		write_queue(sink);
+}
+
+static void sink_line(struct mpt_sink *sink, int priority, const char *line, size_t len)
+{
+	if (sink->line)
+		sink->line(priority, line, len);
+	else if (sink->queue)
+		queue_line(sink, line, len);
+}
+
+void mpt_sink_line(int priority, const char *line, size_t len)
+{
+	struct mpt_sink *sink;
+
+	for (sink = sinks; sink; sink = sink->next) {
+		if (!sink->record && sink->format == MPT_FORMAT_TEXT && (!sink->match || sink->matched))
+			sink_line(sink, priority, line, len);
+	}
+}
+
+/* The JSON line is built once whatever number of sinks take it, and only if
+ * any does. Returns whether the text lines are wanted as well.
+ */
+int mpt_sink_record(const struct mpt_record *rec, int priority)
+{
+	static struct mpt_line json; // Only ever written from the one output thread
+	struct mpt_sink *sink;
+	int built = 0;
+
+	for (sink = sinks; sink; sink = sink->next) {
+		if (sink->match) {
+			sink->matched = sink->match(sink, rec);
+			if (!sink->matched)
+				continue;
+		}
+
+		if (sink->record) {
+			sink->record(rec, priority);
+		} else if (sink->format == MPT_FORMAT_JSON) {
+			if (!built) {
+				line_reset(&json);
+				mpt_record_json_line(rec, &json);
+				built = 1;
+			}
+			sink_line(sink, priority, json.buf, json.len);
+		}
+	}
+
+	return text_sinks != 0;
+}
+
+void mpt_sink_write(struct mpt_sink *sink)
+{
+	sink->waiting = 0;
+	write_queue(sink);
+}
+
+static void handle_sink_poll(struct mpt_poll *poll, uint32_t events)
+{
+	// A reader that hung up shows as an error on the next write
+	mpt_sink_write(container_of(poll, struct mpt_sink, poll));
+}
+
+static int open_fd(struct mpt_sink *sink)
+{
+	struct stat st;
+
+	sink->fd = open(sink->path, O_WRONLY|O_CREAT|O_APPEND|O_NONBLOCK|O_CLOEXEC, 0640);
+	if (sink->fd < 0) {
+		if (!sink->failing)
+			my_syslog(LOG_ERR, "Error opening %s: %d (%m)", sink->path, errno);
+		sink->failing = 1;
+		return -1;
+	}
+
+	if (fstat(sink->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		// Only files rotate
+		sink->seg_size = 0;
+		sink->seg_age_s = 0;
+
+		// Unlike a regular file it can fill up, EPOLLOUT tells when it takes more
+		sink->poll.fd = sink->fd;
+		sink->poll.handler = handle_sink_poll;
+		if (mpt_loop_add(sink_loop, &sink->poll, EPOLLOUT|EPOLLET) < 0) {
+			sink->poll.fd = -1;
+			close_fd(sink);
+			return -1;
+		}
+		return 0;
+	}
+
+	sink->seg_bytes = st.st_size;
+	sink->seg_ms = sink_now_ms();
+	if (sink->seg_size > sink->seg_bytes &&
+	    fallocate(sink->fd, FALLOC_FL_KEEP_SIZE, sink->seg_bytes, sink->seg_size - sink->seg_bytes) < 0 &&
+	    errno != EOPNOTSUPP)
+		my_syslog(LOG_ERR, "Error preallocating %s: %d (%m)", sink->path, errno);
+
+	return 0;
+}
+
+static int open_sink(struct mpt_sink *sink)
+{
+	sink->queue = malloc(sink->queue_size);
+	if (!sink->queue) {
+		my_syslog(LOG_ERR, "Error allocating the queue of %s", sink->name);
+		return -1;
+	}
+	sink->queue_cap = sink->queue_size;
+
+	// It was logged, write_queue() opens it again for the lines to come
+	open_fd(sink);
+	return 0;
+}
+
+int mpt_sink_start(struct mpt_loop *loop)
+{
+	struct mpt_sink *sink;
+
+	sink_loop = loop;
+	for (sink = sinks; sink; sink = sink->next) {
+		if (sink->path && open_sink(sink) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+void mpt_sink_close(void)
+{
+	struct mpt_sink *sink;
+
+	for (sink = sinks; sink; sink = sink->next) {
+		if (!sink->queue)
+			continue;
+
+		sink->waiting = 0;
+		write_queue(sink);
+		sink->stats.dropped += sink->queued_lines;
+		sink->head = 0;
+		sink->queued = 0;
+		sink->queued_lines = 0;
+
+		if (sink->fd >= 0)
+			close_segment(sink);
+		free(sink->queue);
+		sink->queue = NULL;
+	}
+}
+
+int mpt_sink_flush(void)
+{
+	struct mpt_sink *sink, *next;
+	uint64_t now = 0;
+	int next_ms = -1;
+
+	for (sink = sinks; sink; sink = next) {
+		int wait = -1;
+
+		// It may hang up and be gone
+		next = sink->next;
+
+		if (sink->flush) {
+			if (sink->flush() > 0)
+				wait = RETRY_MS;
+		} else if (sink->queued) {
+			if (sink->flush_ms > 0 && !sink->closing) {
+				uint64_t due = sink->queued_ms + sink->flush_ms;
+
+				if (!now)
+					now = sink_now_ms();
+				if (now < due)
+					wait = due - now;
+				else
+					write_queue(sink);
+			} else {
+				write_queue(sink);
+			}
+
+			// Once the fd takes more, EPOLLOUT says so
+			if (wait < 0 && sink->queued && !sink->waiting)
+				wait = RETRY_MS;
+		}
+
+		if (sink->closing && sink->hangup) {
+			if (!now)
+				now = sink_now_ms();
+			if (sink->queued == 0 || now >= sink->closing_ms + HANGUP_MS) {
+				sink->hangup(sink);
+				continue;
+			}
+			wait = sink->closing_ms + HANGUP_MS - now;
+		}
+
+		if (wait >= 0 && (next_ms < 0 || wait < next_ms))
+			next_ms = wait;
+	}
+
+	return next_ms;
+}
+
+void mpt_sink_log_stats(void)
+{
+	struct mpt_sink *sink;
+
+	for (sink = sinks; sink; sink = sink->next) {
+		if (!sink->queue || !sink->path)
+			continue;
+
+		my_syslog(LOG_INFO, "Sink stats: sink=%s lines=%"PRIu64" bytes=%"PRIu64" writes=%"PRIu64" dropped=%"PRIu64" grown=%"PRIu64" queued=%zu rotations=%"PRIu64,
+				sink->name, sink->stats.lines, sink->stats.bytes, sink->stats.writes,
+				sink->stats.dropped, sink->stats.grown, sink->queued, sink->stats.rotations);
+	}
+}
@@ -0,0 +1,117 @@
+#ifndef MPTEVENTS_MPTSINK_H
+#define MPTEVENTS_MPTSINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mptdecode.h"
+#include "mptloop.h"
+
+/* The output thread logs each record to every sink registered here. A record
+ * is formatted once for each format that some sink takes, and each sink gets
+ * the lines of its format.
+ *
+ * A sink either hands the lines to a writer that keeps its own queue (syslog,
+ * stdout) or takes the whole records (journal). Otherwise it writes them to
+ * its fd from a bounded queue of its own, and when the queue is full it
+ * either drops the lines or, with the grow policy, lets the queue grow up to
+ * MPT_SINK_GROW_MAX times its size before it drops. Either way the other
+ * sinks keep getting their lines.
+ */
+
+enum mpt_sink_policy {
+	MPT_SINK_DROP,
+	MPT_SINK_GROW,   // Grow the queue up to MPT_SINK_GROW_MAX times its size, then drop
+	MPT_SINK_HANGUP, // Queue a notice of the loss and hang up once it is written
+};
+
+#define MPT_SINK_QUEUE (1024 * 1024) // Default queue size of a fd sink
+#define MPT_SINK_FLUSH_BATCH -1      // Write at the end of each wakeup
+#define MPT_SINK_KEEP 4              // Default number of rotated segments kept
+#define MPT_SINK_GROW_MAX 16         // A grow sink's queue grows up to this many times its size
+
+struct mpt_sink_stats {
+	uint64_t lines;
+	uint64_t bytes;
+	uint64_t writes;
+	uint64_t dropped;
+	uint64_t grown; // Times a grow sink's queue had to grow
+	uint64_t rotations;
+};
+
+struct mpt_sink {
+	const char *name;
+	int format; // MPT_FORMAT_*, of the lines it takes
+
+	// A sink with a writer of its own
+	void (*line)(int priority, const char *line, size_t len);
+	int (*record)(const struct mpt_record *rec, int priority);
+	int (*flush)(void); // Returns the lines it still holds back
+
+	// Only the records it matches, and the lines that come with them
+	int (*match)(struct mpt_sink *sink, const struct mpt_record *rec);
+	int matched;
+
+	// Or a fd sink, opened from path by mpt_sink_start() when there is one
+	const char *path;
+	int fd;
+	enum mpt_sink_policy policy;
+	int flush_ms;       // Lines wait up to this long, MPT_SINK_FLUSH_BATCH or 0 for at once
+	size_t queue_size;
+	size_t queue_cap;   // Allocated, more than queue_size while a grow sink is behind
+	char *queue;        // Wraps around, the lines start at head
+	size_t head;
+	size_t queued;
+	unsigned queued_lines;
+	uint64_t queued_ms; // When the oldest of them was queued
+	int waiting;        // The fd is full, EPOLLOUT tells when it takes more
+	int failing;        // The last write failed, don't log every one
+	int closing;        // Hang up once the queue is written
+	uint64_t closing_ms;
+	void (*hangup)(struct mpt_sink *sink); // Drops a sink that is closing
+	struct mpt_poll poll;
+
+	// A regular file is rotated to PATH.1 to PATH.keep once it is too big or old
+	uint64_t seg_size;  // Preallocated when set
+	unsigned seg_age_s;
+	unsigned seg_keep;
+	uint64_t seg_bytes; // Written to the current one
+	uint64_t seg_ms;    // When it was started
+
+	struct mpt_sink_stats stats;
+	struct mpt_sink *next;
+};
+
+void mpt_sink_add(struct mpt_sink *sink);
+void mpt_sink_del(struct mpt_sink *sink);
+void mpt_sink_set_format(struct mpt_sink *sink, int format);
+
+/* A fd sink for an fd polled by someone else, who calls mpt_sink_write() once
+ * it is writable again. mpt_sink_del() gives back the queue.
+ */
+int mpt_sink_add_fd(struct mpt_sink *sink, int fd);
+void mpt_sink_write(struct mpt_sink *sink);
+
+/* Sets up a fd sink from [OPTS:]PATH, OPTS being a comma separated list of
+ * text or json, drop or grow, queue=KB, flush=MS, and to rotate a file
+ * size=MB, age=S and keep=N. The file is appended to.
+ */
+int mpt_sink_file(struct mpt_sink *sink, const char *spec);
+
+// Starts polling the fd sinks that may fill up
+int mpt_sink_start(struct mpt_loop *loop);
+void mpt_sink_close(void);
+
+// Where my_syslog_line and mpt_record_log go
+void mpt_sink_line(int priority, const char *line, size_t len);
+int mpt_sink_record(const struct mpt_record *rec, int priority);
+
+/* Writes out what is due, returns how many ms until it should be called again
+ * or -1 if there is nothing left waiting.
+ */
+int mpt_sink_flush(void);
+
+// Only from the output thread, like the rest
+void mpt_sink_log_stats(void);
+
+#endif
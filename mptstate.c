@@ -0,0 +1,210 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <memory.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mpt.h"
+
+/* The cursors are kept in a small file mapped into memory so that a
+ * restarted daemon continues exactly where the previous one stopped. Each
+ * record holds two copies of the cursor, an update always goes to the older
+ * copy and is sealed by a checksum, so dying half way through a write leaves
+ * the other copy intact.
+ */
+
+#define MPT_STATE_MAGIC "MPTSTAT1"
+#define MPT_STATE_VERSION 1
+#define MPT_STATE_RECORDS 64
+
+struct mpt_state_copy {
+	uint32_t seq;
+	uint32_t last_context;
+	uint32_t last_event;
+	uint32_t last_hash;
+	uint32_t check;
+};
+
+struct mpt_state_record {
+	uint32_t in_use;
+	uint32_t type;
+	int32_t ioc_id;
+	uint32_t reserved;
+	struct mpt_state_copy copy[2];
+};
+
+struct mpt_state_file {
+	char magic[8];
+	uint32_t version;
+	uint32_t records_nr;
+	struct mpt_state_record records[MPT_STATE_RECORDS];
+};
+
+static struct mpt_state_file *state;
+static int state_fd = -1;
+
+static uint32_t copy_check(const struct mpt_state_copy *copy)
+{
+	return mpt_hash32(copy, offsetof(struct mpt_state_copy, check));
+}
+
+static const struct mpt_state_copy *latest_copy(const struct mpt_state_record *rec)
+{
+	const struct mpt_state_copy *best = NULL;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		const struct mpt_state_copy *copy = &rec->copy[i];
+
+		if (copy->seq == 0 || copy->check != copy_check(copy))
+			continue;
+		if (!best || (int32_t)(copy->seq - best->seq) > 0)
+			best = copy;
+	}
+
+	return best;
+}
+
+int mpt_state_open(const char *path)
+{
+	struct stat st;
+	void *map;
+
+	state_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	if (state_fd < 0) {
+		my_syslog(LOG_WARNING, "Cannot open state file %s, events may be replayed on restart: %d (%m)", path, errno);
+		return -1;
+	}
+
+	if (flock(state_fd, LOCK_EX|LOCK_NB) < 0) {
+		my_syslog(LOG_WARNING, "State file %s is used by another mptevents, not keeping state", path);
+		goto Error;
+	}
+
+	if (fstat(state_fd, &st) < 0 || (st.st_size < (off_t)sizeof(*state) && ftruncate(state_fd, sizeof(*state)) < 0)) {
+		my_syslog(LOG_WARNING, "Cannot size state file %s: %d (%m)", path, errno);
+		goto Error;
+	}
+
+	map = mmap(NULL, sizeof(*state), PROT_READ|PROT_WRITE, MAP_SHARED, state_fd, 0);
+	if (map == MAP_FAILED) {
+		my_syslog(LOG_WARNING, "Cannot map state file %s: %d (%m)", path, errno);
+		goto Error;
+	}
+	state = map;
+
+	if (memcmp(state->magic, MPT_STATE_MAGIC, sizeof(state->magic)) != 0 ||
+	    state->version != MPT_STATE_VERSION ||
+	    state->records_nr != MPT_STATE_RECORDS) {
+		if (st.st_size > 0)
+			my_syslog(LOG_WARNING, "State file %s is not usable, starting over", path);
+		memset(state, 0, sizeof(*state));
+		state->version = MPT_STATE_VERSION;
+		state->records_nr = MPT_STATE_RECORDS;
+		memcpy(state->magic, MPT_STATE_MAGIC, sizeof(state->magic));
+	}
+
+	return 0;
+
+Error:
+	close(state_fd);
+	state_fd = -1;
+	return -1;
+}
+
+void mpt_state_close(void)
+{
+	if (state) {
+		msync(state, sizeof(*state), MS_SYNC);
+		munmap(state, sizeof(*state));
+	}
+	state = NULL;
+
+	if (state_fd >= 0)
+		close(state_fd);
+	state_fd = -1;
+}
+
+struct mpt_state_record *mpt_state_get(int type, int ioc_id)
+{
+	struct mpt_state_record *free_rec = NULL;
+	int i;
+
+	if (!state)
+		return NULL;
+
+	for (i = 0; i < MPT_STATE_RECORDS; i++) {
+		struct mpt_state_record *rec = &state->records[i];
+
+		if (!rec->in_use) {
+			if (!free_rec)
+				free_rec = rec;
+			continue;
+		}
+		if (rec->type == (uint32_t)type && rec->ioc_id == ioc_id)
+			return rec;
+	}
+
+	if (!free_rec) {
+		my_syslog(LOG_WARNING, "State file is full, not keeping state for ioc %d", ioc_id);
+		return NULL;
+	}
+
+	memset(free_rec, 0, sizeof(*free_rec));
+	free_rec->type = type;
+	free_rec->ioc_id = ioc_id;
+	__atomic_store_n(&free_rec->in_use, 1, __ATOMIC_RELEASE);
+	return free_rec;
+}
+
+/* Returns 1 if the cursor was restored from a previous run */
+int mpt_state_restore(const struct mpt_state_record *rec, struct mpt_cursor *cursor)
+{
+	const struct mpt_state_copy *copy;
+
+	if (!rec)
+		return 0;
+
+	copy = latest_copy(rec);
+	if (!copy)
+		return 0;
+
+	cursor->last_context = copy->last_context;
+	cursor->last_event = copy->last_event;
+	cursor->last_hash = copy->last_hash;
+	cursor->primed = 1;
+	return 1;
+}
+
+void mpt_state_save(struct mpt_state_record *rec, const struct mpt_cursor *cursor)
+{
+	const struct mpt_state_copy *latest;
+	struct mpt_state_copy *copy;
+	uint32_t seq;
+
+	if (!rec || !cursor->primed)
+		return;
+
+	latest = latest_copy(rec);
+	if (latest && latest->last_context == cursor->last_context &&
+	    latest->last_event == cursor->last_event && latest->last_hash == cursor->last_hash)
+		return;
+
+	// Overwrite the copy that is not the latest valid one
+	seq = latest ? latest->seq + 1 : 1;
+	if (seq == 0)
+		seq = 1;
+	copy = (latest == &rec->copy[0]) ? &rec->copy[1] : &rec->copy[0];
+
+	copy->check = 0;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	copy->seq = seq;
+	copy->last_context = cursor->last_context;
+	copy->last_event = cursor->last_event;
+	copy->last_hash = cursor->last_hash;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	copy->check = copy_check(copy);
+}
@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "mpt.h"
+#include "mptmetrics.h"
+#include "mptstatsd.h"
+
+/* The counters are only ever counted, a push walks them and sends those that
+ * moved since the last one, so the events themselves cost nothing more. The
+ * values last sent are kept by the id of the counter. It all runs on the loop
+ * of the output thread, where the counters are counted.
+ */
+
+#define PACKET_SIZE 1432 // Fits an ethernet frame with the IP and UDP headers
+#define METRIC_MAX 160
+
+struct mpt_statsd_stats mpt_statsd_stats;
+
+static struct mpt_loop *statsd_loop;
+static struct mpt_poll statsd_timer = { .fd = -1 };
+static int statsd_fd = -1;
+static uint64_t *statsd_sent;
+static char packet[PACKET_SIZE];
+static size_t packet_len;
+static int statsd_failed; // A send failed before, it is logged only once
+
+static void send_packet(void)
+{
+	if (!packet_len)
+		return;
+
+	if (send(statsd_fd, packet, packet_len, 0) < 0) {
+		// The daemon being away only shows on every other send, they are counted
+		if (!statsd_failed)
+			my_syslog(LOG_ERR, "Error sending to statsd: %d (%m)", errno);
+		statsd_failed = 1;
+		mpt_statsd_stats.dropped++;
+	} else {
+		mpt_statsd_stats.packets++;
+	}
+	packet_len = 0;
+}
+
+static void push_metric(const struct mpt_metric *m, void *arg)
+{
+	char metric[METRIC_MAX];
+	uint64_t value = m->value;
+	int len;
+
+	// A gauge is sent every time, so the daemon doesn't take it as gone
+	if (!m->gauge) {
+		value -= statsd_sent[m->id];
+		if (!value)
+			return;
+		statsd_sent[m->id] = m->value;
+	}
+
+	len = snprintf(metric, sizeof(metric), "%smptevents.ioc%d.%s%s%s:%"PRIu64"|%c",
+	               packet_len ? "\n" : "", m->ioc, m->name, m->label ? "." : "",
+	               m->label ? m->label_value : "", value, m->gauge ? 'g' : 'c');
+	if (len < 0 || len >= (int)sizeof(metric))
+		return;
+
+	if (packet_len + len > sizeof(packet)) {
+		send_packet();
+		// Without the separator now that it starts a packet
+		memmove(metric, metric + 1, len--);
+	}
+	memcpy(packet + packet_len, metric, len);
+	packet_len += len;
+	mpt_statsd_stats.metrics++;
+}
+
+void mpt_statsd_push(void)
+{
+	if (statsd_fd < 0)
+		return;
+	mpt_metrics_walk(push_metric, NULL);
+	send_packet();
+}
+
+static void handle_statsd_timer(struct mpt_poll *poll, uint32_t events)
+{
+	uint64_t expirations;
+
+	if (read(poll->fd, &expirations, sizeof(expirations)) < 0)
+		return;
+	mpt_statsd_push();
+}
+
+int mpt_statsd_open(struct mpt_loop *loop, const char *addr_spec, unsigned interval_ms)
+{
+	struct sockaddr_in addr;
+	struct itimerspec its;
+
+	if (mpt_metrics_inet_addr(addr_spec, &addr) < 0) {
+		my_syslog(LOG_ERR, "Invalid statsd address %s", addr_spec);
+		return -1;
+	}
+
+	statsd_sent = calloc(mpt_metrics_ids(), sizeof(*statsd_sent));
+	if (!statsd_sent) {
+		my_syslog(LOG_ERR, "Error allocating the statsd counters");
+		return -1;
+	}
+
+	statsd_fd = socket(AF_INET, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (statsd_fd < 0) {
+		my_syslog(LOG_ERR, "Error creating statsd socket: %d (%m)", errno);
+		return -1;
+	}
+	// Connected, a daemon that isn't there shows up as an error on send
+	if (connect(statsd_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		my_syslog(LOG_ERR, "Error connecting to statsd at %s: %d (%m)", addr_spec, errno);
+		return -1;
+	}
+
+	statsd_timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (statsd_timer.fd < 0) {
+		my_syslog(LOG_ERR, "Error creating statsd timer: %d (%m)", errno);
+		return -1;
+	}
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = interval_ms / 1000;
+	its.it_value.tv_nsec = (interval_ms % 1000) * 1000000L;
+	its.it_interval = its.it_value;
+	timerfd_settime(statsd_timer.fd, 0, &its, NULL);
+
+	statsd_loop = loop;
+	statsd_timer.handler = handle_statsd_timer;
+	return mpt_loop_add(loop, &statsd_timer, EPOLLIN);
+}
+
+void mpt_statsd_close(void)
+{
+	mpt_statsd_push();
+
+	if (statsd_timer.fd >= 0) {
+		mpt_loop_del(statsd_loop, &statsd_timer);
+		close(statsd_timer.fd);
+	}
+	statsd_timer.fd = -1;
+	if (statsd_fd >= 0)
+		close(statsd_fd);
+	statsd_fd = -1;
+	free(statsd_sent);
+	statsd_sent = NULL;
+}
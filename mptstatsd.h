@@ -0,0 +1,34 @@
+#ifndef MPTEVENTS_MPTSTATSD_H
+#define MPTEVENTS_MPTSTATSD_H
+
+#include <stdint.h>
+
+#include "mptloop.h"
+
+/* Pushes the counters of mptmetrics.h to a StatsD daemon over UDP at every
+ * interval, for the hosts that can't be scraped. A counter is sent as what
+ * it grew by since the last push, a temperature as a gauge, as
+ *
+ *   mptevents.ioc<N>.<kind>[.<label>]:<value>|c
+ *
+ * with the kind named as in mptmetrics.h and as many of them in a datagram
+ * as fit.
+ */
+
+#define MPT_STATSD_INTERVAL_MS 10000
+
+struct mpt_statsd_stats {
+	uint64_t metrics;
+	uint64_t packets;
+	uint64_t dropped; // Packets that failed to send
+};
+
+extern struct mpt_statsd_stats mpt_statsd_stats;
+
+// To [HOST:]PORT, 127.0.0.1 by default
+int mpt_statsd_open(struct mpt_loop *loop, const char *addr, unsigned interval_ms);
+void mpt_statsd_push(void);
+// Pushes what is left
+void mpt_statsd_close(void);
+
+#endif
@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mptstdout.h"
+
+/* The lines of a wakeup are gathered in one buffer and written together once
+ * the output thread is done with it. A wakeup that goes on for long, draining
+ * a storm say, still writes its lines after DEADLINE_US. The date is formatted
+ * once a second, only the microseconds are put in for each line.
+ *
+ * The reader thread logs too, so the buffer is locked. Its messages are rare
+ * and go out at once, after whatever was batched before them.
+ */
+
+#define OUT_SIZE (256 * 1024)
+#define STAMP_MAX 32 // "YYYY-MM-DD HH:MM:SS.uuuuuu "
+#define DEADLINE_US 100000
+
+struct mpt_stdout_stats mpt_stdout_stats;
+
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	size_t len;
+	unsigned lines;    // Not written yet
+	uint64_t since_us; // The first of them was added
+	char data[OUT_SIZE];
+} out;
+
+static time_t out_second = -1; // That out_time is for
+static char out_time[STAMP_MAX];
+static size_t out_time_len;
+
+static size_t put_stamp(char *p, const struct timespec *ts)
+{
+	unsigned usec = ts->tv_nsec / 1000;
+	int i;
+
+	if (ts->tv_sec != out_second) {
+		struct tm tm;
+
+		localtime_r(&ts->tv_sec, &tm);
+		out_time_len = strftime(out_time, sizeof(out_time), "%Y-%m-%d %H:%M:%S.", &tm);
+		out_second = ts->tv_sec;
+	}
+
+	memcpy(p, out_time, out_time_len);
+	p += out_time_len;
+	for (i = 5; i >= 0; i--, usec /= 10)
+		p[i] = '0' + usec % 10;
+	p[6] = ' ';
+
+	return out_time_len + 7;
+}
+
+static unsigned count_lines(const char *p, size_t len)
+{
+	const char *end = p + len;
+	unsigned lines = 0;
+
+	while ((p = memchr(p, '\n', end - p))) {
+		lines++;
+		p++;
+	}
+
+	return lines;
+}
+
+// Called with out_lock held
+static void write_out(void)
+{
+	struct timespec ts;
+	size_t done = 0;
+
+	while (done < out.len) {
+		ssize_t ret = write(STDOUT_FILENO, out.data + done, out.len - done);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break; // Keep the rest for the next flush
+
+			// Nobody is reading anymore, don't hold on to the lines
+			mpt_stdout_stats.dropped += out.lines - count_lines(out.data, done);
+			out.len = 0;
+			out.lines = 0;
+			return;
+		}
+
+		mpt_stdout_stats.writes++;
+		done += ret;
+	}
+
+	if (done == out.len) {
+		out.len = 0;
+		out.lines = 0;
+		return;
+	}
+
+	out.lines -= count_lines(out.data, done);
+	memmove(out.data, out.data + done, out.len - done);
+	out.len -= done;
+
+	// The rest waits for another deadline rather than a write at each line
+	clock_gettime(CLOCK_REALTIME, &ts);
+	out.since_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void append(int stamp, const char *line, size_t len, int now)
+{
+	struct timespec ts;
+	uint64_t ts_us;
+	char *p;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	pthread_mutex_lock(&out_lock);
+
+	if (out.len + STAMP_MAX + len + 1 > sizeof(out.data))
+		write_out();
+	if (out.len + STAMP_MAX + len + 1 > sizeof(out.data)) {
+		mpt_stdout_stats.dropped++;
+		pthread_mutex_unlock(&out_lock);
+		return;
+	}
+
+	p = out.data + out.len;
+	if (stamp)
+		p += put_stamp(p, &ts);
+	memcpy(p, line, len);
+	p += len;
+	*p++ = '\n';
+	out.len = p - out.data;
+
+	if (out.lines++ == 0)
+		out.since_us = ts_us;
+	mpt_stdout_stats.lines++;
+
+	if (now || ts_us - out.since_us >= DEADLINE_US)
+		write_out();
+
+	pthread_mutex_unlock(&out_lock);
+}
+
+void mpt_stdout_line(int priority, const char *line, size_t len)
+{
+	append(1, line, len, 0);
+}
+
+void mpt_stdout_raw_line(int priority, const char *line, size_t len)
+{
+	append(0, line, len, 0);
+}
+
+void mpt_stdout_message(const char *line, size_t len)
+{
+	append(1, line, len, 1);
+}
+
+int mpt_stdout_flush(void)
+{
+	int held;
+
+	pthread_mutex_lock(&out_lock);
+	if (out.len)
+		write_out();
+	held = out.lines;
+	pthread_mutex_unlock(&out_lock);
+
+	return held;
+}
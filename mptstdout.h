@@ -0,0 +1,28 @@
+#ifndef MPTEVENTS_MPTSTDOUT_H
+#define MPTEVENTS_MPTSTDOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Writes the lines to stdout in batches instead of a write per line, each
+ * stamped with the time to the microsecond.
+ */
+
+struct mpt_stdout_stats {
+	uint64_t lines;
+	uint64_t writes;
+	uint64_t dropped; // Lost to a write error, a closed pipe say
+};
+
+extern struct mpt_stdout_stats mpt_stdout_stats;
+
+// Event lines, they wait for mpt_stdout_flush()
+void mpt_stdout_line(int priority, const char *line, size_t len);
+// Lines that carry their own time, JSON records
+void mpt_stdout_raw_line(int priority, const char *line, size_t len);
+// The daemon's own messages, written at once along with anything batched
+void mpt_stdout_message(const char *line, size_t len);
+// Returns the number of lines still held back, the caller should try again later
+int mpt_stdout_flush(void);
+
+#endif
@@ -0,0 +1,358 @@
+#define _GNU_SOURCE // accept4
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "mpt.h"
+#include "mptdecode.h"
+#include "mptsink.h"
+#include "mptsub.h"
+
+/* Every subscriber is a sink of its own, with a filter to match the records
+ * and a queue that hangs it up once it overflows. They are all served from
+ * the loop of the output thread, where the records are logged.
+ */
+
+#define MAX_SUBSCRIBERS 16
+#define SUB_QUEUE (256 * 1024)
+#define FILTER_MAX 512
+
+struct mpt_sub {
+	struct mpt_sink sink;
+	struct mpt_poll poll;
+	unsigned index; // In subs
+	char name[32];
+	char in[FILTER_MAX]; // A filter line coming in
+	size_t in_len;
+
+	int ready; // Sent its first filter
+	int any_event;
+	uint32_t events[MPI2_EVENT_NOTIFY_EVENTMASK_WORDS];
+	int ioc;    // -1 for any
+	int handle; // -1 for any
+	int has_sas;
+	uint64_t sas;
+};
+
+struct mpt_sub_stats mpt_sub_stats;
+
+static struct mpt_loop *sub_loop;
+static struct mpt_poll listen_poll = { .fd = -1 };
+static const char *listen_path;
+static struct mpt_sub *subs[MAX_SUBSCRIBERS];
+static unsigned subs_nr;
+static unsigned subs_serial;
+
+static void scan_fields(const struct mpt_sub *sub, const struct mpt_field *fields, unsigned nr,
+                        const uint64_t *value, int *handle, int *sas)
+{
+	unsigned i;
+
+	for (i = 0; i < nr; i++) {
+		if ((fields[i].flags & MPT_FIELD_HANDLE) && value[i] == (uint64_t)sub->handle)
+			*handle = 1;
+		if (fields[i].format == MPT_FIELD_SAS && value[i] == sub->sas)
+			*sas = 1;
+	}
+}
+
+static int sub_match(struct mpt_sink *sink, const struct mpt_record *rec)
+{
+	struct mpt_sub *sub = container_of(sink, struct mpt_sub, sink);
+	const struct mpt_list_desc *list = rec->desc->list;
+	int handle = sub->handle < 0;
+	int sas = !sub->has_sas;
+	unsigned i;
+
+	if (!sub->ready)
+		return 0;
+	if (sub->ioc >= 0 && rec->ioc != sub->ioc)
+		return 0;
+	// Whoever follows an ioc wants to know what it missed there
+	if (rec->kind == MPT_RECORD_LOST || rec->kind == MPT_RECORD_RESET)
+		return 1;
+	if (!sub->any_event &&
+	    (rec->event >= MPT_EVENT_TYPES || !(sub->events[rec->event / 32] & (1u << (rec->event % 32)))))
+		return 0;
+	if (handle && sas)
+		return 1;
+
+	scan_fields(sub, rec->desc->fields, rec->desc->fields_nr, rec->value, &handle, &sas);
+	for (i = 0; list && i < rec->entries_nr; i++)
+		scan_fields(sub, list->fields, list->fields_nr, rec->entry[i], &handle, &sas);
+
+	return handle && sas;
+}
+
+static int parse_filter(struct mpt_sub *sub, char *line)
+{
+	char *term, *save;
+	int format = MPT_FORMAT_TEXT;
+
+	sub->any_event = 1;
+	memset(sub->events, 0, sizeof(sub->events));
+	sub->ioc = -1;
+	sub->handle = -1;
+	sub->has_sas = 0;
+
+	for (term = strtok_r(line, " \t\r", &save); term; term = strtok_r(NULL, " \t\r", &save)) {
+		char *value = strchr(term, '=');
+		char *end;
+
+		if (!value) {
+			format = mpt_format_lookup(term);
+			if (format < 0)
+				return -1;
+			continue;
+		}
+
+		*value++ = 0;
+		if (!*value || *value == '-')
+			return -1;
+
+		if (strcmp(term, "event") == 0) {
+			char *item, *item_save;
+
+			sub->any_event = 0;
+			for (item = strtok_r(value, ",", &item_save); item; item = strtok_r(NULL, ",", &item_save)) {
+				int event = mpt_event_lookup(item);
+
+				if (event < 0)
+					return -1;
+				sub->events[event / 32] |= 1u << (event % 32);
+			}
+		} else if (strcmp(term, "ioc") == 0) {
+			long n = strtol(value, &end, 10);
+
+			if (*end || n > UINT16_MAX)
+				return -1;
+			sub->ioc = n;
+		} else if (strcmp(term, "handle") == 0) {
+			unsigned long n = strtoul(value, &end, 16);
+
+			if (*end || n > UINT16_MAX)
+				return -1;
+			sub->handle = n;
+		} else if (strcmp(term, "sas") == 0) {
+			unsigned long long n = strtoull(value, &end, 16);
+
+			if (*end)
+				return -1;
+			sub->sas = n;
+			sub->has_sas = 1;
+		} else {
+			return -1;
+		}
+	}
+
+	mpt_sink_set_format(&sub->sink, format);
+	sub->ready = 1;
+	return 0;
+}
+
+// Best effort, for a subscriber that is about to be closed
+static void tell(int fd, const char *msg)
+{
+	if (send(fd, msg, strlen(msg), MSG_NOSIGNAL|MSG_DONTWAIT) < 0)
+		return;
+}
+
+static void sub_remove(struct mpt_sub *sub)
+{
+	mpt_loop_del(sub_loop, &sub->poll);
+	close(sub->poll.fd);
+	mpt_sink_del(&sub->sink);
+
+	subs[sub->index] = subs[--subs_nr];
+	subs[sub->index]->index = sub->index;
+	free(sub);
+}
+
+static void sub_hangup(struct mpt_sink *sink)
+{
+	struct mpt_sub *sub = container_of(sink, struct mpt_sub, sink);
+
+	// Only an overflow has a time to hang up by, a write error means it left
+	if (sink->closing_ms) {
+		my_syslog(LOG_INFO, "Dropped %s, it didn't keep up with the events", sub->name);
+		mpt_sub_stats.overflows++;
+	}
+	sub_remove(sub);
+}
+
+// Returns -1 once the subscriber is to be closed
+static int sub_read(struct mpt_sub *sub)
+{
+	while (1) {
+		ssize_t ret = read(sub->poll.fd, sub->in + sub->in_len, sizeof(sub->in) - 1 - sub->in_len);
+		char *nl;
+
+		// Done sending filters, it may still be reading
+		if (ret == 0)
+			return 0;
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		sub->in_len += ret;
+
+		while ((nl = memchr(sub->in, '\n', sub->in_len)) != NULL) {
+			size_t used = nl + 1 - sub->in;
+
+			*nl = 0;
+			if (parse_filter(sub, sub->in) < 0) {
+				tell(sub->poll.fd, "Invalid filter\n");
+				return -1;
+			}
+			memmove(sub->in, sub->in + used, sub->in_len - used);
+			sub->in_len -= used;
+		}
+
+		if (sub->in_len == sizeof(sub->in) - 1) {
+			tell(sub->poll.fd, "Filter too long\n");
+			return -1;
+		}
+	}
+}
+
+static void handle_sub(struct mpt_poll *poll, uint32_t events)
+{
+	struct mpt_sub *sub = container_of(poll, struct mpt_sub, poll);
+
+	if ((events & EPOLLIN) && sub_read(sub) < 0) {
+		sub_remove(sub);
+		return;
+	}
+	if (events & (EPOLLHUP|EPOLLERR)) {
+		sub_remove(sub);
+		return;
+	}
+
+	if (events & EPOLLOUT)
+		mpt_sink_write(&sub->sink);
+}
+
+static int sub_add(int fd)
+{
+	struct mpt_sub *sub;
+
+	sub = calloc(1, sizeof(*sub));
+	if (!sub)
+		return -1;
+
+	snprintf(sub->name, sizeof(sub->name), "subscriber %u", ++subs_serial);
+	sub->sink.name = sub->name;
+	sub->sink.format = MPT_FORMAT_TEXT;
+	sub->sink.policy = MPT_SINK_HANGUP;
+	sub->sink.flush_ms = MPT_SINK_FLUSH_BATCH;
+	sub->sink.queue_size = SUB_QUEUE;
+	sub->sink.match = sub_match;
+	sub->sink.hangup = sub_hangup;
+	sub->sink.poll.fd = -1;
+	sub->any_event = 1;
+	sub->ioc = -1;
+	sub->handle = -1;
+
+	if (mpt_sink_add_fd(&sub->sink, fd) < 0) {
+		free(sub);
+		return -1;
+	}
+
+	sub->poll.fd = fd;
+	sub->poll.handler = handle_sub;
+	if (mpt_loop_add(sub_loop, &sub->poll, EPOLLIN|EPOLLOUT|EPOLLET) < 0) {
+		mpt_sink_del(&sub->sink);
+		free(sub);
+		return -1;
+	}
+
+	sub->index = subs_nr;
+	subs[subs_nr++] = sub;
+	mpt_sub_stats.accepted++;
+	return 0;
+}
+
+static void handle_listen(struct mpt_poll *poll, uint32_t events)
+{
+	while (1) {
+		int fd = accept4(poll->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				my_syslog(LOG_ERR, "Error accepting a subscriber: %d (%m)", errno);
+			return;
+		}
+
+		if (subs_nr == MAX_SUBSCRIBERS || sub_add(fd) < 0) {
+			tell(fd, "Too many subscribers\n");
+			close(fd);
+			mpt_sub_stats.rejected++;
+		}
+	}
+}
+
+int mpt_sub_listen(struct mpt_loop *loop, const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		my_syslog(LOG_ERR, "Subscriber socket path %s is too long", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		my_syslog(LOG_ERR, "Error creating subscriber socket: %d (%m)", errno);
+		return -1;
+	}
+
+	// A socket left by an earlier run is in the way, anything else is kept
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, MAX_SUBSCRIBERS) < 0) {
+		my_syslog(LOG_ERR, "Error listening on %s: %d (%m)", path, errno);
+		close(fd);
+		return -1;
+	}
+
+	sub_loop = loop;
+	listen_path = path;
+	listen_poll.fd = fd;
+	listen_poll.handler = handle_listen;
+	return mpt_loop_add(loop, &listen_poll, EPOLLIN);
+}
+
+void mpt_sub_close(void)
+{
+	while (subs_nr) {
+		mpt_sink_write(&subs[0]->sink);
+		sub_remove(subs[0]);
+	}
+
+	if (listen_poll.fd >= 0) {
+		close(listen_poll.fd);
+		unlink(listen_path);
+	}
+	listen_poll.fd = -1;
+}
+
+unsigned mpt_sub_count(void)
+{
+	return subs_nr;
+}
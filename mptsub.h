@@ -0,0 +1,35 @@
+#ifndef MPTEVENTS_MPTSUB_H
+#define MPTEVENTS_MPTSUB_H
+
+#include <stdint.h>
+
+#include "mptloop.h"
+
+/* Streams the events to the local tools connected to a unix socket, each
+ * through a filter of its own. Nothing is sent until a subscriber sends a
+ * line with its filter, space separated terms that all have to match:
+ *
+ *   text or json      the format of the lines (default text)
+ *   event=LIST        a comma separated list of event names or numbers
+ *   ioc=N
+ *   handle=HHHH       a device handle in any of the fields or list entries
+ *   sas=ADDRESS       a SAS address in any of the fields or list entries
+ *
+ * An empty line takes all the events, another line replaces the filter. Lost
+ * events and context resets go to everyone the ioc matches. A subscriber that
+ * doesn't keep up is told so and disconnected.
+ */
+
+struct mpt_sub_stats {
+	uint64_t accepted;
+	uint64_t rejected; // Too many subscribers already
+	uint64_t overflows;
+};
+
+extern struct mpt_sub_stats mpt_sub_stats;
+
+int mpt_sub_listen(struct mpt_loop *loop, const char *path);
+void mpt_sub_close(void);
+unsigned mpt_sub_count(void);
+
+#endif
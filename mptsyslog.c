@@ -0,0 +1,303 @@
+#define _GNU_SOURCE // sendmmsg
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "mpt.h"
+#include "mptsyslog.h"
+
+/* The frames are built here with the hostname and tag formatted once and the
+ * time once a second. They are queued until the output thread is done with a
+ * wakeup and sent together. While the syslog daemon is away, restarting say,
+ * they stay queued and whatever doesn't fit is dropped and counted.
+ *
+ * Only the output thread logs event lines, nothing here is locked.
+ */
+
+#define SEND_LINES 1024 // UIO_MAXIOV, the most a sendmmsg() takes
+#define QUEUE_LINES 4096
+#define QUEUE_BYTES (1024 * 1024)
+#define FRAME_HDR_MAX 512 // The priority, time, hostname and tag
+#define RECONNECT_MS 1000
+#define SEND_TIMEOUT_MS 200
+
+struct mpt_syslog_stats mpt_syslog_stats;
+
+static const char *const syslog_format_names[] = {
+	[MPT_SYSLOG_RFC3164] = "rfc3164",
+	[MPT_SYSLOG_RFC5424] = "rfc5424",
+};
+
+static int sl_fd = -1;
+static enum mpt_syslog_format sl_format;
+static int sl_failing;         // Lost the daemon, don't log every attempt
+static uint64_t reconnect_ms;
+
+static char sl_tag[FRAME_HDR_MAX / 2]; // What follows the time
+static size_t sl_tag_len;
+
+static time_t sl_second = -1;  // That sl_time is for
+static char sl_time[64];
+static size_t sl_time_len;
+
+static struct {
+	size_t len;
+	char data[QUEUE_BYTES];
+} frames;
+static struct iovec iov[QUEUE_LINES];
+static struct mmsghdr msgs[QUEUE_LINES];
+static unsigned queued;
+
+int mpt_syslog_format_lookup(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(syslog_format_names) / sizeof(syslog_format_names[0]); i++) {
+		if (strcasecmp(name, syslog_format_names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static uint64_t sl_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int connect_syslog(void)
+{
+	struct sockaddr_un addr;
+	struct timeval tv = { 0, SEND_TIMEOUT_MS * 1000 };
+	uint64_t now = sl_now_ms();
+	int fd;
+
+	if (now < reconnect_ms)
+		return -1;
+	reconnect_ms = now + RECONNECT_MS;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		my_syslog(LOG_ERR, "Error creating syslog socket: %d (%m)", errno);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, MPT_SYSLOG_PATH, sizeof(addr.sun_path) - 1);
+
+	// A stuck syslog daemon holds the lines back rather than the output thread
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		if (!sl_failing)
+			my_syslog(LOG_ERR, "Error connecting to %s: %d (%m)", MPT_SYSLOG_PATH, errno);
+		sl_failing = 1;
+		close(fd);
+		return -1;
+	}
+
+	sl_fd = fd;
+	if (sl_failing) {
+		my_syslog(LOG_INFO, "Reconnected to %s", MPT_SYSLOG_PATH);
+		mpt_syslog_stats.reconnects++;
+	}
+	sl_failing = 0;
+	return 0;
+}
+
+int mpt_syslog_open(const char *ident, enum mpt_syslog_format format)
+{
+	char host[256];
+	int len;
+
+	sl_format = format;
+	if (format == MPT_SYSLOG_RFC5424) {
+		if (gethostname(host, sizeof(host)) < 0 || !host[0])
+			strcpy(host, "-");
+		host[sizeof(host) - 1] = 0;
+		len = snprintf(sl_tag, sizeof(sl_tag), " %s %s %d - - ", host, ident, getpid());
+	} else {
+		// Like syslog(3) on the local socket, no hostname
+		len = snprintf(sl_tag, sizeof(sl_tag), "%s: ", ident);
+	}
+	if (len < 0 || (size_t)len >= sizeof(sl_tag)) {
+		my_syslog(LOG_ERR, "Syslog tag for %s is too long", ident);
+		return -1;
+	}
+	sl_tag_len = len;
+
+	// Not being able to connect yet is fine, the lines wait for the daemon
+	connect_syslog();
+	return 0;
+}
+
+static void format_time(struct timespec *ts)
+{
+	struct tm tm;
+	char zone[8];
+
+	localtime_r(&ts->tv_sec, &tm);
+	if (sl_format == MPT_SYSLOG_RFC5424) {
+		// The microseconds go after this, and the zone as +hh:mm after them
+		sl_time_len = strftime(sl_time, sizeof(sl_time), "%Y-%m-%dT%H:%M:%S.", &tm);
+		strftime(zone, sizeof(zone), "%z", &tm);
+		sl_time[sl_time_len + 6] = zone[0];
+		sl_time[sl_time_len + 7] = zone[1];
+		sl_time[sl_time_len + 8] = zone[2];
+		sl_time[sl_time_len + 9] = ':';
+		sl_time[sl_time_len + 10] = zone[3];
+		sl_time[sl_time_len + 11] = zone[4];
+	} else {
+		sl_time_len = strftime(sl_time, sizeof(sl_time), "%b %e %H:%M:%S ", &tm);
+	}
+	sl_second = ts->tv_sec;
+}
+
+static size_t build_frame(char *frame, int priority, const char *line, size_t len)
+{
+	struct timespec ts;
+	char *p = frame;
+	int n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (ts.tv_sec != sl_second)
+		format_time(&ts);
+
+	n = snprintf(p, 8, "<%d>", LOG_USER | (priority & LOG_PRIMASK));
+	p += n;
+	if (sl_format == MPT_SYSLOG_RFC5424) {
+		unsigned usec = ts.tv_nsec / 1000;
+		int i;
+
+		*p++ = '1';
+		*p++ = ' ';
+		memcpy(p, sl_time, sl_time_len);
+		p += sl_time_len;
+		for (i = 5; i >= 0; i--, usec /= 10)
+			p[i] = '0' + usec % 10;
+		memcpy(p + 6, sl_time + sl_time_len + 6, 6);
+		p += 12;
+	} else {
+		memcpy(p, sl_time, sl_time_len);
+		p += sl_time_len;
+	}
+	memcpy(p, sl_tag, sl_tag_len);
+	p += sl_tag_len;
+	memcpy(p, line, len);
+	p += len;
+
+	return p - frame;
+}
+
+void mpt_syslog_line(int priority, const char *line, size_t len)
+{
+	char *frame;
+
+	if (queued == QUEUE_LINES || frames.len + FRAME_HDR_MAX + len > sizeof(frames.data))
+		mpt_syslog_flush();
+	if (queued == QUEUE_LINES || frames.len + FRAME_HDR_MAX + len > sizeof(frames.data)) {
+		mpt_syslog_stats.dropped++;
+		return;
+	}
+
+	frame = frames.data + frames.len;
+	iov[queued].iov_base = frame;
+	iov[queued].iov_len = build_frame(frame, priority, line, len);
+	memset(&msgs[queued], 0, sizeof(msgs[queued]));
+	msgs[queued].msg_hdr.msg_iov = &iov[queued];
+	msgs[queued].msg_hdr.msg_iovlen = 1;
+	frames.len += iov[queued].iov_len;
+	queued++;
+}
+
+// Moves the lines that weren't sent to the front
+static void drop_sent(unsigned sent)
+{
+	size_t skip;
+	unsigned i;
+
+	if (sent == 0)
+		return;
+	if (sent == queued) {
+		queued = 0;
+		frames.len = 0;
+		return;
+	}
+
+	skip = (char *)iov[sent].iov_base - frames.data;
+	memmove(frames.data, frames.data + skip, frames.len - skip);
+	frames.len -= skip;
+	for (i = sent; i < queued; i++) {
+		iov[i - sent].iov_base = (char *)iov[i].iov_base - skip;
+		iov[i - sent].iov_len = iov[i].iov_len;
+		msgs[i - sent].msg_hdr.msg_iov = &iov[i - sent];
+	}
+	queued -= sent;
+}
+
+int mpt_syslog_flush(void)
+{
+	unsigned sent = 0;
+
+	if (queued == 0)
+		return 0;
+	if (sl_fd < 0 && connect_syslog() < 0)
+		return queued;
+
+	while (sent < queued) {
+		unsigned count = queued - sent < SEND_LINES ? queued - sent : SEND_LINES;
+		int ret = sendmmsg(sl_fd, msgs + sent, count, MSG_NOSIGNAL);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EMSGSIZE) {
+				// Longer than the daemon takes, skip it rather than stall on it
+				mpt_syslog_stats.dropped++;
+				sent++;
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+				break; // Busy, the rest goes with the next flush
+
+			// The daemon went away, connect again once it is back
+			if (!sl_failing)
+				my_syslog(LOG_ERR, "Error writing to %s: %d (%m)", MPT_SYSLOG_PATH, errno);
+			sl_failing = 1;
+			close(sl_fd);
+			sl_fd = -1;
+			break;
+		}
+
+		mpt_syslog_stats.sends++;
+		mpt_syslog_stats.lines += ret;
+		sent += ret;
+	}
+
+	drop_sent(sent);
+	return queued;
+}
+
+void mpt_syslog_close(void)
+{
+	mpt_syslog_flush();
+	if (queued)
+		mpt_syslog_stats.dropped += queued;
+	queued = 0;
+	frames.len = 0;
+
+	if (sl_fd >= 0)
+		close(sl_fd);
+	sl_fd = -1;
+}
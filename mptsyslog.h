@@ -0,0 +1,34 @@
+#ifndef MPTEVENTS_MPTSYSLOG_H
+#define MPTEVENTS_MPTSYSLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Writes the event lines to the syslog socket without going through
+ * syslog(3), the lines of a wakeup go out in a single sendmmsg().
+ */
+
+#define MPT_SYSLOG_PATH "/dev/log"
+
+enum mpt_syslog_format {
+	MPT_SYSLOG_RFC3164, // What syslog(3) sends
+	MPT_SYSLOG_RFC5424,
+};
+
+struct mpt_syslog_stats {
+	uint64_t lines;
+	uint64_t sends;      // sendmmsg calls
+	uint64_t dropped;    // Didn't fit while the syslog daemon was away
+	uint64_t reconnects;
+};
+
+extern struct mpt_syslog_stats mpt_syslog_stats;
+
+int mpt_syslog_format_lookup(const char *name);
+int mpt_syslog_open(const char *ident, enum mpt_syslog_format format);
+void mpt_syslog_line(int priority, const char *line, size_t len);
+// Returns the number of lines still held back, the caller should try again later
+int mpt_syslog_flush(void);
+void mpt_syslog_close(void);
+
+#endif